@@ -38,7 +38,13 @@ struct AkumuliCursor : DbCursor {
     }
 };
 
-AkumuliConnection::AkumuliConnection(const char *path, bool hugetlb, Durability durability)
+AkumuliConnection::AkumuliConnection(const char *path,
+                                     bool hugetlb,
+                                     Durability durability,
+                                     bool wal,
+                                     uint32_t wal_fsync_interval,
+                                     bool direct_io,
+                                     uint32_t query_threads)
     : dbpath_(path)
 {
     aku_FineTuneParams params = {
@@ -49,7 +55,15 @@ AkumuliConnection::AkumuliConnection(const char *path, bool hugetlb, Durability
         // huge tlbs
         (hugetlb ? 1u : 0u),
         // durability
-        (uint32_t)durability
+        (uint32_t)durability,
+        // write-ahead log
+        (wal ? 1u : 0u),
+        // write-ahead log fsync interval
+        wal_fsync_interval,
+        // direct I/O
+        (direct_io ? 1u : 0u),
+        // query threads
+        query_threads
     };
     db_ = aku_open_database(dbpath_.c_str(), params);
 }
@@ -78,7 +78,22 @@ private:
     std::string     dbpath_;
     aku_Database   *db_;
 public:
-    AkumuliConnection(const char* path, bool hugetlb, Durability durability);
+    /** C-tor
+      * @param path is a path to database
+      * @param hugetlb enables huge pages
+      * @param durability is a durability mode
+      * @param wal enables write-ahead log
+      * @param wal_fsync_interval is a max interval between write-ahead log fsync calls in milliseconds
+      * @param direct_io enables O_DIRECT writes to volumes
+      * @param query_threads is a number of threads used to scan volumes in parallel
+      */
+    AkumuliConnection(const char* path,
+                      bool hugetlb,
+                      Durability durability,
+                      bool wal = false,
+                      uint32_t wal_fsync_interval = 0u,
+                      bool direct_io = false,
+                      uint32_t query_threads = 0u);
 
     virtual aku_Status write(const aku_Sample &sample);
 
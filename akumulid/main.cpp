@@ -34,12 +34,14 @@ void create_db(const char* name,
                int32_t nvolumes,
                uint32_t compression_threshold,
                uint64_t window_size,
-               uint32_t max_cache_size)
+               uint32_t max_cache_size,
+               uint64_t volume_size)
 {
     auto status = aku_create_database(name, path, path, nvolumes,
                                       compression_threshold,
                                       window_size,
                                       max_cache_size,
+                                      volume_size,
                                       &static_logger);
     if (status != AKU_SUCCESS) {
         std::cout << "Error creating database" << std::endl;
@@ -53,11 +55,20 @@ void create_db(const char* name,
     }
 }
 
-void run_server(std::string path) {
+void run_server(std::string path, po::variables_map const& vm) {
+
+    bool wal = vm.count("wal") ? vm["wal"].as<bool>() : false;
+    uint32_t wal_fsync_interval = vm.count("wal-fsync-interval") ? vm["wal-fsync-interval"].as<uint32_t>() : 0u;
+    bool direct_io = vm.count("direct-io") ? vm["direct-io"].as<bool>() : false;
+    uint32_t query_threads = vm.count("query-threads") ? vm["query-threads"].as<uint32_t>() : 0u;
 
     auto connection = std::make_shared<AkumuliConnection>(path.c_str(),
                                                           false,
-                                                          AkumuliConnection::MaxDurability);
+                                                          AkumuliConnection::MaxDurability,
+                                                          wal,
+                                                          wal_fsync_interval,
+                                                          direct_io,
+                                                          query_threads);
 
     auto tcp_server = std::make_shared<TcpServer>(connection, 4);
 
@@ -97,6 +108,7 @@ int main(int argc, char** argv) {
             ("name", po::value<std::string>(),      "Database name (create)")
             ("nvolumes", po::value<int32_t>(),      "Number of volumes to create (create)")
             ("window", po::value<std::string>(),    "Window size (create)")
+            ("volume-size", po::value<uint64_t>(),  "Volume size in bytes, 4GB by default (create)")
             ;
 
     po::options_description generic_options;
@@ -104,15 +116,31 @@ int main(int argc, char** argv) {
             ("path", po::value<std::string>(),      "Path to database files")
             ;
 
+    // Storage options, can be set in the config file or overridden from command line
+    po::options_description storage_options;
+    storage_options.add_options()
+            ("wal", po::value<bool>(),                  "Enable write-ahead log (server)")
+            ("wal-fsync-interval", po::value<uint32_t>(), "Max interval between write-ahead log fsync calls in ms, "
+                                                        "0 - fsync on every write (server)")
+            ("direct-io", po::value<bool>(),            "Write volumes using O_DIRECT instead of mmap (server)")
+            ("query-threads", po::value<uint32_t>(),    "Number of threads used to scan volumes in parallel (server)")
+            ;
+
+    po::options_description cli_options;
+    cli_options.add(cli_only_options).add(storage_options);
+
+    po::options_description config_options;
+    config_options.add(generic_options).add(storage_options);
+
     po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, cli_only_options), vm);
+    po::store(po::parse_command_line(argc, argv, cli_options), vm);
     auto path2cfg = boost::filesystem::path(getenv("HOME"));
     path2cfg /= ".akumulid";
     std::fstream config_file(path2cfg.c_str());
-    po::store(po::parse_config_file(config_file, generic_options, true), vm);  // allow_unregistered=true
+    po::store(po::parse_config_file(config_file, config_options, true), vm);  // allow_unregistered=true
     po::notify(vm);
     if (vm.count("help")) {
-        std::cout << cli_only_options << std::endl;
+        std::cout << cli_options << std::endl;
         return 0;
     }
     if (!vm.count("path")) {
@@ -129,10 +157,11 @@ int main(int argc, char** argv) {
         std::string name = vm["name"].as<std::string>();
         int32_t nvol = vm["nvolumes"].as<int32_t>();
         std::string window = vm["window"].as<std::string>();
-        create_db(name.c_str(), path.c_str(), nvol, 10000, str2unixtime(window), 100000);  // TODO: use correct numbers
+        uint64_t volume_size = vm.count("volume-size") ? vm["volume-size"].as<uint64_t>() : 0u;
+        create_db(name.c_str(), path.c_str(), nvol, 10000, str2unixtime(window), 100000, volume_size);  // TODO: use correct numbers
     }
 
-    run_server(path);
+    run_server(path, vm);
 
     return 0;
 }
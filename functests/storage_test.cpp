@@ -237,7 +237,7 @@ struct LocalStorage : Storage {
     virtual void create_new()
     {
         apr_status_t result = aku_create_database(DBNAME_, work_dir_.c_str(), work_dir_.c_str(), n_volumes_,
-                                                  compression_threshold_, sliding_window_size_, 0, nullptr);
+                                                  compression_threshold_, sliding_window_size_, 0, 0, nullptr);
         throw_on_error(result);
     }
 
@@ -250,6 +250,10 @@ struct LocalStorage : Storage {
         aku_FineTuneParams params;
         params.durability = durability_;
         params.enable_huge_tlb = enable_huge_tlb_ ? 1 : 0;
+        params.enable_wal = 0;
+        params.wal_fsync_interval = 0;
+        params.enable_direct_io = 0;
+        params.query_threads = 0;
         params.logger = &aku_console_logger;
         std::string path = get_db_file_path();
         db_ = aku_open_database(path.c_str(), params);
@@ -139,6 +139,13 @@ typedef struct {
     uint64_t n_volumes;       //< Total number of volumes
     uint64_t free_space;      //< Free space total
     uint64_t used_space;      //< Space in use
+    struct {
+        uint64_t n_hits;      //< Number of chunk cache hits
+        uint64_t n_misses;    //< Number of chunk cache misses
+        uint64_t n_evictions; //< Number of evicted chunks
+        uint64_t n_rejected;  //< Number of chunks that wasn't admitted to cache
+        uint64_t size;        //< Size of the cached chunks in bytes
+    } cache;
 } aku_StorageStats;
 
 
@@ -180,6 +187,7 @@ AKU_EXPORT void aku_destroy(void* any);
  * @param metadata_path path to metadata file
  * @param volumes_path path to volumes
  * @param num_volumes number of volumes to create
+ * @param volume_size size of the volume in bytes (4GB max, volumes are created sparse)
  * @return APR errorcode or APR_SUCCESS
  * TODO: move from apr_status_t to aku_Status
  */
@@ -192,6 +200,7 @@ AKU_EXPORT apr_status_t aku_create_database
                                 , uint32_t  compression_threshold
                                 , uint64_t  window_size
                                 , uint64_t  max_cache_size
+                                , uint64_t  volume_size
                                 , aku_logger_cb_t logger
                                 );
 
@@ -50,11 +50,25 @@ typedef struct
     //! Pointer to logging function, can be null
     aku_logger_cb_t logger;
 
-    //! 0 - huge tlbs disabled, other value - enabled
+    /** 0 - huge tlbs disabled, other value - enabled (volumes are mapped using huge pages,
+      * in-memory structures are allocated from huge page arena, the arena is process wide)
+      */
     uint32_t enable_huge_tlb;
 
     //! Consistency-speed tradeoff, 1 - max durability, 2 - tradeoff some durability for speed, 4 - max speed
     uint32_t durability;
 
+    //! 0 - write-ahead log disabled, other value - enabled
+    uint32_t enable_wal;
+
+    //! Max interval between write-ahead log fsync calls in milliseconds (0 - fsync on every write)
+    uint32_t wal_fsync_interval;
+
+    //! 0 - volumes are written through shared mmap, other value - volumes are written using pwrite (O_DIRECT)
+    uint32_t enable_direct_io;
+
+    //! Number of threads used to scan volumes in parallel (0 or 1 - volumes are scanned sequentially)
+    uint32_t query_threads;
+
 } aku_FineTuneParams;
 
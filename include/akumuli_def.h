@@ -112,10 +112,16 @@
 #define AKU_CHUNK_FWD_ID                0xFFFFFFFFFFFFFFFEul
 //! Id for backward scanning
 #define AKU_CHUNK_BWD_ID                0xFFFFFFFFFFFFFFFFul
+//! Ids of the series produced by queries (groups, combined series) start from this value
+#define AKU_QUERY_SERIES_ID             0x8000000000000000ul
 
 // Defaults
 #define AKU_DEFAULT_COMPRESSION_THRESHOLD 0x1000u
 #define AKU_DEFAULT_WINDOW_SIZE 10000ul
 #define AKU_DEFAULT_MAX_CACHE_SIZE 0x100000u
+#define AKU_DEFAULT_VOLUME_SIZE 0x100000000ul
+
+//! Smallest volume size allowed
+#define AKU_MIN_VOLUME_SIZE 0x1000000ul
 
 #endif
@@ -196,6 +196,7 @@ apr_status_t aku_create_database( const char     *file_name
                                 , uint32_t  compression_threshold
                                 , uint64_t  window_size
                                 , uint64_t  max_cache_size
+                                , uint64_t  volume_size
                                 , aku_logger_cb_t logger)
 {
     if (logger == nullptr) {
@@ -210,9 +211,12 @@ apr_status_t aku_create_database( const char     *file_name
     if (max_cache_size == 0) {
         max_cache_size = AKU_DEFAULT_MAX_CACHE_SIZE;
     }
+    if (volume_size == 0) {
+        volume_size = AKU_DEFAULT_VOLUME_SIZE;
+    }
     return Storage::new_storage(file_name, metadata_path, volumes_path, num_volumes,
                                 compression_threshold, window_size, max_cache_size,
-                                logger);
+                                volume_size, logger);
 }
 
 apr_status_t aku_remove_database(const char* file_name, aku_logger_cb_t logger) {
@@ -1,56 +1,266 @@
 #include "buffer_cache.h"
 
+#include <algorithm>
+
 namespace Akumuli {
 
+static uint64_t hash_key(ChunkCache::KeyT const& key) {
+    uint64_t h = static_cast<uint32_t>(std::get<0>(key));
+    h = (h << 32) | static_cast<uint32_t>(std::get<1>(key));
+    // 64-bit finalizer from MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+//                         //
+//      Decoded chunk      //
+//                         //
+
+static size_t align_size(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+DecodedChunk::DecodedChunk(UncompressedChunk const& chunk)
+    : block_(nullptr)
+    , block_size_(0u)
+    , size_(static_cast<uint32_t>(chunk.timestamps.size()))
+    , blob_mask_(nullptr)
+    , min_value_(std::numeric_limits<double>::infinity())
+    , max_value_(-std::numeric_limits<double>::infinity())
+{
+    if (chunk.paramids.size() != size_ || chunk.values.size() != size_) {
+        AKU_PANIC("Bad chunk");
+    }
+    bool has_blobs = false;
+    for (auto const& value: chunk.values) {
+        if (value.type == ChunkValue::BLOB) {
+            has_blobs = true;
+            break;
+        }
+    }
+    size_t ts_size = align_size(size_*sizeof(aku_Timestamp));
+    size_t id_size = align_size(size_*sizeof(aku_ParamId));
+    size_t values_size = align_size(size_*sizeof(double));
+    size_t mask_size = has_blobs ? ((size_ + 63) / 64)*sizeof(uint64_t) : 0u;
+    block_size_ = ts_size + id_size + values_size + mask_size;
+    block_ = static_cast<char*>(HugePageArena::instance().allocate(block_size_));
+    timestamps_ = reinterpret_cast<aku_Timestamp*>(block_);
+    paramids_ = reinterpret_cast<aku_ParamId*>(block_ + ts_size);
+    values_ = reinterpret_cast<double*>(block_ + ts_size + id_size);
+    if (has_blobs) {
+        blob_mask_ = reinterpret_cast<uint64_t*>(block_ + ts_size + id_size + values_size);
+        std::fill(blob_mask_, blob_mask_ + mask_size/sizeof(uint64_t), 0ull);
+    }
+
+    // Chunk order - data ordered by series id first and then by timestamp,
+    // time order - by timestamp first and by series id second.
+    std::vector<uint32_t> index(size_);
+    for (uint32_t i = 0; i < size_; i++) {
+        index[i] = i;
+    }
+    std::stable_sort(index.begin(), index.end(), [&chunk](uint32_t lhs, uint32_t rhs) {
+        return std::make_tuple(chunk.timestamps[lhs], chunk.paramids[lhs]) <
+               std::make_tuple(chunk.timestamps[rhs], chunk.paramids[rhs]);
+    });
+    for (uint32_t i = 0; i < size_; i++) {
+        auto ix = index[i];
+        timestamps_[i] = chunk.timestamps[ix];
+        paramids_[i] = chunk.paramids[ix];
+        auto const& value = chunk.values[ix];
+        if (value.type == ChunkValue::BLOB) {
+            memcpy(&values_[i], &value.value.blobval, sizeof(double));
+            blob_mask_[i >> 6] |= 1ull << (i & 63);
+        } else {
+            values_[i] = value.value.floatval;
+            min_value_ = std::min(min_value_, values_[i]);
+            max_value_ = std::max(max_value_, values_[i]);
+        }
+    }
+}
+
+DecodedChunk::~DecodedChunk() {
+    HugePageArena::instance().deallocate(block_, block_size_);
+}
+
+//                          //
+//     Frequency sketch     //
+//                          //
+
+ChunkCache::FrequencySketch::FrequencySketch(size_t width)
+    : table_(width*DEPTH, 0u)
+    , mask_(width - 1)
+    , period_(width*10)
+    , nsamples_(0u)
+{
+}
+
+static size_t sketch_index(uint64_t hash, int row, size_t mask) {
+    static const uint64_t SEEDS[] = {
+        0x97cb3127ull, 0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull, 0x9ae16a3b2f90404full
+    };
+    uint64_t h = (hash + SEEDS[row]) * SEEDS[(row + 1) % 4];
+    h ^= h >> 32;
+    return static_cast<size_t>(row)*(mask + 1) + (h & mask);
+}
+
+void ChunkCache::FrequencySketch::increment(uint64_t hash) {
+    for (int row = 0; row < DEPTH; row++) {
+        auto& counter = table_[sketch_index(hash, row, mask_)];
+        if (counter < 0xFF) {
+            counter++;
+        }
+    }
+    if (++nsamples_ == period_) {
+        // Aging
+        for (auto& counter: table_) {
+            counter >>= 1;
+        }
+        nsamples_ = 0;
+    }
+}
+
+int ChunkCache::FrequencySketch::estimate(uint64_t hash) const {
+    int result = 0xFF;
+    for (int row = 0; row < DEPTH; row++) {
+        result = std::min(result, static_cast<int>(table_[sketch_index(hash, row, mask_)]));
+    }
+    return result;
+}
+
+//                  //
+//     Chunk cache  //
+//                  //
+
+size_t ChunkCache::KeyHash::operator () (KeyT const& key) const {
+    return static_cast<size_t>(hash_key(key));
+}
+
+ChunkCache::Shard::Shard(size_t sketch_width)
+    : hand(ring.end())
+    , size(0u)
+    , sketch(sketch_width)
+    , n_hits(0u)
+    , n_misses(0u)
+    , n_evictions(0u)
+    , n_rejected(0u)
+{
+}
+
 ChunkCache::ChunkCache(size_t limit)
-    : total_size_(0ul)
-    , size_limit_(limit)
 {
+    size_t nshards = NSHARDS;
+    while (nshards > 1 && limit / nshards < MIN_SHARD_SIZE) {
+        nshards /= 2;
+    }
+    shard_limit_ = limit / nshards;
+    // Sketch should be wide enough to track much more entries than can fit in the
+    // shard (assuming that chunk takes at least 4KB), otherwise collisions will
+    // make estimates useless
+    size_t width = 0x400;
+    while (width < shard_limit_ / 0x1000 && width < 0x10000) {
+        width <<= 1;
+    }
+    for (size_t i = 0; i < nshards; i++) {
+        shards_.emplace_back(new Shard(width));
+    }
+}
+
+ChunkCache::Shard& ChunkCache::get_shard_(uint64_t hash) const {
+    // Number of shards is a power of two not greater than 16
+    return *shards_[(hash >> 60) & (shards_.size() - 1)];
+}
+
+ChunkCache::RingT::iterator ChunkCache::next_victim_(Shard& shard) {
+    while (true) {
+        if (shard.hand == shard.ring.end()) {
+            shard.hand = shard.ring.begin();
+        }
+        if (!shard.hand->referenced) {
+            return shard.hand;
+        }
+        shard.hand->referenced = false;
+        ++shard.hand;
+    }
 }
 
 bool ChunkCache::contains(KeyT key) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return cache_.count(key) > 0;
+    auto& shard = get_shard_(hash_key(key));
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.index.count(key) > 0;
 }
 
 ChunkCache::ItemT ChunkCache::get(KeyT key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = cache_.find(key);
-    if (it == cache_.end()) {
+    auto hash = hash_key(key);
+    auto& shard = get_shard_(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Misses are counted too, item that is requested often should be admitted
+    shard.sketch.increment(hash);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        shard.n_misses++;
         return ItemT();
     }
-    return it->second;
+    shard.n_hits++;
+    it->second->referenced = true;
+    return it->second->item;
 }
 
-static size_t get_size(const std::shared_ptr<UncompressedChunk>& header) {
-    return header->paramids.size()   * sizeof(aku_ParamId) +
-           header->timestamps.size() * sizeof(aku_Timestamp) +
-           header->values.size()     * sizeof(ChunkValue);
+void ChunkCache::put(KeyT key, ItemT const& chunk) {
+    auto szdelta = chunk->mem_size();
+    auto hash = hash_key(key);
+    auto& shard = get_shard_(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        // Replace item
+        shard.size -= it->second->size;
+        if (shard.hand == it->second) {
+            ++shard.hand;
+        }
+        shard.ring.erase(it->second);
+        shard.index.erase(it);
+    }
+    auto frequency = shard.sketch.estimate(hash);
+    while (shard.size + szdelta > shard_limit_ && !shard.ring.empty()) {
+        auto victim = next_victim_(shard);
+        if (shard.sketch.estimate(hash_key(victim->key)) > frequency) {
+            // Admission policy: victim is more valuable than the new item
+            shard.n_rejected++;
+            return;
+        }
+        shard.size -= victim->size;
+        shard.index.erase(victim->key);
+        shard.hand = shard.ring.erase(victim);
+        shard.n_evictions++;
+    }
+    // New entry is placed behind the hand so it will be checked last
+    Entry entry = { key, chunk, szdelta, false };
+    shard.index[key] = shard.ring.insert(shard.hand, entry);
+    shard.size += szdelta;
 }
 
-void ChunkCache::put(KeyT key, const std::shared_ptr<UncompressedChunk>& header) {
-    auto szdelta = get_size(header);
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (total_size_ + szdelta > size_limit_) {
-        if (!fifo_.empty()) {
-            // Eviction
-            KeyT ekey;
-            size_t esz;
-            std::tie(ekey, esz) = fifo_.back();
-            fifo_.pop_back();
-            auto it = cache_.find(ekey);
-            if (it != cache_.end()) {
-                cache_.erase(it);
-            } else {
-                // TODO: report error (inconsistent cache)
-            }
-            total_size_ -= esz;
-        }
+size_t ChunkCache::size() const {
+    size_t result = 0u;
+    for (auto const& shard: shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        result += shard->size;
     }
-    fifo_.push_front(std::make_tuple(key, szdelta));
-    cache_[key] = header;
-    total_size_ += szdelta;
+    return result;
 }
 
+void ChunkCache::get_stats(aku_StorageStats* rcv_stats) const {
+    for (auto const& shard: shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        rcv_stats->cache.n_hits      += shard->n_hits;
+        rcv_stats->cache.n_misses    += shard->n_misses;
+        rcv_stats->cache.n_evictions += shard->n_evictions;
+        rcv_stats->cache.n_rejected  += shard->n_rejected;
+        rcv_stats->cache.size        += shard->size;
+    }
 }
 
+}
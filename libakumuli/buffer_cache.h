@@ -1,35 +1,178 @@
 #pragma once
 
+#include "akumuli_def.h"
 #include "compression.h"
+#include "util.h"
 
-#include <map>
+#include <cstring>
+#include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace Akumuli {
 
+/** Decoded chunk in compact columnar form.
+  * Rows are stored in time order. All columns are stored in one memory block
+  * (allocated from HugePageArena): timestamps, series ids, values and bitmap that
+  * marks blob rows. Bitmap is present only if chunk contains blobs, blob descriptors
+  * are stored in the values column.
+  */
+class DecodedChunk {
+    static_assert(sizeof(ChunkValue::blob_t) == sizeof(double), "blob descriptor should fit value slot");
+
+    char*           block_;
+    size_t          block_size_;
+    uint32_t        size_;
+    aku_Timestamp*  timestamps_;
+    aku_ParamId*    paramids_;
+    double*         values_;
+    uint64_t*       blob_mask_;     //< Set bit means that row contains blob (null if there is no blobs)
+    double          min_value_;     //< Smallest float value (+inf if there is no float values)
+    double          max_value_;     //< Largest float value (-inf if there is no float values)
+
+public:
+    /** Convert chunk from chunk order (used on disk) to time order.
+      * @throws Exception if chunk is malformed
+      */
+    explicit DecodedChunk(UncompressedChunk const& chunk);
+
+    ~DecodedChunk();
+
+    DecodedChunk(DecodedChunk const&) = delete;
+    DecodedChunk& operator = (DecodedChunk const&) = delete;
+
+    //! Number of rows
+    uint32_t size() const { return size_; }
+
+    //! Number of bytes used by the chunk
+    size_t mem_size() const { return sizeof(DecodedChunk) + block_size_; }
+
+    aku_Timestamp const* timestamps() const { return timestamps_; }
+
+    aku_ParamId const* paramids() const { return paramids_; }
+
+    bool has_blobs() const { return blob_mask_ != nullptr; }
+
+    bool is_blob(uint32_t ix) const {
+        return blob_mask_ != nullptr && (blob_mask_[ix >> 6] >> (ix & 63)) & 1;
+    }
+
+    //! Values column (slots of the blob rows contain blob descriptors)
+    double const* values() const { return values_; }
+
+    double get_float(uint32_t ix) const { return values_[ix]; }
+
+    //! Smallest float value of the chunk (used to skip chunks that can't match value filter)
+    double min_value() const { return min_value_; }
+
+    //! Largest float value of the chunk
+    double max_value() const { return max_value_; }
+
+    ChunkValue::blob_t get_blob(uint32_t ix) const {
+        ChunkValue::blob_t blob;
+        memcpy(&blob, &values_[ix], sizeof(blob));
+        return blob;
+    }
+};
+
+/** Cache of decoded chunks.
+  * Cache is split into shards to reduce lock contention, shard is selected using key hash
+  * and each shard gets equal part of the size limit. Small caches use fewer shards so each
+  * shard can hold a few chunks of the default size. Entries are evicted using CLOCK
+  * algorithm. New entry is admitted only if it was accessed at least as often as eviction
+  * candidate (TinyLFU admission policy), access frequencies are estimated using count-min
+  * sketch. This makes cache scan resistant: chunks read once by large historical query
+  * can't evict frequently used chunks.
+  */
 struct ChunkCache
 {
     //! Volume id + entry index
     typedef std::tuple<int, int> KeyT;
-    typedef std::tuple<KeyT, size_t> QueueItemT;
-    typedef std::shared_ptr<UncompressedChunk> ItemT;
+    typedef std::shared_ptr<DecodedChunk> ItemT;
 
-    std::map<KeyT, ItemT> cache_;
-    std::list<QueueItemT> fifo_;
-    size_t                total_size_;
-    mutable std::mutex    mutex_;
-    const size_t          size_limit_;
+    //! Max number of shards
+    static const int NSHARDS = 16;
+    //! Min size of the shard (four decoded chunks of the default size)
+    static const size_t MIN_SHARD_SIZE = 4*AKU_DEFAULT_COMPRESSION_THRESHOLD*
+                                         (sizeof(aku_Timestamp) + sizeof(aku_ParamId) + sizeof(double));
+
+private:
+    /** Count-min sketch of access frequencies.
+      * Counters are halved periodically so old history fades away.
+      */
+    struct FrequencySketch {
+        static const int DEPTH = 4;
+        std::vector<uint8_t> table_;    //< DEPTH rows of counters
+        const size_t         mask_;     //< Row width - 1
+        const size_t         period_;   //< Number of increments between aging
+        size_t               nsamples_;
+
+        FrequencySketch(size_t width);
+
+        void increment(uint64_t hash);
+
+        int estimate(uint64_t hash) const;
+    };
+
+    struct Entry {
+        KeyT   key;
+        ItemT  item;
+        size_t size;
+        bool   referenced;  //< Reference bit of the CLOCK algorithm
+    };
+
+    struct KeyHash {
+        size_t operator () (KeyT const& key) const;
+    };
+
+    typedef std::list<Entry> RingT;
+
+    struct Shard {
+        std::mutex                                  mutex;
+        RingT                                       ring;       //< CLOCK ring
+        RingT::iterator                             hand;       //< CLOCK hand
+        std::unordered_map<KeyT, RingT::iterator, KeyHash> index;
+        size_t                                      size;       //< Size of all entries in bytes
+        FrequencySketch                             sketch;
+        uint64_t                                    n_hits;
+        uint64_t                                    n_misses;
+        uint64_t                                    n_evictions;
+        uint64_t                                    n_rejected;
+
+        Shard(size_t sketch_width);
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t                              shard_limit_;   //< Size limit of the each shard
+
+    Shard& get_shard_(uint64_t hash) const;
+
+    //! Find eviction candidate (shard should be locked and not empty)
+    static RingT::iterator next_victim_(Shard& shard);
+
+public:
 
     ChunkCache(size_t limit);
 
     bool contains(KeyT key) const;
 
+    //! Get item from cache, returns null if item is not cached
     ItemT get(KeyT key);
 
-    void put(KeyT key, const std::shared_ptr<UncompressedChunk>& header);
+    /** Add item to cache.
+      * Item can be rejected if it's not used frequently enough. Item that is larger than
+      * the shard is admitted only if the shard is empty (or can be emptied).
+      */
+    void put(KeyT key, ItemT const& chunk);
+
+    //! Number of bytes used by cached items
+    size_t size() const;
+
+    //! Add cache counters to `rcv_stats`
+    void get_stats(aku_StorageStats* rcv_stats) const;
 };
 
 }
-
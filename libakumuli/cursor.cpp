@@ -170,8 +170,13 @@ StacklessFanInCursorCombinator::StacklessFanInCursorCombinator(
         int direction)
     : direction_(direction)
     , in_cursors_(in_cursors, in_cursors + size)
-    , pred_{direction}
+    , buffers_(static_cast<size_t>(size))
+    , positions_(static_cast<size_t>(size), 0u)
+    , tree_(static_cast<uint32_t>(size))
 {
+    if (direction_ != AKU_CURSOR_DIR_FORWARD && direction_ != AKU_CURSOR_DIR_BACKWARD) {
+        AKU_PANIC("bad direction of the fan-in cursor");
+    }
     int error = AKU_SUCCESS;
     for (auto cursor: in_cursors_) {
         if (cursor->is_error(&error)) {
@@ -180,56 +185,62 @@ StacklessFanInCursorCombinator::StacklessFanInCursorCombinator(
         }
     }
 
-    const size_t BUF_LEN = 0x200;
-    aku_Sample buffer[BUF_LEN];
     for(auto cur_index = 0u; cur_index < in_cursors_.size(); cur_index++) {
-        if (!in_cursors_[cur_index]->is_done()) {
-            ExternalCursor* cursor = in_cursors_[cur_index];
-            size_t nwrites = cursor->read(buffer, BUF_LEN);
-            if (cursor->is_error(&error)) {
-                set_error(error);
-                return;
-            }
-            for (size_t buf_ix = 0u; buf_ix < nwrites; buf_ix++) {
-                auto cur_count = nwrites - buf_ix;
-                auto key = std::make_tuple(buffer[buf_ix], cur_index, cur_count);
-                heap_.push_back(key);
-            }
+        if (refill_(cur_index)) {
+            tree_.set(cur_index, key_(buffers_[cur_index].front()));
+        } else if (cursor_fsm_.get_error(&error)) {
+            return;
         }
     }
+    tree_.build();
+}
 
-    std::make_heap(heap_.begin(), heap_.end(), pred_);
+MergeKey StacklessFanInCursorCombinator::key_(aku_Sample const& sample) const {
+    return direction_ == AKU_CURSOR_DIR_FORWARD
+         ? make_merge_key<AKU_CURSOR_DIR_FORWARD>(sample.timestamp, sample.paramid)
+         : make_merge_key<AKU_CURSOR_DIR_BACKWARD>(sample.timestamp, sample.paramid);
 }
 
-void StacklessFanInCursorCombinator::read_impl_() {
-    // Check preconditions
-    int error = 0;
-    bool proceed = true;
+bool StacklessFanInCursorCombinator::refill_(uint32_t cur_index) {
     const size_t BUF_LEN = 0x200;
-    aku_Sample buffer[BUF_LEN];
-    while(proceed && !heap_.empty()) {
-        std::pop_heap(heap_.begin(), heap_.end(), pred_);
-        auto item = heap_.back();
-        const aku_Sample& cur_result = std::get<0>(item);
-        int cur_index = std::get<1>(item);
-        int cur_count = std::get<2>(item);
-        proceed = put(cur_result);
-        heap_.pop_back();
-        if (cur_count == 1 && !in_cursors_[cur_index]->is_done()) {
-            ExternalCursor* cursor = in_cursors_[cur_index];
-            size_t nwrites = cursor->read(buffer, BUF_LEN);
-            if (cursor->is_error(&error)) {
-                set_error(error);
+    ExternalCursor* cursor = in_cursors_[cur_index];
+    Buffer& buffer = buffers_[cur_index];
+    buffer.resize(BUF_LEN);
+    positions_[cur_index] = 0u;
+    size_t nwrites = 0u;
+    while (nwrites == 0u && !cursor->is_done()) {
+        nwrites = cursor->read(buffer.data(), BUF_LEN);
+        int error = AKU_SUCCESS;
+        if (cursor->is_error(&error)) {
+            set_error(error);
+            nwrites = 0u;
+            break;
+        }
+    }
+    buffer.resize(nwrites);
+    return nwrites != 0u;
+}
+
+void StacklessFanInCursorCombinator::read_impl_() {
+    int error = AKU_SUCCESS;
+    if (cursor_fsm_.is_done()) {
+        return;
+    }
+    while(!tree_.empty() && cursor_fsm_.can_put()) {
+        uint32_t cur_index = tree_.top();
+        Buffer& buffer = buffers_[cur_index];
+        size_t& pos = positions_[cur_index];
+        put(buffer[pos++]);
+        if (pos == buffer.size() && !refill_(cur_index)) {
+            if (cursor_fsm_.get_error(&error)) {
                 return;
             }
-            for (size_t buf_ix = 0u; buf_ix < nwrites; buf_ix++) {
-                auto key = std::make_tuple(buffer[buf_ix], cur_index, nwrites - buf_ix);
-                heap_.push_back(key);
-                std::push_heap(heap_.begin(), heap_.end(), pred_);
-            }
+            tree_.pop_top();
+            continue;
         }
+        tree_.replace_top(key_(buffer[pos]));
     }
-    if (heap_.empty()) {
+    if (tree_.empty()) {
         complete();
     }
 }
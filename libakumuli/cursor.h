@@ -28,6 +28,7 @@
 #include "akumuli.h"
 #include "internal_cursor.h"
 #include "page.h"
+#include "loser_tree.h"
 
 namespace Akumuli {
 
@@ -147,28 +148,6 @@ struct CoroCursor : Cursor {
     }
 };
 
-typedef std::tuple<aku_Sample, int, int> HeapItem;
-
-struct HeapPred {
-    int dir;
-    bool operator () (HeapItem const& lhs, HeapItem const& rhs) const {
-        bool result = false;
-        const aku_Sample& lres = std::get<0>(lhs);
-        const aku_Sample& rres = std::get<0>(rhs);
-        const auto lkey = std::make_tuple(lres.timestamp, lres.paramid);
-        const auto rkey = std::make_tuple(rres.timestamp, rres.paramid);
-        if (dir == AKU_CURSOR_DIR_BACKWARD) {
-            // Min heap is used
-            result = lkey < rkey;
-        } else if (dir == AKU_CURSOR_DIR_FORWARD) {
-            result = lkey > rkey;
-        } else {
-            AKU_PANIC("bad direction of the fan-in cursor")
-        }
-        return result;
-    }
-};
-
 /**
  * @brief Fan in cursor.
  * Takes list of cursors and pages and merges
@@ -176,13 +155,17 @@ struct HeapPred {
  * sequence of events.
  */
 class StacklessFanInCursorCombinator : ExternalCursor {
-    typedef std::vector<HeapItem> Heap;
+    typedef std::vector<aku_Sample> Buffer;
     const int                           direction_;
     const std::vector<ExternalCursor*>  in_cursors_;
-    const HeapPred                      pred_;
-    Heap                                heap_;
+    std::vector<Buffer>                 buffers_;     //< Prefetched samples for each input cursor
+    std::vector<size_t>                 positions_;   //< Read position inside each buffer
+    LoserTree                           tree_;
     CursorFSM                           cursor_fsm_;
 
+    MergeKey key_(aku_Sample const& sample) const;
+    //! Read next portion of data from input cursor, returns false if cursor is exhausted
+    bool refill_(uint32_t cur_index);
     void read_impl_();
     void set_error(int error_code);
     bool put(aku_Sample const& result);
@@ -16,6 +16,7 @@
 
 #include "datetime.h"
 #include <cstdio>
+#include <cstring>
 
 namespace Akumuli {
 
@@ -24,10 +25,6 @@ typedef std::chrono::nanoseconds DurationT;
 
 static const boost::posix_time::ptime EPOCH = boost::posix_time::from_time_t(0);
 
-struct BadDateTimeFormat : std::runtime_error {
-    BadDateTimeFormat(const char* str) : std::runtime_error(str) {}
-};
-
 aku_Timestamp DateTimeUtil::from_std_chrono(std::chrono::system_clock::time_point timestamp) {
     auto duration = timestamp.time_since_epoch();
     DurationT result = std::chrono::duration_cast<DurationT>(duration);
@@ -140,5 +137,38 @@ aku_Status DateTimeUtil::to_iso_string(aku_Timestamp ts, char* buffer, size_t bu
     return len + 1;
 }
 
+aku_Timestamp DateTimeUtil::parse_duration(const char* str) {
+    const char* p = str;
+    aku_Timestamp value = 0u;
+    while (*p >= '0' && *p <= '9') {
+        value = value*10 + static_cast<aku_Timestamp>(*p - '0');
+        p++;
+    }
+    if (p == str) {
+        BadDateTimeFormat error("can't parse duration, number expected");
+        BOOST_THROW_EXCEPTION(error);
+    }
+    struct Unit {
+        const char*  name;
+        aku_Timestamp mult;
+    };
+    static const Unit UNITS[] = {
+        { "",   1ul },
+        { "ns", 1ul },
+        { "us", 1000ul },
+        { "ms", 1000000ul },
+        { "s",  1000000000ul },
+        { "m",  60*1000000000ul },
+        { "h",  3600*1000000000ul },
+        { "d",  24*3600*1000000000ul },
+    };
+    for (auto const& unit: UNITS) {
+        if (std::strcmp(p, unit.name) == 0) {
+            return value*unit.mult;
+        }
+    }
+    BadDateTimeFormat error("can't parse duration, unknown units");
+    BOOST_THROW_EXCEPTION(error);
 }
 
+}
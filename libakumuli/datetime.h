@@ -23,6 +23,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <chrono>
+#include <stdexcept>
 
 namespace Akumuli {
 
@@ -32,7 +33,9 @@ namespace Akumuli {
   */
 
 //! Timestamp parsing error
-struct BadDateTimeFormat;
+struct BadDateTimeFormat : std::runtime_error {
+    BadDateTimeFormat(const char* str) : std::runtime_error(str) {}
+};
 
 //! Static utility class for date-time utility functions
 struct DateTimeUtil {
@@ -53,6 +56,13 @@ struct DateTimeUtil {
     /** Convert timestamp to string.
       */
     static aku_Status to_iso_string(aku_Timestamp ts, char* buffer, size_t buffer_size);
+
+    /** Parse duration, e.g. "10s", "100ms", "5m".
+      * Supported units: "ns", "us", "ms", "s", "m" (minutes), "h", "d". Number without
+      * units is treated as number of nanoseconds.
+      * @throws BadDateTimeFormat on error
+      */
+    static aku_Timestamp parse_duration(const char* str);
 };
 
 }
@@ -0,0 +1,150 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Loser tree (tournament tree) for k-way merge.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "akumuli.h"
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+//! Packed (timestamp, id) merge key, timestamp occupies high 64 bits
+typedef unsigned __int128 MergeKey;
+
+/** Make merge key.
+  * Integer order of the keys matches lexicographical (timestamp, id) order
+  * in forward direction and reversed order in backward direction, so
+  * merge algorithm can always select minimal key.
+  */
+template<int dir>
+inline MergeKey make_merge_key(aku_Timestamp ts, aku_ParamId id) {
+    MergeKey key = (static_cast<MergeKey>(ts) << 64) | static_cast<MergeKey>(id);
+    return dir == AKU_CURSOR_DIR_FORWARD ? key : ~key;
+}
+
+/** Loser tree.
+  * @brief Selects source with minimal key among N sources. Replacing the
+  * key of the winner takes log2(N) comparisons and touches only one path
+  * from leaf to root (heap needs up to 2*log2(N) comparisons on pop and
+  * push). Tree doesn't store values, only keys and source indexes, values
+  * should be stored by the caller.
+  */
+class LoserTree {
+    std::vector<MergeKey> keys_;   //< Current key of each source (leaf)
+    std::vector<uint32_t> dead_;   //< 1 if source is exhausted, 0 otherwise
+    std::vector<uint32_t> tree_;   //< tree_[0] - winner, tree_[1..size-1] - losers
+    uint32_t              size_;   //< Number of leafs (power of two)
+    uint32_t              alive_;  //< Number of sources that are not exhausted
+
+    //! Returns true if source `a` should go before source `b`
+    bool less_(uint32_t a, uint32_t b) const {
+        // Exhausted sources are larger than anything else
+        return (dead_[a] < dead_[b]) | ((dead_[a] == dead_[b]) & (keys_[a] < keys_[b]));
+    }
+
+    void replay_(uint32_t winner) {
+        for (uint32_t node = (size_ + winner) >> 1; node > 0; node >>= 1) {
+            uint32_t loser = tree_[node];
+            uint32_t swap = less_(loser, winner);
+            // branch-free select
+            tree_[node] = swap ? winner : loser;
+            winner      = swap ? loser  : winner;
+        }
+        tree_[0] = winner;
+    }
+
+public:
+    /** C-tor
+      * @param nsources number of sources, all sources are exhausted initially
+      */
+    LoserTree(uint32_t nsources)
+        : size_(1)
+        , alive_(0)
+    {
+        while (size_ < nsources) {
+            size_ <<= 1;
+        }
+        keys_.resize(size_);
+        dead_.resize(size_, 1u);
+        tree_.resize(size_);
+    }
+
+    //! Set initial key of the source (must be called before `build`)
+    void set(uint32_t source, MergeKey key) {
+        keys_[source] = key;
+        alive_ += dead_[source];
+        dead_[source] = 0u;
+    }
+
+    //! Build the tree, should be called once after initial keys was set
+    void build() {
+        std::vector<uint32_t> winners(2*size_);
+        for (uint32_t i = 0; i < size_; i++) {
+            winners[size_ + i] = i;
+        }
+        for (uint32_t node = size_ - 1; node > 0; node--) {
+            uint32_t left = winners[2*node];
+            uint32_t right = winners[2*node + 1];
+            if (less_(right, left)) {
+                winners[node] = right;
+                tree_[node] = left;
+            } else {
+                winners[node] = left;
+                tree_[node] = right;
+            }
+        }
+        tree_[0] = winners[1];
+    }
+
+    //! Returns true if all sources are exhausted
+    bool empty() const {
+        return alive_ == 0;
+    }
+
+    //! Index of the source with the smallest key
+    uint32_t top() const {
+        return tree_[0];
+    }
+
+    //! Smallest key
+    MergeKey top_key() const {
+        return keys_[tree_[0]];
+    }
+
+    //! Replace key of the winner (winning source advanced to the next element)
+    void replace_top(MergeKey key) {
+        uint32_t winner = tree_[0];
+        keys_[winner] = key;
+        replay_(winner);
+    }
+
+    //! Remove winner (winning source is exhausted)
+    void pop_top() {
+        uint32_t winner = tree_[0];
+        dead_[winner] = 1u;
+        alive_--;
+        replay_(winner);
+    }
+};
+
+}  // namespace
@@ -18,6 +18,7 @@
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <limits>
 #include <mutex>
 #include <apr_time.h>
 #include "timsort.hpp"
@@ -119,6 +120,26 @@ size_t PageHeader::get_free_space() const {
     return end - begin;
 }
 
+uint32_t PageHeader::get_next_offset() const {
+    return next_offset;
+}
+
+std::pair<size_t, size_t> PageHeader::get_payload_range(uint32_t offset) const {
+    auto base = reinterpret_cast<const char*>(this);
+    size_t begin = static_cast<size_t>(payload - base) + std::min(offset, next_offset);
+    size_t end = static_cast<size_t>(payload - base) + next_offset;
+    return std::make_pair(begin, end);
+}
+
+std::pair<size_t, size_t> PageHeader::get_index_range(uint32_t index) const {
+    auto base = reinterpret_cast<const char*>(this);
+    auto index_end = payload + length;
+    index = std::min(index, count);
+    size_t begin = static_cast<size_t>((index_end - count*sizeof(aku_EntryIndexRecord)) - base);
+    size_t end = static_cast<size_t>((index_end - index*sizeof(aku_EntryIndexRecord)) - base);
+    return std::make_pair(begin, end);
+}
+
 void PageHeader::reuse() {
     count = 0;
     checkpoint = 0;
@@ -191,7 +212,7 @@ int PageHeader::complete_chunk(const UncompressedChunk& data) {
         char* begin;
         char* end;
 
-        Writer(PageHeader *h) : header(h) {}
+        Writer(PageHeader *h) : header(h), begin(nullptr), end(nullptr) {}
 
         virtual aku_MemRange allocate() {
             size_t bytes_free = header->get_free_space();
@@ -213,19 +234,29 @@ int PageHeader::complete_chunk(const UncompressedChunk& data) {
 
     // Write compressed data
     aku_Status status = CompressionUtil::encode_chunk(&desc.n_elements, &first_ts, &last_ts, &writer, data);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
 
     // Calculate checksum of the new compressed data
     boost::crc_32_type checksum;
 
     checksum.process_block(writer.begin, writer.end);
-    if (status != AKU_SUCCESS) {
-        return status;
-    }
 
     desc.checksum = checksum.checksum();
     desc.begin_offset = writer.begin - payload;
     desc.end_offset = writer.end - payload;
 
+    // Value range is used by the value filter to skip chunks without decoding
+    desc.min_value = std::numeric_limits<double>::infinity();
+    desc.max_value = -std::numeric_limits<double>::infinity();
+    for (auto const& value: data.values) {
+        if (value.type == ChunkValue::FLOAT) {
+            desc.min_value = std::min(desc.min_value, value.value.floatval);
+            desc.max_value = std::max(desc.max_value, value.value.floatval);
+        }
+    }
+
     aku_MemRange head = {&desc, sizeof(desc)};
     status = add_entry(AKU_CHUNK_BWD_ID, first_ts, head);
     if (status != AKU_SUCCESS) {
@@ -298,6 +329,64 @@ int PageHeader::copy_entry(uint32_t offset, aku_Entry *receiver) const {
 }
 
 
+SparseIndex::SparseIndex()
+    : count_(0u)
+    , last_(AKU_MIN_TIMESTAMP)
+{
+}
+
+void SparseIndex::update(PageHeader const* page) {
+    auto count = page->get_entries_count();
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (count < count_) {
+        // Page was reused
+        timestamps_.clear();
+    }
+    count_ = count;
+    for (uint32_t ix = static_cast<uint32_t>(timestamps_.size())*STEP; ix < count; ix += STEP) {
+        timestamps_.push_back(page->page_index(static_cast<int>(ix))->timestamp);
+    }
+    if (count) {
+        last_ = page->page_index(static_cast<int>(count - 1))->timestamp;
+    }
+}
+
+void SparseIndex::reset() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    timestamps_.clear();
+    count_ = 0u;
+    last_ = AKU_MIN_TIMESTAMP;
+}
+
+bool SparseIndex::get_bounds(uint32_t max_entries, aku_Timestamp* begin, aku_Timestamp* end) const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (timestamps_.empty() || count_ < max_entries) {
+        return false;
+    }
+    // Entries are added in timestamp order
+    *begin = timestamps_.front();
+    *end = last_;
+    return true;
+}
+
+std::pair<uint32_t, uint32_t> SparseIndex::narrow(aku_Timestamp key, uint32_t max_index) const {
+    uint32_t begin = 0u, end = max_index - 1;
+    std::lock_guard<std::mutex> guard(mutex_);
+    // Last indexed record with timestamp less than key
+    auto lower = std::lower_bound(timestamps_.begin(), timestamps_.end(), key);
+    if (lower != timestamps_.begin()) {
+        begin = static_cast<uint32_t>((lower - timestamps_.begin()) - 1)*STEP;
+    }
+    // First indexed record with timestamp greater than key
+    auto upper = std::upper_bound(lower, timestamps_.end(), key);
+    if (upper != timestamps_.end()) {
+        end = static_cast<uint32_t>(upper - timestamps_.begin())*STEP;
+    }
+    end = std::min(end, max_index - 1);
+    begin = std::min(begin, end);
+    return std::make_pair(begin, end);
+}
+
 SearchStats& get_global_search_stats() {
     static SearchStats stats;
     return stats;
@@ -341,17 +430,39 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 
     SearchRange range_;
 
-    SearchAlgorithm(PageHeader const* page, std::shared_ptr<QP::IQueryProcessor> query, std::shared_ptr<ChunkCache> cache)
+    //! Number of index entries that should be prefetched ahead of the scan (two entries per chunk)
+    static const uint32_t READAHEAD_ENTRIES = 16;
+    //! Number of chunks after which scan is considered large
+    static const uint32_t LARGE_SCAN_CHUNKS = 16;
+
+    uint32_t readahead_index_;  //< Scan boundary of the prefetched range (direction-aware)
+    uint32_t nchunks_;          //< Number of chunks decoded by the scan
+    std::vector<uint32_t> selection_;  //< Selection vector of the batch (backward scan or value filter)
+    const QP::ValueFilter* filter_;    //< Value predicate pushed down by query processor (can be null)
+    bool interrupted_;                 //< Query processor doesn't need more samples
+
+    SearchAlgorithm(PageHeader const* page,
+                    std::shared_ptr<QP::IQueryProcessor> query,
+                    std::shared_ptr<ChunkCache> cache,
+                    uint32_t max_entries,
+                    SparseIndex const* index)
         : page_(page)
         , query_(query)
         , cache_(cache)
-        , MAX_INDEX_(page->get_entries_count())
+        , MAX_INDEX_(std::min(page->get_entries_count(), max_entries))
         , IS_BACKWARD_(query->direction() == AKU_CURSOR_DIR_BACKWARD)
         , key_(IS_BACKWARD_ ? query->upperbound() : query->lowerbound())
         , lowerbound_(query->lowerbound())
         , upperbound_(query->upperbound())
+        , readahead_index_(0u)
+        , nchunks_(0u)
+        , filter_(query->value_filter())
+        , interrupted_(false)
     {
-        if (MAX_INDEX_) {
+        if (MAX_INDEX_ && index) {
+            // Only part of the on-disk index should be searched
+            std::tie(range_.begin, range_.end) = index->narrow(key_, MAX_INDEX_);
+        } else if (MAX_INDEX_) {
             range_.begin = 0u;
             range_.end = MAX_INDEX_ - 1;
         } else {
@@ -393,7 +504,7 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 
     // Interpolation search supporting functions
     bool read_at(aku_Timestamp* out_timestamp, uint32_t ix) const {
-        if (ix < page_->get_entries_count()) {
+        if (ix < MAX_INDEX_) {
             *out_timestamp = page_->page_index(ix)->timestamp;
             return true;
         }
@@ -463,7 +574,7 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 
     bool scan_compressed_entries(uint32_t current_index, aku_Entry const* probe_entry, bool binary_search=false) {
         aku_Status status = AKU_SUCCESS;
-        std::shared_ptr<UncompressedChunk> chunk_header, header;
+        std::shared_ptr<DecodedChunk> header;
 
         auto npages = page_->get_numpages();    // This needed to prevent key collision
         auto nopens = page_->get_open_count();  // between old and new page data, when
@@ -471,13 +582,21 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 
         auto key = std::make_tuple(npages*nopens + pageid, current_index);
 
-        if (cache_ && cache_->contains(key)) {
-            // Fast path
+        auto pdesc = reinterpret_cast<CompressedChunkDesc const*>(&probe_entry->value[0]);
+        if (filter_ && probe_entry->length >= sizeof(CompressedChunkDesc) &&
+            !filter_->match_range(pdesc->min_value, pdesc->max_value))
+        {
+            // Chunk doesn't contain matching values, it's not decoded. Index entry timestamp
+            // is the last timestamp of the chunk in scan direction.
+            auto probe_time = page_->page_index(current_index)->timestamp;
+            return IS_BACKWARD_ ? lowerbound_ <= probe_time : upperbound_ >= probe_time;
+        }
+
+        if (cache_) {
             header = cache_->get(key);
-        } else {
-            chunk_header.reset(new UncompressedChunk());
-            header.reset(new UncompressedChunk());
-            auto pdesc  = reinterpret_cast<CompressedChunkDesc const*>(&probe_entry->value[0]);
+        }
+        if (!header) {
+            UncompressedChunk chunk_header;
             auto pbegin = (const unsigned char*)page_->read_entry_data(pdesc->begin_offset);
             auto pend   = (const unsigned char*)page_->read_entry_data(pdesc->end_offset);
             auto probe_length = pdesc->n_elements;
@@ -491,75 +610,157 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
                 return false;
             }
 
-            status = CompressionUtil::decode_chunk(chunk_header.get(), pbegin, pend, probe_length);
+            status = CompressionUtil::decode_chunk(&chunk_header, pbegin, pend, probe_length);
             if (status != AKU_SUCCESS) {
                 AKU_PANIC("Can't decode chunk");
             }
 
+            if (++nchunks_ > LARGE_SCAN_CHUNKS) {
+                // Large scan shouldn't evict hot data, compressed data is not needed after decoding
+                release_mem(pbegin, static_cast<size_t>(pend - pbegin));
+            }
+
             // TODO: depending on a query type we can use chunk order or convert back to time-order.
             // If we extract evertyhing it is better to convert to time order. If we picking some
             // parameter ids it is better to check if this ids present in a chunk and extract values
             // in chunk order and only after that - convert results to time-order.
 
             // Convert from chunk order to time order
-            if (!CompressionUtil::convert_from_chunk_order(*chunk_header, header.get())) {
-                AKU_PANIC("Bad chunk");
-            }
+            header = std::make_shared<DecodedChunk>(chunk_header);
 
             if (cache_) {
                 cache_->put(key, header);
             }
         }
 
+        if (!header->has_blobs()) {
+            // Rows are ordered by timestamp, matching rows form contiguous range
+            // that can be passed to query processor as a single batch
+            auto timestamps = header->timestamps();
+            auto size = header->size();
+            auto begin = static_cast<uint32_t>(std::lower_bound(timestamps, timestamps + size, lowerbound_) - timestamps);
+            auto end = static_cast<uint32_t>(std::upper_bound(timestamps, timestamps + size, upperbound_) - timestamps);
+            if (begin < end && filter_ && !filter_->match_range(header->min_value(), header->max_value())) {
+                // Chunk doesn't contain matching values
+                return IS_BACKWARD_ ? begin == 0 : end == size;
+            }
+            if (begin < end && filter_) {
+                // Values are filtered before samples are passed to query processor
+                auto values = header->values();
+                selection_.clear();
+                if (IS_BACKWARD_) {
+                    for (uint32_t i = end; i --> begin;) {
+                        if (filter_->match(values[i])) {
+                            selection_.push_back(i - begin);
+                        }
+                    }
+                } else {
+                    for (uint32_t i = begin; i < end; i++) {
+                        if (filter_->match(values[i])) {
+                            selection_.push_back(i - begin);
+                        }
+                    }
+                }
+                if (!selection_.empty()) {
+                    QP::SampleBatch batch = {
+                        timestamps + begin,
+                        header->paramids() + begin,
+                        values + begin,
+                        selection_.data(),
+                        static_cast<uint32_t>(selection_.size()),
+                    };
+                    if (!query_->put_batch(batch)) {
+                        interrupted_ = true;
+                        return false;
+                    }
+                }
+            } else if (begin < end) {
+                QP::SampleBatch batch = {
+                    timestamps + begin,
+                    header->paramids() + begin,
+                    header->values() + begin,
+                    nullptr,
+                    end - begin,
+                };
+                if (IS_BACKWARD_) {
+                    selection_.resize(batch.size);
+                    for (uint32_t i = 0; i < batch.size; i++) {
+                        selection_[i] = batch.size - 1 - i;
+                    }
+                    batch.selection = selection_.data();
+                }
+                if (!query_->put_batch(batch)) {
+                    interrupted_ = true;
+                    return false;
+                }
+            }
+            // Scan should proceed if the next chunk can contain matching rows
+            return IS_BACKWARD_ ? begin == 0 : end == size;
+        }
+
         int start_pos = 0;
         if (IS_BACKWARD_) {
-            start_pos = static_cast<int>(header->timestamps.size() - 1);
+            start_pos = static_cast<int>(header->size()) - 1;
         }
         bool probe_in_time_range = true;
 
         auto queryproc = query_;
         auto page = page_;
+        auto timestamps = header->timestamps();
+        auto paramids = header->paramids();
 
-        auto put_entry = [&header, queryproc, page] (uint32_t i) {
+        auto filter = filter_;
+        auto put_entry = [&header, timestamps, paramids, queryproc, page, filter] (uint32_t i) -> bool {
             aku_PData pdata;
-            if (header->values.at(i).type == ChunkValue::BLOB) {
+            if (filter && (header->is_blob(i) || !filter->match(header->get_float(i)))) {
+                // Value filter drops BLOBs
+                return true;
+            }
+            if (header->is_blob(i)) {
+                auto blob = header->get_blob(i);
                 pdata.type =  aku_PData::BLOB;
-                pdata.value.blob.begin = page->read_entry_data(header->values.at(i).value.blobval.offset);
-                pdata.value.blob.size = header->values.at(i).value.blobval.length;
-            } else if (header->values.at(i).type == ChunkValue::FLOAT) {
+                pdata.value.blob.begin = page->read_entry_data(blob.offset);
+                pdata.value.blob.size = blob.length;
+            } else {
                 pdata.type = aku_PData::FLOAT;
-                pdata.value.float64 = header->values.at(i).value.floatval;
+                pdata.value.float64 = header->get_float(i);
             }
             aku_Sample result = {
-                header->timestamps.at(i),
-                header->paramids.at(i),
+                timestamps[i],
+                paramids[i],
                 pdata,
             };
-            queryproc->put(result);
+            return queryproc->put(result);
         };
 
         if (IS_BACKWARD_) {
             for (int i = static_cast<int>(start_pos); i >= 0; i--) {
-                probe_in_time_range = lowerbound_ <= header->timestamps[i] &&
-                                      upperbound_ >= header->timestamps[i];
+                probe_in_time_range = lowerbound_ <= timestamps[i] &&
+                                      upperbound_ >= timestamps[i];
                 if (probe_in_time_range) {
-                    put_entry(i);
+                    if (!put_entry(i)) {
+                        interrupted_ = true;
+                        return false;
+                    }
                 } else {
-                    probe_in_time_range = lowerbound_ <= header->timestamps[i];
+                    probe_in_time_range = lowerbound_ <= timestamps[i];
                     if (!probe_in_time_range) {
                         break;
                     }
                 }
             }
         } else {
-            auto end_pos = (int)header->timestamps.size();
+            auto end_pos = static_cast<int>(header->size());
             for (auto i = start_pos; i != end_pos; i++) {
-                probe_in_time_range = lowerbound_ <= header->timestamps[i] &&
-                                      upperbound_ >= header->timestamps[i];
+                probe_in_time_range = lowerbound_ <= timestamps[i] &&
+                                      upperbound_ >= timestamps[i];
                 if (probe_in_time_range) {
-                    put_entry(i);
+                    if (!put_entry(i)) {
+                        interrupted_ = true;
+                        return false;
+                    }
                 } else {
-                    probe_in_time_range = upperbound_ >= header->timestamps[i];
+                    probe_in_time_range = upperbound_ >= timestamps[i];
                     if (!probe_in_time_range) {
                         break;
                     }
@@ -569,6 +770,37 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         return probe_in_time_range;
     }
 
+    /** Prefetch payload of the next few entries in scan direction.
+      * Index records contains offsets so payload is not accessed. Entries
+      * are stored in the payload in index order.
+      */
+    void readahead(uint32_t current_index) {
+        const size_t page_size = get_page_size();
+        if (IS_BACKWARD_) {
+            // Entries [readahead_index_, current_index] are prefetched
+            if (readahead_index_ == 0u || readahead_index_ + READAHEAD_ENTRIES/2 <= current_index) {
+                return;
+            }
+            uint32_t from = current_index > READAHEAD_ENTRIES ? current_index - READAHEAD_ENTRIES : 0u;
+            uint32_t to = std::min(current_index, readahead_index_ - 1);
+            auto begin = page_->read_entry_data(page_->page_index(from)->offset);
+            auto end = page_->read_entry_data(page_->page_index(to)->offset);
+            readahead_mem(begin, static_cast<size_t>(static_cast<const char*>(end) - static_cast<const char*>(begin)) + page_size);
+            readahead_index_ = from;
+        } else {
+            // Entries [current_index, readahead_index_) are prefetched
+            if (readahead_index_ >= MAX_INDEX_ || readahead_index_ > current_index + READAHEAD_ENTRIES/2) {
+                return;
+            }
+            uint32_t from = std::max(current_index, readahead_index_);
+            uint32_t to = std::min(current_index + READAHEAD_ENTRIES, MAX_INDEX_);
+            auto begin = page_->read_entry_data(page_->page_index(from)->offset);
+            auto end = page_->read_entry_data(page_->page_index(to - 1)->offset);
+            readahead_mem(begin, static_cast<size_t>(static_cast<const char*>(end) - static_cast<const char*>(begin)) + page_size);
+            readahead_index_ = to;
+        }
+    }
+
     std::tuple<uint64_t, uint64_t> scan_impl(uint32_t probe_index) {
 #ifdef DEBUG
         // Debug variables
@@ -576,9 +808,12 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         long dbg_count = 0;
 #endif
         int index_increment = IS_BACKWARD_ ? -1 : 1;
+        // Nothing is prefetched yet
+        readahead_index_ = IS_BACKWARD_ ? probe_index + 1 : probe_index;
         while (true) {
             auto current_index = probe_index;
             probe_index += index_increment;
+            readahead(current_index);
             auto probe_offset = page_->page_index(current_index)->offset;
             auto probe_time = page_->page_index(current_index)->timestamp;
             auto probe_entry = page_->read_entry(probe_offset);
@@ -608,6 +843,7 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
                         pdata
                     };
                     if (!query_->put(result)) {
+                        interrupted_ = true;
                         break;
                     }
                 }
@@ -643,7 +879,20 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
             return;
         }
 
-        auto sums = scan_impl(range_.begin);
+        // Binary search can stop at any of the records with the same timestamp,
+        // scan should start from the first one (in scan direction)
+        auto start = range_.begin;
+        if (IS_BACKWARD_) {
+            while (start + 1 < MAX_INDEX_ && page_->page_index(start + 1)->timestamp <= key_) {
+                start++;
+            }
+        } else {
+            while (start > 0 && page_->page_index(start - 1)->timestamp >= key_) {
+                start--;
+            }
+        }
+
+        auto sums = scan_impl(start);
 
         auto& stats = get_global_search_stats();
         {
@@ -655,14 +904,19 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 };
 
 
-void PageHeader::searchV2(std::shared_ptr<QP::IQueryProcessor> query, std::shared_ptr<ChunkCache> cache) const {
-    SearchAlgorithm search_alg(this, query, cache);
+bool PageHeader::searchV2(std::shared_ptr<QP::IQueryProcessor> query,
+                          std::shared_ptr<ChunkCache> cache,
+                          uint32_t max_entries,
+                          SparseIndex const* index) const
+{
+    SearchAlgorithm search_alg(this, query, cache, max_entries, index);
     if (search_alg.fast_path() == false) {
         if (search_alg.interpolation()) {
             search_alg.binary_search();
             search_alg.scan();
         }
     }
+    return !search_alg.interrupted_;
 }
 
 void PageHeader::get_stats(aku_StorageStats* rcv_stats) {
@@ -60,11 +60,17 @@ struct aku_EntryIndexRecord {
     uint32_t        offset;
 } __attribute__((packed));
 
+/** Compressed chunk descriptor.
+  * Value range fields are absent in chunks written by older versions (entry length
+  * should be checked before they're used).
+  */
 struct CompressedChunkDesc {
     uint32_t n_elements;        //< Number of elements in a chunk
     uint32_t begin_offset;      //< Data begin offset
     uint32_t end_offset;        //< Data end offset
     uint32_t checksum;          //< Checksum
+    double   min_value;         //< Smallest float value (+inf if there is no float values)
+    double   max_value;         //< Largest float value (-inf if there is no float values)
 } __attribute__((packed));
 
 //! Storage configuration
@@ -88,6 +94,9 @@ struct aku_Entry {
 //! PageHeader forward declaration
 struct PageHeader;
 
+//! SparseIndex forward declaration
+class SparseIndex;
+
 /** Page bounding box.
  *  All data is two dimentional: param-timestamp.
  */
@@ -175,6 +184,20 @@ public:
     //! Returns amount of free space in bytes
     size_t get_free_space() const;
 
+    //! Returns offset of the next payload record
+    uint32_t get_next_offset() const;
+
+    /** Get byte range of the payload written after `offset`.
+      * @returns [begin, end) range relative to the beginning of the page
+      */
+    std::pair<size_t, size_t> get_payload_range(uint32_t offset) const;
+
+    /** Get byte range of the index entries added after first `index` entries.
+      * Index grows down from the end of the page.
+      * @returns [begin, end) range relative to the beginning of the page
+      */
+    std::pair<size_t, size_t> get_index_range(uint32_t index) const;
+
     bool inside_bbox(aku_ParamId param, aku_Timestamp time) const;
 
     /**
@@ -259,8 +282,16 @@ public:
 
     /**
       * @brief Search matches inside the volume
+      * @param query is a query processor
+      * @param cache is a chunk cache (can be null)
+      * @param max_entries limits number of page entries visible to the search
+      * @param index is an in-memory index of the page (can be null)
+      * @return false if query processor interrupted the search
       */
-    void searchV2(std::shared_ptr<QP::IQueryProcessor> query, std::shared_ptr<ChunkCache> cache = std::shared_ptr<ChunkCache>()) const;
+    bool searchV2(std::shared_ptr<QP::IQueryProcessor> query,
+                  std::shared_ptr<ChunkCache> cache = std::shared_ptr<ChunkCache>(),
+                  uint32_t max_entries = ~0u,
+                  SparseIndex const* index = nullptr) const;
 
     static void get_search_stats(aku_SearchStats* stats, bool reset=false);
 
@@ -268,4 +299,43 @@ public:
     void get_stats(aku_StorageStats* rcv_stats);
 };
 
+
+/** In-memory sparse index of the page.
+  * Contains timestamp of every STEP-th index record. Search uses it to
+  * narrow the range before touching index records stored in the page,
+  * so only one or two pages of the on-disk index are accessed.
+  * Index is updated by one thread and can be used by many readers.
+  */
+class SparseIndex {
+    mutable std::mutex          mutex_;
+    std::vector<aku_Timestamp>  timestamps_;  //< Timestamps of the every STEP-th record
+    uint32_t                    count_;       //< Number of page entries at the last update
+    aku_Timestamp               last_;        //< Timestamp of the last page entry
+public:
+    //! Distance between indexed records (one memory page of index records)
+    static const uint32_t STEP = 256;
+
+    SparseIndex();
+
+    /** Add records appended to the page since the previous update.
+      * Should be called after the page was modified and on open.
+      */
+    void update(PageHeader const* page);
+
+    //! Clear index (page was reused)
+    void reset();
+
+    /** Get index range [begin, end] that should contain the key.
+      * @param key is a timestamp to search
+      * @param max_index is a number of page entries visible to the search (should be non zero)
+      */
+    std::pair<uint32_t, uint32_t> narrow(aku_Timestamp key, uint32_t max_index) const;
+
+    /** Get time bounds of the page.
+      * @param max_entries is a number of page entries visible to the search
+      * @returns false if page is empty or index wasn't updated after the visible entries was added
+      */
+    bool get_bounds(uint32_t max_entries, aku_Timestamp* begin, aku_Timestamp* end) const;
+};
+
 }  // namespaces
@@ -16,10 +16,13 @@
 
 #include "queryprocessor.h"
 #include "util.h"
+#include "datetime.h"
 
 #include <random>
 #include <algorithm>
+#include <cmath>
 #include <unordered_set>
+#include <map>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -76,152 +79,1401 @@ struct RandomSamplingNode : std::enable_shared_from_this<RandomSamplingNode>, No
         next_->complete();
     }
 
+    void add_sample(const aku_Sample& sample) {
+        if (samples_.size() < buffer_size_) {
+            // Just append new values
+            samples_.push_back(sample);
+        } else {
+            // Flip a coin
+            uint32_t ix = random_() % samples_.size();
+            if (ix < buffer_size_) {
+                samples_.at(ix) = sample;
+            }
+        }
+    }
+
     virtual bool put(const aku_Sample& sample) {
         if (!next_) {
             AKU_PANIC("bad query processor node, next not set");
         }
-        if (samples_.size() < buffer_size_) {
-            // Just append new values
-            samples_.push_back(sample);
+        add_sample(sample);
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        if (!next_) {
+            AKU_PANIC("bad query processor node, next not set");
+        }
+        for (uint32_t i = 0; i < batch.size; i++) {
+            add_sample(batch.get(i));
+        }
+        return true;
+    }
+
+    void set_error(aku_Status status) {
+        if (!next_) {
+            AKU_PANIC("bad query processor node, next not set");
+        }
+        next_->set_error(status);
+    }
+};
+
+
+/** Filter ids using predicate.
+  * Predicate is an unary functor that accepts parameter of type aku_ParamId - fun(aku_ParamId) -> bool.
+  */
+template<class Predicate>
+struct FilterByIdNode : std::enable_shared_from_this<FilterByIdNode<Predicate>>, Node {
+    //! Id matching predicate
+    Predicate op_;
+    std::shared_ptr<Node> next_;
+    std::vector<uint32_t> selection_;   //< Selection vector of the last batch
+
+    FilterByIdNode(Predicate pred, std::shared_ptr<Node> next)
+        : op_(pred)
+        , next_(next)
+    {
+    }
+
+    // Bolt interface
+    virtual void complete() {
+        if (!next_) {
+            AKU_PANIC("bad query processor node, next not set");
+        }
+        next_->complete();
+    }
+
+    virtual bool put(const aku_Sample& sample) {
+        if (!next_) {
+            AKU_PANIC("bad query processor node, next not set");
+        }
+        return op_(sample.paramid) ? next_->put(sample) : true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        if (!next_) {
+            AKU_PANIC("bad query processor node, next not set");
+        }
+        selection_.clear();
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            if (op_(batch.paramids[row])) {
+                selection_.push_back(row);
+            }
+        }
+        if (selection_.empty()) {
+            return true;
+        }
+        SampleBatch filtered = batch;
+        filtered.selection = selection_.data();
+        filtered.size = static_cast<uint32_t>(selection_.size());
+        return next_->put_batch(filtered);
+    }
+
+    void set_error(aku_Status status) {
+        if (!next_) {
+            AKU_PANIC("bad query processor node, next not set");
+        }
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return NodeType::FilterById;
+    }
+};
+
+struct MovingAverage : Node {
+    struct MACounter {
+        double acc;
+        size_t num;
+    };
+
+    aku_Timestamp const step_;
+    bool first_hit_;
+    aku_Timestamp lowerbound_, upperbound_;
+    std::shared_ptr<Node> next_;
+
+    MovingAverage(aku_Timestamp step, std::shared_ptr<Node> next)
+        : step_(step)
+        , first_hit_(true)
+        , lowerbound_(AKU_MIN_TIMESTAMP)
+        , upperbound_(AKU_MIN_TIMESTAMP)
+        , next_(next)
+    {
+    }
+
+    std::unordered_map<aku_ParamId, MACounter> counters_;
+
+    bool average_samples() {
+        for (auto& cnt: counters_) {
+            if (cnt.second.num) {
+                aku_Sample sample;
+                sample.paramid = cnt.first;
+                sample.payload.value.float64 = cnt.second.acc / cnt.second.num;
+                sample.payload.type = aku_PData::FLOAT;
+                sample.timestamp = upperbound_;
+                cnt.second = {};
+                if (!next_->put(sample)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    virtual void complete() {
+        average_samples();
+        next_->complete();
+    }
+
+    bool add_value(aku_ParamId id, aku_Timestamp ts, double value) {
+        if (AKU_UNLIKELY(first_hit_ == true)) {
+            first_hit_ = false;
+            aku_Timestamp aligned = ts / step_ * step_;
+            // aligned <= ts
+            lowerbound_ = aligned;
+            upperbound_ = aligned + step_;
+        }
+        if (ts > upperbound_) {
+            // Forward direction
+            if (!average_samples()) {
+                return false;
+            }
+            lowerbound_ += step_;
+            upperbound_ += step_;
+        } else if (ts < lowerbound_) {
+            // Backward direction
+            if (!average_samples()) {
+                return false;
+            }
+            lowerbound_ -= step_;
+            upperbound_ -= step_;
+        } else {
+            auto& cnt = counters_[id];
+            cnt.acc += value;
+            cnt.num += 1;
+        }
+        return true;
+    }
+
+    virtual bool put(const aku_Sample &sample) {
+        // ignore BLOBs
+        if (sample.payload.type == aku_PData::FLOAT) {
+            return add_value(sample.paramid, sample.timestamp, sample.payload.value.float64);
+        }
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            if (!add_value(batch.paramids[row], batch.timestamps[row], batch.values[row])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    virtual void set_error(aku_Status status) {
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return Node::MovingAverage;
+    }
+};
+
+/** Streaming quantile sketch with relative error guarantee (DDSketch).
+  * Values are mapped to bins with logarithmically growing width, so any quantile
+  * estimate is within 1% of the exact value. Number of bins per sign is bounded by
+  * MAX_BINS, when this limit is reached lowest bins are collapsed (this affects only
+  * accuracy of the lowest quantiles). Zero is counted separately.
+  */
+struct QuantileSketch {
+    static const int MAX_BINS = 2048;
+
+    //! Contiguous range of bins
+    struct Store {
+        std::vector<uint64_t> bins;
+        int offset;  //< Index of the first bin
+
+        Store() : offset(0) {}
+
+        //! Make room for bins in [lo, hi] range, returns actual lower bound
+        int extend(int lo, int hi) {
+            if (hi - lo + 1 > MAX_BINS) {
+                lo = hi - MAX_BINS + 1;
+            }
+            std::vector<uint64_t> tmp(static_cast<size_t>(hi - lo + 1), 0u);
+            for (size_t i = 0; i < bins.size(); i++) {
+                int ix = std::max(offset + static_cast<int>(i), lo) - lo;
+                tmp[static_cast<size_t>(ix)] += bins[i];
+            }
+            bins.swap(tmp);
+            offset = lo;
+            return lo;
+        }
+
+        void add(int index) {
+            if (bins.empty()) {
+                bins.push_back(0u);
+                offset = index;
+            } else if (index < offset) {
+                index = std::max(index, extend(index, offset + static_cast<int>(bins.size()) - 1));
+            } else if (index >= offset + static_cast<int>(bins.size())) {
+                extend(offset, index);
+            }
+            bins[static_cast<size_t>(index - offset)]++;
+        }
+
+        void clear() {
+            bins.clear();
+        }
+    };
+
+    Store    positive_;
+    Store    negative_;
+    uint64_t zeros_;
+    uint64_t count_;
+
+    QuantileSketch() : zeros_(0u), count_(0u) {}
+
+    static double gamma() {
+        return (1.0 + 0.01) / (1.0 - 0.01);
+    }
+
+    static int index(double value) {
+        static const double INV_LOG_GAMMA = 1.0 / std::log(gamma());
+        return static_cast<int>(std::ceil(std::log(value) * INV_LOG_GAMMA));
+    }
+
+    //! Representative value of the bin
+    static double value(int index) {
+        return 2.0 * std::pow(gamma(), index) / (gamma() + 1.0);
+    }
+
+    void add(double value) {
+        if (value > 0.0) {
+            positive_.add(index(value));
+        } else if (value < 0.0) {
+            negative_.add(index(-value));
+        } else {
+            zeros_++;
+        }
+        count_++;
+    }
+
+    //! Estimate quantile `q` (0 <= q <= 1)
+    double quantile(double q) const {
+        if (count_ == 0u) {
+            return NAN;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * (count_ - 1));
+        uint64_t n = 0u;
+        // Largest negative bin contains smallest values
+        for (auto i = negative_.bins.size(); i --> 0;) {
+            n += negative_.bins[i];
+            if (n > rank) {
+                return -value(negative_.offset + static_cast<int>(i));
+            }
+        }
+        n += zeros_;
+        if (n > rank) {
+            return 0.0;
+        }
+        for (size_t i = 0; i < positive_.bins.size(); i++) {
+            n += positive_.bins[i];
+            if (n > rank) {
+                return value(positive_.offset + static_cast<int>(i));
+            }
+        }
+        return value(positive_.offset + static_cast<int>(positive_.bins.size()) - 1);
+    }
+
+    void clear() {
+        positive_.clear();
+        negative_.clear();
+        zeros_ = 0u;
+        count_ = 0u;
+    }
+};
+
+/** Maps series ids to dense indexes.
+  * Ids known at plan time get their slots in advance (in the order of the first occurrence
+  * in the list), lookup is a single array access. Series that wasn't known at plan time
+  * (e.g. created after the query was parsed) gets the next free slot and extends the array.
+  */
+struct SeriesSlots {
+    static const uint32_t NO_SLOT = ~0u;
+
+    aku_ParamId base_;                  //< Smallest mapped id
+    std::vector<uint32_t> slots_;       //< Slot of the series `base_ + i` (NO_SLOT - not mapped)
+    uint32_t size_;                     //< Number of mapped series
+
+    SeriesSlots(std::vector<aku_ParamId> const& ids)
+        : base_(0u)
+        , size_(0u)
+    {
+        if (!ids.empty()) {
+            auto minmax = std::minmax_element(ids.begin(), ids.end());
+            base_ = *minmax.first;
+            slots_.resize(*minmax.second - base_ + 1, NO_SLOT);
+            for (auto id: ids) {
+                auto& slot = slots_[id - base_];
+                if (slot == NO_SLOT) {
+                    slot = size_++;
+                }
+            }
+        }
+    }
+
+    //! Number of mapped series
+    uint32_t size() const {
+        return size_;
+    }
+
+    //! Get index of the series, unknown series gets index equal to `size()`
+    uint32_t get(aku_ParamId id) {
+        auto ix = id - base_;  // wraps around if id < base_
+        if (AKU_LIKELY(ix < slots_.size() && slots_[ix] != NO_SLOT)) {
+            return slots_[ix];
+        }
+        return add(id);
+    }
+
+    uint32_t add(aku_ParamId id) {
+        if (slots_.empty()) {
+            base_ = id;
+        } else if (id < base_) {
+            slots_.insert(slots_.begin(), base_ - id, NO_SLOT);
+            base_ = id;
+        }
+        auto ix = id - base_;
+        if (ix >= slots_.size()) {
+            slots_.resize(ix + 1, NO_SLOT);
+        }
+        slots_[ix] = size_;
+        return size_++;
+    }
+};
+
+const uint32_t SeriesSlots::NO_SLOT;
+
+/** Aggregation state of the series.
+  */
+struct SeriesAccumulator {
+    enum Func {
+        MIN, MAX, SUM, COUNT, AVG, FIRST, LAST, QUANTILE
+    };
+
+    struct FuncSpec {
+        Func   func;
+        double q;       //< Quantile (only for QUANTILE)
+    };
+
+    aku_ParamId   id;
+    uint64_t      count;    //< Zero if accumulator is empty
+    double        sum;
+    double        min;
+    double        max;
+    aku_Timestamp first_ts;
+    double        first;
+    aku_Timestamp last_ts;
+    double        last;
+    QuantileSketch sketch;  //< Used only if quantiles are needed
+
+    SeriesAccumulator(aku_ParamId id)
+        : id(id)
+        , count(0u)
+    {
+    }
+
+    void add(aku_Timestamp ts, double value) {
+        if (count == 0u) {
+            count = 1u;
+            sum = min = max = first = last = value;
+            first_ts = last_ts = ts;
+            return;
+        }
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        // Scan direction is not known here, first/last are defined by timestamps
+        if (ts < first_ts) {
+            first_ts = ts;
+            first = value;
+        }
+        if (ts >= last_ts) {
+            last_ts = ts;
+            last = value;
+        }
+    }
+
+    double get(FuncSpec spec) const {
+        switch (spec.func) {
+        case MIN:
+            return min;
+        case MAX:
+            return max;
+        case SUM:
+            return sum;
+        case COUNT:
+            return static_cast<double>(count);
+        case AVG:
+            return sum / count;
+        case FIRST:
+            return first;
+        case LAST:
+            return last;
+        case QUANTILE:
+            return sketch.quantile(spec.q);
+        };
+        return 0.0;
+    }
+
+    void clear() {
+        sketch.clear();
+        count = 0u;
+    }
+};
+
+/** Time-bucketed aggregation.
+  * Values of each series are aggregated inside buckets of `step` width aligned to
+  * the epoch. One sample is emitted for each function (in the order of the `funcs`
+  * list) for each series present in the bucket, timestamp of the output sample is
+  * a beginning of the bucket. Buckets are emitted in scan order (works in both
+  * directions), series inside the bucket are ordered by id. BLOBs are ignored.
+  * Quantiles are estimated using QuantileSketch. If histogram boundaries are set,
+  * number of values in each interval (-inf, b0), [b0, b1), ..., [bN, +inf) is emitted
+  * after function results.
+  */
+struct GroupAggregate : Node {
+    typedef SeriesAccumulator::FuncSpec FuncSpec;
+
+    struct Accumulator : SeriesAccumulator {
+        std::vector<uint64_t> histogram;
+
+        Accumulator(aku_ParamId id) : SeriesAccumulator(id) {}
+    };
+
+    aku_Timestamp const step_;
+    std::vector<FuncSpec> const funcs_;
+    std::vector<double> const bounds_;                  //< Histogram boundaries (sorted)
+    bool need_sketch_;
+    std::shared_ptr<Node> next_;
+    aku_Timestamp bucket_;                              //< Current bucket index
+    SeriesSlots slots_;                                 //< Series id -> accumulator index
+    std::vector<Accumulator> accumulators_;
+    std::vector<uint32_t> active_;                      //< Accumulators used in current bucket
+    // Output buffers
+    std::vector<aku_Timestamp> out_timestamps_;
+    std::vector<aku_ParamId> out_paramids_;
+    std::vector<double> out_values_;
+
+    GroupAggregate(aku_Timestamp step,
+                   std::vector<FuncSpec> funcs,
+                   std::vector<double> bounds,
+                   std::vector<aku_ParamId> const& ids,
+                   std::shared_ptr<Node> next)
+        : step_(step)
+        , funcs_(funcs)
+        , bounds_(bounds)
+        , need_sketch_(false)
+        , next_(next)
+        , bucket_(0u)
+        , slots_(ids)
+    {
+        for (auto const& spec: funcs_) {
+            need_sketch_ |= spec.func == SeriesAccumulator::QUANTILE;
+        }
+        accumulators_.reserve(slots_.size());
+        for (auto id: ids) {
+            get_slot(id);
+        }
+    }
+
+    uint32_t get_slot(aku_ParamId id) {
+        auto slot = slots_.get(id);
+        if (slot == accumulators_.size()) {
+            accumulators_.emplace_back(id);
+            accumulators_.back().histogram.resize(bounds_.empty() ? 0u : bounds_.size() + 1);
+        }
+        return slot;
+    }
+
+    //! Send results of the current bucket to the next node
+    bool flush() {
+        if (active_.empty()) {
+            return true;
+        }
+        std::sort(active_.begin(), active_.end(), [this](uint32_t lhs, uint32_t rhs) {
+            return accumulators_[lhs].id < accumulators_[rhs].id;
+        });
+        aku_Timestamp ts = bucket_*step_;
+        out_timestamps_.clear();
+        out_paramids_.clear();
+        out_values_.clear();
+        for (auto slot: active_) {
+            auto& acc = accumulators_[slot];
+            for (auto const& spec: funcs_) {
+                out_timestamps_.push_back(ts);
+                out_paramids_.push_back(acc.id);
+                out_values_.push_back(acc.get(spec));
+            }
+            for (auto& cnt: acc.histogram) {
+                out_timestamps_.push_back(ts);
+                out_paramids_.push_back(acc.id);
+                out_values_.push_back(static_cast<double>(cnt));
+                cnt = 0u;
+            }
+            acc.clear();
+        }
+        active_.clear();
+        SampleBatch batch = {
+            out_timestamps_.data(),
+            out_paramids_.data(),
+            out_values_.data(),
+            nullptr,
+            static_cast<uint32_t>(out_values_.size())
+        };
+        return next_->put_batch(batch);
+    }
+
+    bool add_value(aku_ParamId id, aku_Timestamp ts, double value) {
+        aku_Timestamp bucket = ts / step_;
+        if (bucket != bucket_) {
+            if (!flush()) {
+                return false;
+            }
+            bucket_ = bucket;
+        }
+        auto slot = get_slot(id);
+        auto& acc = accumulators_[slot];
+        if (need_sketch_) {
+            acc.sketch.add(value);
+        }
+        if (!bounds_.empty()) {
+            auto bin = std::upper_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+            acc.histogram[static_cast<size_t>(bin)]++;
+        }
+        if (acc.count == 0u) {
+            active_.push_back(slot);
+        }
+        acc.add(ts, value);
+        return true;
+    }
+
+    virtual bool put(const aku_Sample &sample) {
+        // ignore BLOBs
+        if (sample.payload.type == aku_PData::FLOAT) {
+            return add_value(sample.paramid, sample.timestamp, sample.payload.value.float64);
+        }
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            if (!add_value(batch.paramids[row], batch.timestamps[row], batch.values[row])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    virtual void complete() {
+        flush();
+        next_->complete();
+    }
+
+    virtual void set_error(aku_Status status) {
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return Node::Aggregate;
+    }
+};
+
+/** Top-K (or bottom-K) series selection.
+  * Each series is aggregated over the whole query range. When the scan is completed
+  * K series with the largest (or the smallest) score are emitted in rank order, one
+  * sample per series: score as value and timestamp of the last value of the series.
+  * Winners are selected using bounded heap. BLOBs are ignored.
+  */
+struct TopK : Node {
+    typedef SeriesAccumulator::FuncSpec FuncSpec;
+
+    size_t const k_;
+    FuncSpec const by_;
+    bool const bottom_;
+    std::shared_ptr<Node> next_;
+    SeriesSlots slots_;
+    std::vector<SeriesAccumulator> accumulators_;
+
+    TopK(size_t k, FuncSpec by, bool bottom, std::vector<aku_ParamId> const& ids, std::shared_ptr<Node> next)
+        : k_(k)
+        , by_(by)
+        , bottom_(bottom)
+        , next_(next)
+        , slots_(ids)
+    {
+        accumulators_.reserve(slots_.size());
+        for (auto id: ids) {
+            get_slot(id);
+        }
+    }
+
+    uint32_t get_slot(aku_ParamId id) {
+        auto slot = slots_.get(id);
+        if (slot == accumulators_.size()) {
+            accumulators_.emplace_back(id);
+        }
+        return slot;
+    }
+
+    bool add_value(aku_ParamId id, aku_Timestamp ts, double value) {
+        auto& acc = accumulators_[get_slot(id)];
+        if (by_.func == SeriesAccumulator::QUANTILE) {
+            acc.sketch.add(value);
+        }
+        acc.add(ts, value);
+        return true;
+    }
+
+    //! Send winners to the next node
+    bool emit() {
+        typedef std::pair<double, uint32_t> Item;  // score, slot
+        // Better item goes first, ties are broken using series id
+        auto better = [this](Item const& lhs, Item const& rhs) {
+            if (lhs.first != rhs.first) {
+                return bottom_ ? lhs.first < rhs.first : lhs.first > rhs.first;
+            }
+            return accumulators_[lhs.second].id < accumulators_[rhs.second].id;
+        };
+        // Heap top is the worst of the current winners
+        std::vector<Item> heap;
+        heap.reserve(std::min(k_, accumulators_.size()));
+        for (uint32_t slot = 0; slot < accumulators_.size(); slot++) {
+            if (accumulators_[slot].count == 0u) {
+                // Series known at plan time but not present in the query range
+                continue;
+            }
+            Item item(accumulators_[slot].get(by_), slot);
+            if (heap.size() < k_) {
+                heap.push_back(item);
+                std::push_heap(heap.begin(), heap.end(), better);
+            } else if (better(item, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = item;
+                std::push_heap(heap.begin(), heap.end(), better);
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), better);
+        std::vector<aku_Timestamp> timestamps;
+        std::vector<aku_ParamId> paramids;
+        std::vector<double> values;
+        for (auto const& item: heap) {
+            auto const& acc = accumulators_[item.second];
+            timestamps.push_back(acc.last_ts);
+            paramids.push_back(acc.id);
+            values.push_back(item.first);
+        }
+        SampleBatch batch = {
+            timestamps.data(),
+            paramids.data(),
+            values.data(),
+            nullptr,
+            static_cast<uint32_t>(values.size())
+        };
+        return next_->put_batch(batch);
+    }
+
+    virtual bool put(const aku_Sample &sample) {
+        // ignore BLOBs
+        if (sample.payload.type == aku_PData::FLOAT) {
+            return add_value(sample.paramid, sample.timestamp, sample.payload.value.float64);
+        }
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            add_value(batch.paramids[row], batch.timestamps[row], batch.values[row]);
+        }
+        return true;
+    }
+
+    virtual void complete() {
+        emit();
+        next_->complete();
+    }
+
+    virtual void set_error(aku_Status status) {
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return Node::TopK;
+    }
+};
+
+/** Group-by node.
+  * Replaces series id with id of the group using dense id->group array precomputed
+  * at plan time. Samples of the series that doesn't belong to any group are dropped.
+  */
+struct GroupByNode : Node {
+    aku_ParamId const base_;                //< Smallest mapped id
+    std::vector<aku_ParamId> groups_;       //< Group id of the series `base_ + i` (0 - not mapped)
+    std::shared_ptr<Node> next_;
+    // Output buffers
+    std::vector<aku_ParamId> out_paramids_;
+    std::vector<uint32_t> selection_;
+
+    GroupByNode(aku_ParamId base, std::vector<aku_ParamId> groups, std::shared_ptr<Node> next)
+        : base_(base)
+        , groups_(groups)
+        , next_(next)
+    {
+    }
+
+    aku_ParamId get_group(aku_ParamId id) const {
+        auto ix = id - base_;  // wraps around if id < base_
+        return ix < groups_.size() ? groups_[ix] : 0u;
+    }
+
+    virtual bool put(const aku_Sample &sample) {
+        auto group = get_group(sample.paramid);
+        if (group == 0u) {
+            return true;
+        }
+        aku_Sample out = sample;
+        out.paramid = group;
+        return next_->put(out);
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        selection_.clear();
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            auto group = get_group(batch.paramids[row]);
+            if (group != 0u) {
+                if (row >= out_paramids_.size()) {
+                    out_paramids_.resize(row + 1);
+                }
+                out_paramids_[row] = group;
+                selection_.push_back(row);
+            }
+        }
+        if (selection_.empty()) {
+            return true;
+        }
+        SampleBatch out = {
+            batch.timestamps,
+            out_paramids_.data(),
+            batch.values,
+            selection_.data(),
+            static_cast<uint32_t>(selection_.size())
+        };
+        return next_->put_batch(out);
+    }
+
+    virtual void complete() {
+        next_->complete();
+    }
+
+    virtual void set_error(aku_Status status) {
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return Node::GroupBy;
+    }
+};
+
+/** Resampler.
+  * Aligns every series to a grid with fixed step (grid points are multiples of the step).
+  * Values at grid points between two consecutive samples of the series are interpolated
+  * (linear, previous or next value). If distance between samples is larger than `max_gap`
+  * grid points inside the gap are filled with constant value or skipped if fill value is
+  * not set. Output of each series is ordered in scan direction, output of different series
+  * can be interleaved (value at grid point is known only when next sample of the series
+  * arrives). BLOBs are ignored.
+  */
+struct Resampler : Node {
+    //! Max number of samples buffered before they're sent to the next node
+    static const size_t MAX_BATCH = 0x1000;
+
+    enum Interpolation {
+        LINEAR, PREVIOUS, NEXT
+    };
+
+    struct State {
+        aku_Timestamp ts;
+        double        value;
+        bool          valid;  //< Set if series has at least one sample
+    };
+
+    aku_Timestamp const step_;
+    Interpolation const interpolation_;
+    aku_Timestamp const max_gap_;
+    bool const has_fill_;
+    double const fill_;
+    std::shared_ptr<Node> next_;
+    SeriesSlots slots_;
+    std::vector<State> states_;
+    // Output buffers
+    std::vector<aku_Timestamp> out_timestamps_;
+    std::vector<aku_ParamId> out_paramids_;
+    std::vector<double> out_values_;
+
+    Resampler(aku_Timestamp step,
+              Interpolation interpolation,
+              aku_Timestamp max_gap,
+              bool has_fill,
+              double fill,
+              std::vector<aku_ParamId> const& ids,
+              std::shared_ptr<Node> next)
+        : step_(step)
+        , interpolation_(interpolation)
+        , max_gap_(max_gap)
+        , has_fill_(has_fill)
+        , fill_(fill)
+        , next_(next)
+        , slots_(ids)
+    {
+        State empty = {};
+        states_.resize(slots_.size(), empty);
+    }
+
+    void emit(aku_ParamId id, aku_Timestamp ts, double value) {
+        out_timestamps_.push_back(ts);
+        out_paramids_.push_back(id);
+        out_values_.push_back(value);
+    }
+
+    double interpolate(State const& lo, State const& hi, aku_Timestamp ts) const {
+        switch (interpolation_) {
+        case PREVIOUS:
+            return lo.value;
+        case NEXT:
+            return hi.value;
+        case LINEAR:
+            break;
+        };
+        double k = static_cast<double>(ts - lo.ts) / static_cast<double>(hi.ts - lo.ts);
+        return lo.value + (hi.value - lo.value)*k;
+    }
+
+    //! Add value to the series, returns false if the next node doesn't need more data
+    bool add_value(aku_ParamId id, aku_Timestamp ts, double value) {
+        auto slot = slots_.get(id);
+        if (slot == states_.size()) {
+            State empty = {};
+            states_.push_back(empty);
+        }
+        auto& state = states_[slot];
+        State curr = { ts, value, true };
+        if (state.valid && ts != state.ts) {
+            bool forward = ts > state.ts;
+            State const& lo = forward ? state : curr;
+            State const& hi = forward ? curr : state;
+            bool gap = hi.ts - lo.ts > max_gap_;
+            if (!gap || has_fill_) {
+                // Grid points strictly between samples
+                aku_Timestamp first = lo.ts / step_ * step_ + step_;
+                aku_Timestamp last = (hi.ts - 1) / step_ * step_;
+                aku_Timestamp npoints = first <= last ? (last - first) / step_ + 1 : 0u;
+                for (aku_Timestamp i = 0; i < npoints; i++) {
+                    aku_Timestamp point = forward ? first + i*step_ : last - i*step_;
+                    emit(id, point, gap ? fill_ : interpolate(lo, hi, point));
+                    // Long gap can produce any number of points
+                    if (out_values_.size() == MAX_BATCH && !flush()) {
+                        return false;
+                    }
+                }
+            }
+        }
+        if (ts % step_ == 0 && !(state.valid && ts == state.ts)) {
+            emit(id, ts, value);
+        }
+        state = curr;
+        return true;
+    }
+
+    bool flush() {
+        if (out_values_.empty()) {
+            return true;
+        }
+        SampleBatch batch = {
+            out_timestamps_.data(),
+            out_paramids_.data(),
+            out_values_.data(),
+            nullptr,
+            static_cast<uint32_t>(out_values_.size())
+        };
+        bool result = next_->put_batch(batch);
+        out_timestamps_.clear();
+        out_paramids_.clear();
+        out_values_.clear();
+        return result;
+    }
+
+    virtual bool put(const aku_Sample &sample) {
+        // ignore BLOBs
+        if (sample.payload.type == aku_PData::FLOAT) {
+            return add_value(sample.paramid, sample.timestamp, sample.payload.value.float64) && flush();
+        }
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            if (!add_value(batch.paramids[row], batch.timestamps[row], batch.values[row])) {
+                return false;
+            }
+        }
+        return flush();
+    }
+
+    virtual void complete() {
+        next_->complete();
+    }
+
+    virtual void set_error(aku_Status status) {
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return Node::Resampler;
+    }
+};
+
+/** Per-series transformation.
+  * Program is a flat list of operations compiled from the query, each operation is
+  * applied to the whole batch before the next one. Stateful operations (rate and
+  * derivative) keep previous value of each series and drop the first sample of the
+  * series. BLOBs are ignored.
+  */
+struct TransformNode : Node {
+    enum OpCode {
+        RATE,           //< Per-second rate of the monotonic counter (handles counter resets)
+        DERIVATIVE,     //< Per-second derivative
+        SCALE,          //< Multiply by constant
+        ABS,            //< Absolute value
+        CLAMP,          //< Limit value to [arg0, arg1] range
+    };
+
+    struct Op {
+        OpCode   code;
+        double   arg0;
+        double   arg1;
+        uint32_t state;  //< Index of the state (stateful operations only)
+    };
+
+    struct State {
+        aku_Timestamp ts;
+        double        value;
+        bool          valid;
+    };
+
+    std::vector<Op> program_;
+    uint32_t nstates_;                      //< Number of stateful operations
+    std::shared_ptr<Node> next_;
+    SeriesSlots slots_;
+    std::vector<State> states_;             //< nstates_ states for each series
+    // Output buffers
+    std::vector<aku_Timestamp> timestamps_;
+    std::vector<aku_ParamId> paramids_;
+    std::vector<double> values_;
+
+    TransformNode(std::vector<Op> program, std::vector<aku_ParamId> const& ids, std::shared_ptr<Node> next)
+        : program_(program)
+        , nstates_(0u)
+        , next_(next)
+        , slots_(ids)
+    {
+        for (auto& op: program_) {
+            if (op.code == RATE || op.code == DERIVATIVE) {
+                op.state = nstates_++;
+            }
+        }
+        State empty = {};
+        states_.resize(slots_.size()*nstates_, empty);
+    }
+
+    //! Apply stateful operation to all rows, rows without result are removed
+    void apply_stateful(Op const& op) {
+        size_t w = 0;
+        for (size_t i = 0; i < values_.size(); i++) {
+            auto id = paramids_[i];
+            auto slot = slots_.get(id);
+            if (slot*nstates_ == states_.size()) {
+                State empty = {};
+                states_.resize(states_.size() + nstates_, empty);
+            }
+            auto& state = states_[slot*nstates_ + op.state];
+            State curr = { timestamps_[i], values_[i], true };
+            bool valid = state.valid && curr.ts != state.ts;
+            double result = 0.0;
+            if (valid) {
+                // Scan direction doesn't matter, result is computed in time order
+                bool forward = curr.ts > state.ts;
+                State const& lo = forward ? state : curr;
+                State const& hi = forward ? curr : state;
+                double delta = hi.value - lo.value;
+                if (op.code == RATE && delta < 0.0) {
+                    // Counter reset
+                    delta = hi.value;
+                }
+                result = delta / ((hi.ts - lo.ts) / 1000000000.0);
+            }
+            state = curr;
+            if (valid) {
+                timestamps_[w] = timestamps_[i];
+                paramids_[w] = id;
+                values_[w] = result;
+                w++;
+            }
+        }
+        timestamps_.resize(w);
+        paramids_.resize(w);
+        values_.resize(w);
+    }
+
+    bool run() {
+        for (auto const& op: program_) {
+            switch (op.code) {
+            case RATE:
+            case DERIVATIVE:
+                apply_stateful(op);
+                break;
+            case SCALE:
+                for (auto& value: values_) {
+                    value *= op.arg0;
+                }
+                break;
+            case ABS:
+                for (auto& value: values_) {
+                    value = std::abs(value);
+                }
+                break;
+            case CLAMP:
+                for (auto& value: values_) {
+                    value = std::min(std::max(value, op.arg0), op.arg1);
+                }
+                break;
+            };
+        }
+        bool result = true;
+        if (!values_.empty()) {
+            SampleBatch batch = {
+                timestamps_.data(),
+                paramids_.data(),
+                values_.data(),
+                nullptr,
+                static_cast<uint32_t>(values_.size())
+            };
+            result = next_->put_batch(batch);
+        }
+        timestamps_.clear();
+        paramids_.clear();
+        values_.clear();
+        return result;
+    }
+
+    virtual bool put(const aku_Sample &sample) {
+        // ignore BLOBs
+        if (sample.payload.type == aku_PData::FLOAT) {
+            timestamps_.push_back(sample.timestamp);
+            paramids_.push_back(sample.paramid);
+            values_.push_back(sample.payload.value.float64);
+            return run();
+        }
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            timestamps_.push_back(batch.timestamps[row]);
+            paramids_.push_back(batch.paramids[row]);
+            values_.push_back(batch.values[row]);
+        }
+        return run();
+    }
+
+    virtual void complete() {
+        next_->complete();
+    }
+
+    virtual void set_error(aku_Status status) {
+        next_->set_error(status);
+    }
+
+    virtual NodeType get_type() const {
+        return Node::Transform;
+    }
+};
+
+/** Binary operation between two series.
+  * Values of the `lhs` and `rhs` series with equal timestamps are combined and emitted
+  * as a value of the `out` series (series should be aligned, e.g. by resampler). Values
+  * without a pair are dropped, samples of other series are ignored.
+  */
+struct CombineNode : Node {
+    enum OpCode {
+        ADD, SUB, MUL, DIV
+    };
+
+    struct Pending {
+        bool   has_lhs;
+        double lhs;
+        bool   has_rhs;
+        double rhs;
+    };
+
+    struct Side {
+        aku_Timestamp first;
+        aku_Timestamp last;
+        bool          valid;
+    };
+
+    OpCode const op_;
+    aku_ParamId const lhs_;
+    aku_ParamId const rhs_;
+    aku_ParamId const out_;
+    std::shared_ptr<Node> next_;
+    std::map<aku_Timestamp, Pending> pending_;  //< Values waiting for the pair
+    Side sides_[2];
+
+    CombineNode(OpCode op, aku_ParamId lhs, aku_ParamId rhs, aku_ParamId out, std::shared_ptr<Node> next)
+        : op_(op)
+        , lhs_(lhs)
+        , rhs_(rhs)
+        , out_(out)
+        , next_(next)
+    {
+        sides_[0] = sides_[1] = Side();
+    }
+
+    double apply(double lhs, double rhs) const {
+        switch (op_) {
+        case ADD:
+            return lhs + rhs;
+        case SUB:
+            return lhs - rhs;
+        case MUL:
+            return lhs * rhs;
+        case DIV:
+            break;
+        };
+        return lhs / rhs;
+    }
+
+    //! Remove values that can't be paired (both series have moved past them)
+    void evict() {
+        auto const& l = sides_[0];
+        auto const& r = sides_[1];
+        if (!l.valid || !r.valid) {
+            return;
+        }
+        bool backward = l.last < l.first || r.last < r.first;
+        if (!backward) {
+            auto limit = std::min(l.last, r.last);
+            while (!pending_.empty() && pending_.begin()->first < limit) {
+                pending_.erase(pending_.begin());
+            }
         } else {
-            // Flip a coin
-            uint32_t ix = random_() % samples_.size();
-            if (ix < buffer_size_) {
-                samples_.at(ix) = sample;
+            auto limit = std::max(l.last, r.last);
+            while (!pending_.empty() && pending_.rbegin()->first > limit) {
+                pending_.erase(std::prev(pending_.end()));
+            }
+        }
+    }
+
+    bool add_value(aku_ParamId id, aku_Timestamp ts, double value) {
+        bool is_lhs = id == lhs_;
+        if (!is_lhs && id != rhs_) {
+            return true;
+        }
+        auto& side = sides_[is_lhs ? 0 : 1];
+        if (!side.valid) {
+            side.first = ts;
+            side.valid = true;
+        }
+        side.last = ts;
+        auto it = pending_.find(ts);
+        if (it == pending_.end()) {
+            Pending item = {};
+            it = pending_.insert(std::make_pair(ts, item)).first;
+        }
+        auto& item = it->second;
+        if (is_lhs) {
+            item.has_lhs = true;
+            item.lhs = value;
+        } else {
+            item.has_rhs = true;
+            item.rhs = value;
+        }
+        if (item.has_lhs && item.has_rhs) {
+            aku_Sample sample;
+            sample.paramid = out_;
+            sample.timestamp = ts;
+            sample.payload.type = aku_PData::FLOAT;
+            sample.payload.value.float64 = apply(item.lhs, item.rhs);
+            pending_.erase(it);
+            if (!next_->put(sample)) {
+                return false;
             }
         }
+        evict();
         return true;
     }
 
-    void set_error(aku_Status status) {
-        if (!next_) {
-            AKU_PANIC("bad query processor node, next not set");
+    virtual bool put(const aku_Sample &sample) {
+        // ignore BLOBs
+        if (sample.payload.type == aku_PData::FLOAT) {
+            return add_value(sample.paramid, sample.timestamp, sample.payload.value.float64);
+        }
+        return true;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            if (!add_value(batch.paramids[row], batch.timestamps[row], batch.values[row])) {
+                return false;
+            }
         }
+        return true;
+    }
+
+    virtual void complete() {
+        next_->complete();
+    }
+
+    virtual void set_error(aku_Status status) {
         next_->set_error(status);
     }
-};
 
+    virtual NodeType get_type() const {
+        return Node::Combine;
+    }
+};
 
-/** Filter ids using predicate.
-  * Predicate is an unary functor that accepts parameter of type aku_ParamId - fun(aku_ParamId) -> bool.
+/** Value filter.
+  * Passes only float values that match the predicate, BLOBs are dropped.
   */
-template<class Predicate>
-struct FilterByIdNode : std::enable_shared_from_this<FilterByIdNode<Predicate>>, Node {
-    //! Id matching predicate
-    Predicate op_;
+struct FilterByValueNode : Node {
+    ValueFilter const filter_;
     std::shared_ptr<Node> next_;
+    std::vector<uint32_t> selection_;   //< Selection vector of the last batch
 
-    FilterByIdNode(Predicate pred, std::shared_ptr<Node> next)
-        : op_(pred)
+    FilterByValueNode(ValueFilter const& filter, std::shared_ptr<Node> next)
+        : filter_(filter)
         , next_(next)
     {
     }
 
-    // Bolt interface
     virtual void complete() {
-        if (!next_) {
-            AKU_PANIC("bad query processor node, next not set");
-        }
         next_->complete();
     }
 
     virtual bool put(const aku_Sample& sample) {
-        if (!next_) {
-            AKU_PANIC("bad query processor node, next not set");
+        if (sample.payload.type == aku_PData::FLOAT && filter_.match(sample.payload.value.float64)) {
+            return next_->put(sample);
         }
-        return op_(sample.paramid) ? next_->put(sample) : true;
+        return true;
     }
 
-    void set_error(aku_Status status) {
-        if (!next_) {
-            AKU_PANIC("bad query processor node, next not set");
+    virtual bool put_batch(SampleBatch const& batch) {
+        selection_.clear();
+        for (uint32_t i = 0; i < batch.size; i++) {
+            auto row = batch.row(i);
+            if (filter_.match(batch.values[row])) {
+                selection_.push_back(row);
+            }
+        }
+        if (selection_.empty()) {
+            return true;
         }
+        if (selection_.size() == batch.size) {
+            // Batch could be already filtered by storage
+            return next_->put_batch(batch);
+        }
+        SampleBatch filtered = batch;
+        filtered.selection = selection_.data();
+        filtered.size = static_cast<uint32_t>(selection_.size());
+        return next_->put_batch(filtered);
+    }
+
+    virtual void set_error(aku_Status status) {
         next_->set_error(status);
     }
 
     virtual NodeType get_type() const {
-        return NodeType::FilterById;
+        return Node::FilterByValue;
     }
 };
 
-struct MovingAverage : Node {
-    struct MACounter {
-        double acc;
-        size_t num;
-    };
 
-    aku_Timestamp const step_;
-    bool first_hit_;
-    aku_Timestamp lowerbound_, upperbound_;
+/** Limits number of samples passed to the next node.
+  * Returns false from `put` and `put_batch` when the limit is reached so the
+  * storage can stop the scan.
+  */
+struct LimitNode : Node {
+    uint64_t limit_;    //< Number of samples that should be passed to the next node
+    uint64_t offset_;   //< Number of samples that should be skipped
     std::shared_ptr<Node> next_;
 
-    MovingAverage(aku_Timestamp step, std::shared_ptr<Node> next)
-        : step_(step)
-        , first_hit_(true)
-        , lowerbound_(AKU_MIN_TIMESTAMP)
-        , upperbound_(AKU_MIN_TIMESTAMP)
+    LimitNode(uint64_t limit, uint64_t offset, std::shared_ptr<Node> next)
+        : limit_(limit)
+        , offset_(offset)
         , next_(next)
     {
     }
 
-    std::unordered_map<aku_ParamId, MACounter> counters_;
-
-    bool average_samples() {
-        for (auto& cnt: counters_) {
-            if (cnt.second.num) {
-                aku_Sample sample;
-                sample.paramid = cnt.first;
-                sample.payload.value.float64 = cnt.second.acc / cnt.second.num;
-                sample.payload.type = aku_PData::FLOAT;
-                sample.timestamp = upperbound_;
-                cnt.second = {};
-                if (!next_->put(sample)) {
-                    return false;
-                }
-            }
-        }
-        return true;
-    }
-
     virtual void complete() {
-        average_samples();
         next_->complete();
     }
 
-    virtual bool put(const aku_Sample &sample) {
-        // ignore BLOBs
-        if (sample.payload.type == aku_PData::FLOAT) {
-            aku_ParamId id = sample.paramid;
-            aku_Timestamp ts = sample.timestamp;
-            if (AKU_UNLIKELY(first_hit_ == true)) {
-                first_hit_ = false;
-                aku_Timestamp aligned = ts / step_ * step_;
-                // aligned <= ts
-                lowerbound_ = aligned;
-                upperbound_ = aligned + step_;
-            }
-            double value = sample.payload.value.float64;
-            if (ts > upperbound_) {
-                // Forward direction
-                if (!average_samples()) {
-                    return false;
-                }
-                lowerbound_ += step_;
-                upperbound_ += step_;
-            } else if (ts < lowerbound_) {
-                // Backward direction
-                if (!average_samples()) {
-                    return false;
-                }
-                lowerbound_ -= step_;
-                upperbound_ -= step_;
-            } else {
-                auto& cnt = counters_[id];
-                cnt.acc += value;
-                cnt.num += 1;
-            }
+    virtual bool put(const aku_Sample& sample) {
+        if (limit_ == 0) {
+            return false;
         }
-        return true;
+        if (offset_) {
+            offset_--;
+            return true;
+        }
+        limit_--;
+        return next_->put(sample) && limit_ != 0;
+    }
+
+    virtual bool put_batch(SampleBatch const& batch) {
+        if (limit_ == 0) {
+            return false;
+        }
+        uint32_t skip = static_cast<uint32_t>(std::min<uint64_t>(offset_, batch.size));
+        uint32_t take = static_cast<uint32_t>(std::min<uint64_t>(limit_, batch.size - skip));
+        offset_ -= skip;
+        if (take == 0) {
+            return true;
+        }
+        limit_ -= take;
+        SampleBatch head = batch;
+        if (batch.selection) {
+            head.selection = batch.selection + skip;
+        } else {
+            head.timestamps = batch.timestamps + skip;
+            head.paramids = batch.paramids + skip;
+            head.values = batch.values + skip;
+        }
+        head.size = take;
+        return next_->put_batch(head) && limit_ != 0;
     }
 
     virtual void set_error(aku_Status status) {
@@ -229,7 +1481,7 @@ struct MovingAverage : Node {
     }
 
     virtual NodeType get_type() const {
-        return Node::MovingAverage;
+        return Node::Limit;
     }
 };
 
@@ -271,6 +1523,301 @@ std::shared_ptr<Node> NodeBuilder::make_sampler(boost::property_tree::ptree cons
     }
 }
 
+/** Parse aggregation function name.
+  * @throws NodeException if name is unknown, bad_lexical_cast if percentile is malformed
+  */
+static SeriesAccumulator::FuncSpec parse_aggregate_func(std::string const& name, Node::NodeType type) {
+    typedef SeriesAccumulator::FuncSpec FuncSpec;
+    static const std::pair<const char*, SeriesAccumulator::Func> FUNCS[] = {
+        { "min",   SeriesAccumulator::MIN   },
+        { "max",   SeriesAccumulator::MAX   },
+        { "sum",   SeriesAccumulator::SUM   },
+        { "count", SeriesAccumulator::COUNT },
+        { "avg",   SeriesAccumulator::AVG   },
+        { "first", SeriesAccumulator::FIRST },
+        { "last",  SeriesAccumulator::LAST  },
+    };
+    for (auto const& item: FUNCS) {
+        if (name == item.first) {
+            FuncSpec spec = { item.second, 0.0 };
+            return spec;
+        }
+    }
+    if (name == "median") {
+        FuncSpec spec = { SeriesAccumulator::QUANTILE, 0.5 };
+        return spec;
+    }
+    if (name.size() > 1 && name[0] == 'p') {
+        // Percentile, e.g. "p99" or "p99.9"
+        double pct = boost::lexical_cast<double>(name.substr(1));
+        if (pct >= 0.0 && pct <= 100.0) {
+            FuncSpec spec = { SeriesAccumulator::QUANTILE, pct / 100.0 };
+            return spec;
+        }
+    }
+    NodeException except(type, "invalid query description, unknown aggregation function");
+    BOOST_THROW_EXCEPTION(except);
+}
+
+std::shared_ptr<Node> NodeBuilder::make_aggregate(boost::property_tree::ptree const& ptree,
+                                                  std::shared_ptr<Node> next,
+                                                  aku_logger_cb_t logger,
+                                                  std::vector<aku_ParamId> const& ids)
+{
+    // ptree = { "step": "10s", "func": ["min", "max", "avg", "p99"] }
+    // or
+    // ptree = { "step": "10s", "func": "avg" }
+    // or
+    // ptree = { "step": "10s", "histogram": [0, 10, 100, 1000] }
+    typedef SeriesAccumulator::FuncSpec FuncSpec;
+    try {
+        std::string step = ptree.get<std::string>("step");
+        aku_Timestamp nstep = DateTimeUtil::parse_duration(step.c_str());
+        if (nstep == 0u) {
+            NodeException except(Node::Aggregate, "invalid aggregate description, step can't be zero");
+            BOOST_THROW_EXCEPTION(except);
+        }
+        std::vector<FuncSpec> funcs;
+        auto func = ptree.get_child_optional("func");
+        if (func && func->empty()) {
+            // single value
+            funcs.push_back(parse_aggregate_func(func->get_value<std::string>(), Node::Aggregate));
+        } else if (func) {
+            for (auto const& child: *func) {
+                funcs.push_back(parse_aggregate_func(child.second.get_value<std::string>(), Node::Aggregate));
+            }
+        }
+        std::vector<double> bounds;
+        auto histogram = ptree.get_child_optional("histogram");
+        if (histogram) {
+            for (auto const& child: *histogram) {
+                bounds.push_back(boost::lexical_cast<double>(child.second.get_value<std::string>()));
+            }
+            if (bounds.empty() || !std::is_sorted(bounds.begin(), bounds.end())) {
+                NodeException except(Node::Aggregate, "invalid aggregate description, bad histogram boundaries");
+                BOOST_THROW_EXCEPTION(except);
+            }
+        }
+        if (funcs.empty() && bounds.empty()) {
+            NodeException except(Node::Aggregate, "invalid aggregate description, function or histogram expected");
+            BOOST_THROW_EXCEPTION(except);
+        }
+        return std::make_shared<GroupAggregate>(nstep, funcs, bounds, ids, next);
+    } catch (const boost::property_tree::ptree_error&) {
+        NodeException except(Node::Aggregate, "invalid aggregate description");
+        BOOST_THROW_EXCEPTION(except);
+    } catch (const boost::bad_lexical_cast&) {
+        NodeException except(Node::Aggregate, "invalid aggregate description, number expected");
+        BOOST_THROW_EXCEPTION(except);
+    } catch (const BadDateTimeFormat&) {
+        NodeException except(Node::Aggregate, "invalid aggregate description, bad step");
+        BOOST_THROW_EXCEPTION(except);
+    }
+}
+
+std::shared_ptr<Node> NodeBuilder::make_resampler(boost::property_tree::ptree const& ptree,
+                                                  std::shared_ptr<Node> next,
+                                                  aku_logger_cb_t logger,
+                                                  std::vector<aku_ParamId> const& ids)
+{
+    // ptree = { "step": "10s", "interpolation": "linear", "max_gap": "1m", "fill": 0 }
+    try {
+        std::string step = ptree.get<std::string>("step");
+        aku_Timestamp nstep = DateTimeUtil::parse_duration(step.c_str());
+        if (nstep == 0u) {
+            NodeException except(Node::Resampler, "invalid resampler description, step can't be zero");
+            BOOST_THROW_EXCEPTION(except);
+        }
+        Resampler::Interpolation interpolation;
+        std::string method = ptree.get<std::string>("interpolation", "linear");
+        if (method == "linear") {
+            interpolation = Resampler::LINEAR;
+        } else if (method == "previous") {
+            interpolation = Resampler::PREVIOUS;
+        } else if (method == "next") {
+            interpolation = Resampler::NEXT;
+        } else {
+            NodeException except(Node::Resampler, "invalid resampler description, unknown interpolation method");
+            BOOST_THROW_EXCEPTION(except);
+        }
+        aku_Timestamp max_gap = AKU_MAX_TIMESTAMP;
+        auto gap = ptree.get_optional<std::string>("max_gap");
+        if (gap) {
+            max_gap = DateTimeUtil::parse_duration(gap->c_str());
+        }
+        auto fill = ptree.get_optional<std::string>("fill");
+        double fill_value = 0.0;
+        if (fill) {
+            fill_value = boost::lexical_cast<double>(*fill);
+        }
+        return std::make_shared<Resampler>(nstep, interpolation, max_gap, static_cast<bool>(fill), fill_value, ids, next);
+    } catch (const boost::property_tree::ptree_error&) {
+        NodeException except(Node::Resampler, "invalid resampler description");
+        BOOST_THROW_EXCEPTION(except);
+    } catch (const boost::bad_lexical_cast&) {
+        NodeException except(Node::Resampler, "invalid resampler description, number expected");
+        BOOST_THROW_EXCEPTION(except);
+    } catch (const BadDateTimeFormat&) {
+        NodeException except(Node::Resampler, "invalid resampler description, bad duration");
+        BOOST_THROW_EXCEPTION(except);
+    }
+}
+
+std::shared_ptr<Node> NodeBuilder::make_topk(boost::property_tree::ptree const& ptree,
+                                             bool bottom,
+                                             std::shared_ptr<Node> next,
+                                             aku_logger_cb_t logger,
+                                             std::vector<aku_ParamId> const& ids)
+{
+    // ptree = { "k": 10, "by": "max" }
+    try {
+        size_t k = ptree.get<size_t>("k");
+        if (k == 0u) {
+            NodeException except(Node::TopK, "invalid top-k description, k can't be zero");
+            BOOST_THROW_EXCEPTION(except);
+        }
+        auto by = parse_aggregate_func(ptree.get<std::string>("by", "max"), Node::TopK);
+        return std::make_shared<TopK>(k, by, bottom, ids, next);
+    } catch (const boost::property_tree::ptree_error&) {
+        NodeException except(Node::TopK, "invalid top-k description");
+        BOOST_THROW_EXCEPTION(except);
+    } catch (const boost::bad_lexical_cast&) {
+        NodeException except(Node::TopK, "invalid top-k description, number expected");
+        BOOST_THROW_EXCEPTION(except);
+    }
+}
+
+std::shared_ptr<Node> NodeBuilder::make_group_by(std::vector<aku_ParamId> const& ids,
+                                                 std::vector<aku_ParamId> const& groups,
+                                                 std::shared_ptr<Node> next,
+                                                 aku_logger_cb_t logger)
+{
+    if (ids.size() != groups.size() || ids.empty()) {
+        NodeException except(Node::GroupBy, "invalid group-by mapping");
+        BOOST_THROW_EXCEPTION(except);
+    }
+    auto minmax = std::minmax_element(ids.begin(), ids.end());
+    aku_ParamId base = *minmax.first;
+    std::vector<aku_ParamId> dense(*minmax.second - base + 1, 0u);
+    for (size_t i = 0; i < ids.size(); i++) {
+        dense[ids[i] - base] = groups[i];
+    }
+    return std::make_shared<GroupByNode>(base, std::move(dense), next);
+}
+
+std::shared_ptr<Node> NodeBuilder::make_transform(boost::property_tree::ptree const& ptree,
+                                                  std::shared_ptr<Node> next,
+                                                  aku_logger_cb_t logger,
+                                                  std::vector<aku_ParamId> const& ids)
+{
+    // ptree = [ "rate", {"scale": 100}, "abs", {"clamp": [0, 100]} ]
+    typedef TransformNode::Op Op;
+    std::vector<Op> program;
+    try {
+        for (auto const& child: ptree) {
+            auto const& item = child.second;
+            std::string name;
+            std::vector<double> args;
+            if (item.empty()) {
+                name = item.get_value<std::string>();
+            } else {
+                name = item.begin()->first;
+                auto const& value = item.begin()->second;
+                if (value.empty()) {
+                    args.push_back(boost::lexical_cast<double>(value.get_value<std::string>()));
+                } else {
+                    for (auto const& arg: value) {
+                        args.push_back(boost::lexical_cast<double>(arg.second.get_value<std::string>()));
+                    }
+                }
+            }
+            Op op = {};
+            size_t nargs = 0;
+            if (name == "rate") {
+                op.code = TransformNode::RATE;
+            } else if (name == "derivative") {
+                op.code = TransformNode::DERIVATIVE;
+            } else if (name == "abs") {
+                op.code = TransformNode::ABS;
+            } else if (name == "scale") {
+                op.code = TransformNode::SCALE;
+                nargs = 1;
+            } else if (name == "clamp") {
+                op.code = TransformNode::CLAMP;
+                nargs = 2;
+            } else {
+                NodeException except(Node::Transform, "invalid transform description, unknown function");
+                BOOST_THROW_EXCEPTION(except);
+            }
+            if (args.size() != nargs) {
+                NodeException except(Node::Transform, "invalid transform description, wrong number of arguments");
+                BOOST_THROW_EXCEPTION(except);
+            }
+            if (nargs > 0) {
+                op.arg0 = args[0];
+            }
+            if (nargs > 1) {
+                op.arg1 = args[1];
+            }
+            program.push_back(op);
+        }
+    } catch (const boost::bad_lexical_cast&) {
+        NodeException except(Node::Transform, "invalid transform description, number expected");
+        BOOST_THROW_EXCEPTION(except);
+    }
+    if (program.empty()) {
+        NodeException except(Node::Transform, "invalid transform description, empty list");
+        BOOST_THROW_EXCEPTION(except);
+    }
+    bool stateful = std::any_of(program.begin(), program.end(), [](Op const& op) {
+        return op.code == TransformNode::RATE || op.code == TransformNode::DERIVATIVE;
+    });
+    // Slots are needed only by stateful operations
+    return std::make_shared<TransformNode>(program, stateful ? ids : std::vector<aku_ParamId>(), next);
+}
+
+std::shared_ptr<Node> NodeBuilder::make_combine(std::string const& op,
+                                                aku_ParamId lhs,
+                                                aku_ParamId rhs,
+                                                aku_ParamId out,
+                                                std::shared_ptr<Node> next,
+                                                aku_logger_cb_t logger)
+{
+    CombineNode::OpCode code;
+    if (op == "add") {
+        code = CombineNode::ADD;
+    } else if (op == "sub") {
+        code = CombineNode::SUB;
+    } else if (op == "mul") {
+        code = CombineNode::MUL;
+    } else if (op == "div") {
+        code = CombineNode::DIV;
+    } else {
+        NodeException except(Node::Combine, "invalid combine description, unknown operation");
+        BOOST_THROW_EXCEPTION(except);
+    }
+    return std::make_shared<CombineNode>(code, lhs, rhs, out, next);
+}
+
+std::shared_ptr<Node> NodeBuilder::make_filter_by_value(ValueFilter const& filter,
+                                                       std::shared_ptr<Node> next,
+                                                       aku_logger_cb_t logger)
+{
+    return std::make_shared<FilterByValueNode>(filter, next);
+}
+
+std::shared_ptr<Node> NodeBuilder::make_limit(uint64_t limit,
+                                             uint64_t offset,
+                                             std::shared_ptr<Node> next,
+                                             aku_logger_cb_t logger)
+{
+    if (limit == 0) {
+        NodeException except(Node::Limit, "limit should be greater than zero");
+        BOOST_THROW_EXCEPTION(except);
+    }
+    return std::make_shared<LimitNode>(limit, offset, next);
+}
+
 std::shared_ptr<Node> NodeBuilder::make_filter_by_id(aku_ParamId id, std::shared_ptr<Node> next, aku_logger_cb_t logger) {
     struct Fun {
         aku_ParamId id_;
@@ -328,16 +1875,22 @@ std::shared_ptr<Node> NodeBuilder::make_filter_out_by_id_list(std::vector<aku_Pa
 ScanQueryProcessor::ScanQueryProcessor(std::shared_ptr<Node> root,
                std::vector<std::string> metrics,
                aku_Timestamp begin,
-               aku_Timestamp end)
+               aku_Timestamp end,
+               std::shared_ptr<ValueFilter> filter)
     : lowerbound_(std::min(begin, end))
     , upperbound_(std::max(begin, end))
     , direction_(begin > end ? AKU_CURSOR_DIR_BACKWARD : AKU_CURSOR_DIR_FORWARD)
     , metrics_(metrics)
     , namesofinterest_(StringTools::create_table(0x1000))
     , root_node_(root)
+    , value_filter_(filter)
 {
 }
 
+ValueFilter const* ScanQueryProcessor::value_filter() const {
+    return value_filter_.get();
+}
+
 bool ScanQueryProcessor::start() {
     return true;
 }
@@ -346,6 +1899,10 @@ bool ScanQueryProcessor::put(const aku_Sample &sample) {
     return root_node_->put(sample);
 }
 
+bool ScanQueryProcessor::put_batch(SampleBatch const& batch) {
+    return root_node_->put_batch(batch);
+}
+
 void ScanQueryProcessor::stop() {
     root_node_->complete();
 }
@@ -366,6 +1923,45 @@ int ScanQueryProcessor::direction() const {
     return direction_;
 }
 
+BatchBuilder::BatchBuilder(IQueryProcessor& query)
+    : query_(query)
+{
+    timestamps_.reserve(CAPACITY);
+    paramids_.reserve(CAPACITY);
+    values_.reserve(CAPACITY);
+}
+
+bool BatchBuilder::put(aku_Sample const& sample) {
+    if (sample.payload.type != aku_PData::FLOAT) {
+        return flush() && query_.put(sample);
+    }
+    timestamps_.push_back(sample.timestamp);
+    paramids_.push_back(sample.paramid);
+    values_.push_back(sample.payload.value.float64);
+    if (timestamps_.size() == CAPACITY) {
+        return flush();
+    }
+    return true;
+}
+
+bool BatchBuilder::flush() {
+    if (timestamps_.empty()) {
+        return true;
+    }
+    SampleBatch batch = {
+        timestamps_.data(),
+        paramids_.data(),
+        values_.data(),
+        nullptr,
+        static_cast<uint32_t>(timestamps_.size()),
+    };
+    bool result = query_.put_batch(batch);
+    timestamps_.clear();
+    paramids_.clear();
+    values_.clear();
+    return result;
+}
+
 MetadataQueryProcessor::MetadataQueryProcessor(std::vector<aku_ParamId> ids, std::shared_ptr<Node> node)
     : ids_(ids)
     , root_(node)
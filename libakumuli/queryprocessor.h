@@ -41,6 +41,72 @@ struct NodeBuilder {
                                                      std::shared_ptr<Node> next,
                                                      aku_logger_cb_t logger);
 
+    /** Create resampling node.
+      * @param ids list of series ids known at plan time (per-series state is preallocated)
+      */
+    static std::shared_ptr<Node> make_resampler(const boost::property_tree::ptree &ptree,
+                                                std::shared_ptr<Node> next,
+                                                aku_logger_cb_t logger,
+                                                std::vector<aku_ParamId> const& ids = std::vector<aku_ParamId>());
+
+    /** Create time-bucketed aggregation node.
+      * @param ids list of series (or group) ids known at plan time
+      */
+    static std::shared_ptr<Node> make_aggregate(const boost::property_tree::ptree &ptree,
+                                                std::shared_ptr<Node> next,
+                                                aku_logger_cb_t logger,
+                                                std::vector<aku_ParamId> const& ids = std::vector<aku_ParamId>());
+
+    /** Create top-k (or bottom-k if `bottom` is set) series selection node.
+      * @param ids list of series (or group) ids known at plan time
+      */
+    static std::shared_ptr<Node> make_topk(const boost::property_tree::ptree &ptree,
+                                           bool bottom,
+                                           std::shared_ptr<Node> next,
+                                           aku_logger_cb_t logger,
+                                           std::vector<aku_ParamId> const& ids = std::vector<aku_ParamId>());
+
+    /** Create group-by node.
+      * @param ids list of series ids
+      * @param groups list of group ids (groups[i] is a group of the ids[i] series)
+      */
+    static std::shared_ptr<Node> make_group_by(std::vector<aku_ParamId> const& ids,
+                                               std::vector<aku_ParamId> const& groups,
+                                               std::shared_ptr<Node> next,
+                                               aku_logger_cb_t logger);
+
+    /** Create per-series transformation node.
+      * @param ids list of series ids known at plan time
+      */
+    static std::shared_ptr<Node> make_transform(const boost::property_tree::ptree &ptree,
+                                                std::shared_ptr<Node> next,
+                                                aku_logger_cb_t logger,
+                                                std::vector<aku_ParamId> const& ids = std::vector<aku_ParamId>());
+
+    /** Create node that combines two series.
+      * @param op operation name ("add", "sub", "mul" or "div")
+      * @param out id of the output series
+      */
+    static std::shared_ptr<Node> make_combine(std::string const& op,
+                                              aku_ParamId lhs,
+                                              aku_ParamId rhs,
+                                              aku_ParamId out,
+                                              std::shared_ptr<Node> next,
+                                              aku_logger_cb_t logger);
+
+    //! Create node that filters values
+    static std::shared_ptr<Node> make_filter_by_value(ValueFilter const& filter,
+                                                      std::shared_ptr<Node> next,
+                                                      aku_logger_cb_t logger);
+
+    /** Create node that skips first `offset` samples and passes next `limit` samples.
+      * Node interrupts the query when the limit is reached.
+      */
+    static std::shared_ptr<Node> make_limit(uint64_t limit,
+                                            uint64_t offset,
+                                            std::shared_ptr<Node> next,
+                                            aku_logger_cb_t logger);
+
     //! Create filtering node
     static std::shared_ptr<Node> make_filter_by_id(aku_ParamId id, std::shared_ptr<Node> next,
                                                    aku_logger_cb_t logger);
@@ -76,6 +142,8 @@ struct ScanQueryProcessor : IQueryProcessor {
 
     //! Root of the processing topology
     std::shared_ptr<Node>              root_node_;
+    //! Value predicate (can be null)
+    std::shared_ptr<ValueFilter>       value_filter_;
 
     /** Create new query processor.
       * @param root is a root of the processing topology
@@ -83,11 +151,14 @@ struct ScanQueryProcessor : IQueryProcessor {
       * @param begin is a timestamp to begin from
       * @param end is a timestamp to end with
       *        (depending on a scan direction can be greater or smaller then lo)
+      * @param filter is a value predicate that storage can apply during scan (optional,
+      *        topology should filter values too)
       */
     ScanQueryProcessor(std::shared_ptr<Node> root,
                    std::vector<std::string> metrics,
                    aku_Timestamp begin,
-                   aku_Timestamp end);
+                   aku_Timestamp end,
+                   std::shared_ptr<ValueFilter> filter = std::shared_ptr<ValueFilter>());
 
     //! Lowerbound
     aku_Timestamp lowerbound() const;
@@ -103,6 +174,12 @@ struct ScanQueryProcessor : IQueryProcessor {
     //! Process value
     bool put(const aku_Sample& sample);
 
+    //! Process batch of values
+    bool put_batch(SampleBatch const& batch);
+
+    //! Value predicate
+    ValueFilter const* value_filter() const;
+
     //! Should be called when processing completed
     void stop();
 
@@ -111,6 +188,27 @@ struct ScanQueryProcessor : IQueryProcessor {
 };
 
 
+/** Collects float samples into batches and passes them to query processor using `put_batch`.
+  * Other samples are passed using `put` (pending batch is flushed first to keep the order).
+  */
+class BatchBuilder {
+    static const size_t CAPACITY = 0x400;
+
+    IQueryProcessor&            query_;
+    std::vector<aku_Timestamp>  timestamps_;
+    std::vector<aku_ParamId>    paramids_;
+    std::vector<double>         values_;
+public:
+    BatchBuilder(IQueryProcessor& query);
+
+    //! Add sample, returns false if query processor was interrupted
+    bool put(aku_Sample const& sample);
+
+    //! Pass pending samples to query processor, returns false if query processor was interrupted
+    bool flush();
+};
+
+
 struct MetadataQueryProcessor : IQueryProcessor {
 
     std::vector<aku_ParamId> ids_;
@@ -1,9 +1,71 @@
 #pragma once
 #include "akumuli.h"
 
+#include <limits>
+
 namespace Akumuli {
 namespace QP {
 
+/** Batch of float samples in columnar form.
+  * If `selection` is null rows [0, size) are selected, otherwise only rows
+  * listed in `selection` are selected (in this order).
+  */
+struct SampleBatch {
+    aku_Timestamp const* timestamps;
+    aku_ParamId   const* paramids;
+    double        const* values;
+    uint32_t      const* selection;
+    uint32_t             size;          //< Number of selected rows
+
+    //! Get row index of the ix-th selected sample
+    uint32_t row(uint32_t ix) const {
+        return selection ? selection[ix] : ix;
+    }
+
+    //! Get ix-th selected sample
+    aku_Sample get(uint32_t ix) const {
+        auto r = row(ix);
+        aku_Sample sample;
+        sample.timestamp = timestamps[r];
+        sample.paramid = paramids[r];
+        sample.payload.type = aku_PData::FLOAT;
+        sample.payload.value.float64 = values[r];
+        return sample;
+    }
+};
+
+/** Value predicate - range of the float values.
+  * Can be pushed down to storage to filter values before they are passed
+  * to query processor.
+  */
+struct ValueFilter {
+    double lowerbound;
+    double upperbound;
+    bool   lower_inclusive;
+    bool   upper_inclusive;
+
+    //! Create filter that matches every value
+    ValueFilter()
+        : lowerbound(-std::numeric_limits<double>::infinity())
+        , upperbound(std::numeric_limits<double>::infinity())
+        , lower_inclusive(true)
+        , upper_inclusive(true)
+    {
+    }
+
+    bool match(double value) const {
+        return (lower_inclusive ? value >= lowerbound : value > lowerbound) &&
+               (upper_inclusive ? value <= upperbound : value < upperbound);
+    }
+
+    //! Check if any value from [min, max] range can match
+    bool match_range(double min, double max) const {
+        return min <= max &&
+               (upper_inclusive ? min <= upperbound : min < upperbound) &&
+               (lower_inclusive ? max >= lowerbound : max > lowerbound);
+    }
+};
+
 struct Node {
 
     enum NodeType {
@@ -11,10 +73,18 @@ struct Node {
         RandomSampler,
         MovingAverage,
         Resampler,
+        // Aggregation
+        Aggregate,
+        TopK,
         // Filtering
         FilterById,
+        FilterByValue,
+        Limit,
         // Group by
         GroupBy,
+        // Arithmetic
+        Transform,
+        Combine,
         // Testing
         Mock,
         // Cursor node
@@ -29,6 +99,18 @@ struct Node {
     //! Process value, return false to interrupt process
     virtual bool put(aku_Sample const& sample) = 0;
 
+    /** Process batch of values, return false to interrupt process.
+      * Default implementation calls `put` for every sample.
+      */
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            if (!put(batch.get(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     virtual void set_error(aku_Status status) = 0;
 
     // Introspections
@@ -63,6 +145,21 @@ struct IQueryProcessor {
     //! Get new value
     virtual bool put(const aku_Sample& sample) = 0;
 
+    //! Get batch of values (default implementation calls `put` for every sample)
+    virtual bool put_batch(SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            if (!put(batch.get(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //! Value predicate that can be applied by storage (null if values shouldn't be filtered)
+    virtual ValueFilter const* value_filter() const {
+        return nullptr;
+    }
+
     //! Will be called when processing completed without errors
     virtual void stop() = 0;
 
@@ -19,11 +19,9 @@
 #include "sequencer.h"
 #include "util.h"
 #include "compression.h"
+#include "loser_tree.h"
 
 #include <thread>
-#include <boost/heap/skew_heap.hpp>
-#include <boost/range.hpp>
-#include <boost/range/iterator_range.hpp>
 
 // Max space required to store one data element
 #define SPACE_PER_ELEMENT 20
@@ -32,18 +30,6 @@ using namespace std;
 
 namespace Akumuli {
 
-template<typename RunType>
-bool top_element_less(const RunType& x, const RunType& y)
-{
-    return x->back() < y->back();
-}
-
-template<typename RunType>
-bool top_element_more(const RunType& x, const RunType& y)
-{
-    return top_element_less(y, x);
-}
-
 TimeSeriesValue::TimeSeriesValue() {}
 
 TimeSeriesValue::TimeSeriesValue(aku_Timestamp ts, aku_ParamId id, uint32_t value, uint32_t value_length)
@@ -119,20 +105,85 @@ bool chunk_order_LT (TimeSeriesValue const& lhs, TimeSeriesValue const& rhs) {
     return lhstup < rhstup;
 }
 
+// SortedRun
+
+SortedRun::const_iterator SortedRun::Snapshot::begin() const {
+    return block ? block->data() : nullptr;
+}
+
+SortedRun::const_iterator SortedRun::Snapshot::end() const {
+    return block ? block->data() + size : nullptr;
+}
+
+SortedRun::SortedRun()
+    : block_(std::make_shared<Block>(MIN_CAPACITY))
+    , size_ {0u}
+{
+}
+
+SortedRun::SortedRun(const_iterator begin, const_iterator end)
+    : block_(std::make_shared<Block>(begin, end))
+    , size_ {static_cast<size_t>(end - begin)}
+{
+    if (block_->size() < MIN_CAPACITY) {
+        block_->resize(MIN_CAPACITY);
+    }
+}
+
+SortedRun::Snapshot SortedRun::snapshot() const {
+    Snapshot snap;
+    // Length should be loaded first, block that was published
+    // before this length contains at least `size` elements.
+    snap.size = size_.load(std::memory_order_acquire);
+    snap.block = std::atomic_load(&block_);
+    return snap;
+}
+
+void SortedRun::push_back(TimeSeriesValue const& value) {
+    size_t size = size_.load(std::memory_order_relaxed);
+    if (size == block_->size()) {
+        // Block is full, readers can still use old block
+        auto block = std::make_shared<Block>(block_->size()*2);
+        std::copy(block_->begin(), block_->end(), block->begin());
+        std::atomic_store(&block_, block);
+    }
+    (*block_)[size] = value;
+    size_.store(size + 1, std::memory_order_release);
+}
+
+TimeSeriesValue const& SortedRun::back() const {
+    return (*block_)[size_.load(std::memory_order_relaxed) - 1];
+}
+
+size_t SortedRun::size() const {
+    return size_.load(std::memory_order_relaxed);
+}
+
+bool SortedRun::empty() const {
+    return size() == 0u;
+}
+
+SortedRun::const_iterator SortedRun::begin() const {
+    return block_->data();
+}
+
+SortedRun::const_iterator SortedRun::end() const {
+    return block_->data() + size();
+}
+
 // Sequencer
 
 Sequencer::Sequencer(PageHeader const* page, aku_Config config)
-    : window_size_(config.window_size)
+    : ready_page_limit_(0u)
+    , window_size_(config.window_size)
     , page_(page)
     , top_timestamp_()
     , checkpoint_(0u)
     , sequence_number_ {0}
-    , run_locks_(RUN_LOCK_FLAGS_SIZE)
     , space_estimate_(0u)
+    , ready_estimate_ {0u}
     , c_threshold_(config.compression_threshold)
 {
-    key_.reset(new SortedRun());
-    key_->push_back(TimeSeriesValue());
 }
 
 //! Checkpoint id = ⌊timestamp/window_size⌋
@@ -146,56 +197,66 @@ aku_Timestamp Sequencer::get_timestamp_(aku_Timestamp cp) const {
     return cp*window_size_;
 }
 
-// move sorted runs to ready_ collection
-int Sequencer::make_checkpoint_(aku_Timestamp new_checkpoint) {
-    int flag = sequence_number_.fetch_add(1) + 1;
-    if (flag % 2 != 0) {
-        auto old_top = get_timestamp_(checkpoint_);
-        checkpoint_ = new_checkpoint;
-        vector<PSortedRun> new_runs;
-        for (auto& sorted_run: runs_) {
-            auto it = lower_bound(sorted_run->begin(), sorted_run->end(), TimeSeriesValue(old_top, AKU_LIMITS_MAX_ID, 0u, 0u));
-            // Check that compression threshold is reached
-            if (it == sorted_run->begin()) {
-                // all timestamps are newer than old_top, do nothing
-                new_runs.push_back(move(sorted_run));
-                continue;
-            } else if (it == sorted_run->end()) {
-                // all timestamps are older than old_top, move them
-                ready_.push_back(move(sorted_run));
-            } else {
-                // it is in between of the sorted run - split
-                PSortedRun run(new SortedRun());
-                copy(sorted_run->begin(), it, back_inserter(*run));  // copy old
-                ready_.push_back(move(run));
-                run.reset(new SortedRun());
-                copy(it, sorted_run->end(), back_inserter(*run));  // copy new
-                new_runs.push_back(move(run));
-            }
-        }
-        Lock guard(runs_resize_lock_);
-        space_estimate_ = 0u;
-        for (auto& sorted_run: new_runs) {
-            space_estimate_ += sorted_run->size() * SPACE_PER_ELEMENT;
-        }
-        swap(runs_, new_runs);
+/** Move sorted runs to ready_ collection.
+  * Sequence number is odd while ready_ is not merged. Only one checkpoint can be in
+  * progress at a time, if previous checkpoint wasn't merged yet (e.g. merge_and_compress
+  * is still running in background) AKU_EBUSY is returned and sequence number isn't changed.
+  */
+std::tuple<int, int> Sequencer::make_checkpoint_(aku_Timestamp new_checkpoint) {
+    int flag = sequence_number_.load();
+    if (flag % 2 != 0 || !sequence_number_.compare_exchange_strong(flag, flag + 1)) {
+        // Previous checkpoint not completed
+        return make_tuple(AKU_EBUSY, 0);
+    }
+    flag++;
+    auto old_top = get_timestamp_(checkpoint_);
+    checkpoint_ = new_checkpoint;
+    auto key = TimeSeriesValue(old_top, AKU_LIMITS_MAX_ID, 0u, 0u);
+
+    size_t ready_size = 0u;
+    for (auto const& sorted_run: runs_) {
+        auto it = lower_bound(sorted_run->begin(), sorted_run->end(), key);
+        ready_size += static_cast<size_t>(it - sorted_run->begin());
+    }
+    if (ready_size == 0u || ready_size < c_threshold_) {
+        // If ready doesn't contains enough data compression wouldn't be efficient,
+        // we need to wait for more data to come. Sorted runs stays searchable.
+        flag = sequence_number_.fetch_add(1) + 1;  // no checkpoint, flag is even
+        return make_tuple(AKU_SUCCESS, flag);
+    }
 
-        size_t ready_size = 0u;
-        for (auto& sorted_run: ready_) {
-            ready_size += sorted_run->size();
-        }
-        if (ready_size < c_threshold_) {
-            // If ready doesn't contains enough data compression wouldn't be efficient,
-            //  we need to wait for more data to come
-            flag = sequence_number_.fetch_add(1) + 1;
-            // We should make sorted runs in ready_ array searchable again
-            for (auto& sorted_run: ready_) {
-                runs_.push_back(sorted_run);
-            }
-            ready_.clear();
+    vector<PSortedRun> new_runs;
+    vector<PSortedRun> new_ready;
+    // Runs can be accessed by readers concurrently, runs_ array shouldn't be modified
+    // here, it will be replaced with new_runs array under the lock.
+    for (auto const& sorted_run: runs_) {
+        auto it = lower_bound(sorted_run->begin(), sorted_run->end(), key);
+        if (it == sorted_run->begin()) {
+            // all timestamps are newer than old_top, do nothing
+            new_runs.push_back(sorted_run);
+        } else if (it == sorted_run->end()) {
+            // all timestamps are older than old_top, move them
+            new_ready.push_back(sorted_run);
+        } else {
+            // it is in between of the sorted run - split
+            new_ready.push_back(std::make_shared<SortedRun>(sorted_run->begin(), it));  // copy old
+            new_runs.push_back(std::make_shared<SortedRun>(it, sorted_run->end()));     // copy new
         }
     }
-    return flag;
+
+    Lock guard(runs_resize_lock_);
+    space_estimate_ = 0u;
+    for (auto& sorted_run: new_runs) {
+        space_estimate_ += sorted_run->size() * SPACE_PER_ELEMENT;
+    }
+    // Data should be moved from runs_ to ready_ atomically, otherwise
+    // reader can see it twice or miss it.
+    swap(runs_, new_runs);
+    swap(ready_, new_ready);
+    ready_page_limit_ = page_ ? page_->get_entries_count() : 0u;
+    // Space for this data should be reserved until merge_and_compress completes
+    ready_estimate_.store(static_cast<uint32_t>(ready_size * SPACE_PER_ELEMENT));
+    return make_tuple(AKU_SUCCESS, flag);
 }
 
 /** Check timestamp and make checkpoint if timestamp is large enough.
@@ -214,10 +275,11 @@ std::tuple<int, int> Sequencer::check_timestamp_(aku_Timestamp ts) {
     int flag = 0;
     if (point > checkpoint_) {
         // Create new checkpoint
-        flag = make_checkpoint_(point);
-        if (flag % 2 == 0) {
-            // Previous checkpoint not completed
-            error_code = AKU_EBUSY;
+        tie(error_code, flag) = make_checkpoint_(point);
+        if (error_code != AKU_SUCCESS) {
+            // Previous checkpoint not completed, value should be
+            // rejected and top_timestamp_ shouldn't be changed.
+            return make_tuple(error_code, flag);
         }
     }
     top_timestamp_ = ts;
@@ -233,15 +295,14 @@ std::tuple<int, int> Sequencer::add(TimeSeriesValue const& value) {
         return make_tuple(status, lock);
     }
 
-    key_->pop_back();
-    key_->push_back(value);
-
     Lock guard(runs_resize_lock_);
     space_estimate_ += SPACE_PER_ELEMENT;
-    auto begin = runs_.begin();
-    auto end = runs_.end();
-    auto insert_it = lower_bound(begin, end, key_, top_element_more<PSortedRun>);
-    int run_ix = distance(begin, insert_it);
+    // Find first run with top element less than value (runs_ is sorted by top element
+    // in descending order)
+    auto insert_it = lower_bound(runs_.begin(), runs_.end(), value,
+                                 [](PSortedRun const& run, TimeSeriesValue const& val) {
+                                     return val < run->back();
+                                 });
     bool new_run_needed = insert_it == runs_.end();
     SortedRun* run = nullptr;
     if (!new_run_needed) {
@@ -250,159 +311,115 @@ std::tuple<int, int> Sequencer::add(TimeSeriesValue const& value) {
     guard.unlock();
 
     if (!new_run_needed) {
-        auto ix = run_ix & RUN_LOCK_FLAGS_MASK;
-        auto& rwlock = run_locks_.at(ix);
-        rwlock.wrlock();
+        // Only one writer is allowed, readers can access run concurrently
         run->push_back(value);
-        rwlock.unlock();
     } else {
-        guard.lock();
         PSortedRun new_pile(new SortedRun());
         new_pile->push_back(value);
+        guard.lock();
         runs_.push_back(move(new_pile));
         guard.unlock();
     }
     return make_tuple(AKU_SUCCESS, lock);
 }
 
-template<class Cont>
-void wrlock_all(Cont& cont) {
-    for (auto& rwlock: cont) {
-        rwlock.wrlock();
-    }
-}
-
-template<class Cont>
-void unlock_all(Cont& cont) {
-    for (auto& rwlock: cont) {
-        rwlock.unlock();
-    }
-}
-
 aku_Status Sequencer::close(PageHeader* target) {
-    wrlock_all(run_locks_);
-    for (auto& sorted_run: runs_) {
-        ready_.push_back(move(sorted_run));
-    }
-    unlock_all(run_locks_);
-
-    runs_resize_lock_.lock();
-    runs_.clear();
-    runs_resize_lock_.unlock();
-
-    sequence_number_.store(1);
+    reset();
     return merge_and_compress(target);
 }
 
 int Sequencer::reset() {
-    wrlock_all(run_locks_);
-    for (auto& sorted_run: runs_) {
-        ready_.push_back(move(sorted_run));
+    Lock guard(runs_resize_lock_);
+    if (ready_.empty()) {
+        ready_page_limit_ = page_ ? page_->get_entries_count() : 0u;
+    }
+    for (auto const& sorted_run: runs_) {
+        ready_.push_back(sorted_run);
     }
-    unlock_all(run_locks_);
-
-    runs_resize_lock_.lock();
     runs_.clear();
-    runs_resize_lock_.unlock();
+    guard.unlock();
     sequence_number_.store(1);
     return 1;
 }
 
-template<class TKey, int dir>
-struct TimeOrderMergePredicate;
+//! Size of the output buffer used by kway_merge
+static const size_t MERGE_BUFFER_SIZE = 0x200;
 
-template<class TKey>
-struct TimeOrderMergePredicate<TKey, AKU_CURSOR_DIR_FORWARD> {
-    greater<TKey> greater_;
-    bool operator () (TKey const& lhs, TKey const& rhs) const {
-        return greater_(lhs, rhs);
-    }
-};
+template<int dir>
+struct RunCursor;
 
-template<class TKey>
-struct TimeOrderMergePredicate<TKey, AKU_CURSOR_DIR_BACKWARD> {
-    less<TKey> less_;
-    bool operator () (TKey const& lhs, TKey const& rhs) const {
-        return less_(lhs, rhs);
-    }
+template<>
+struct RunCursor<AKU_CURSOR_DIR_FORWARD> {
+    const TimeSeriesValue* pos;
+    const TimeSeriesValue* end;
+    RunCursor(Sequencer::Range const& range) : pos(range.first), end(range.second) {}
+    TimeSeriesValue const& front() const { return *pos; }
+    void advance() { pos++; }
+    bool empty() const { return pos == end; }
 };
 
-template<class TKey, int Dir>
-struct ChunkOrderMergePredicate;
-
-template<class TKey>
-struct ChunkOrderMergePredicate<std::tuple<TKey, int>, AKU_CURSOR_DIR_FORWARD> {
-    // Only forward chunk-order merge is allowed
-    bool operator () (std::tuple<TKey, int> const& lhs, std::tuple<TKey, int> const& rhs) const {
-        return chunk_order_LT(std::get<0>(lhs), std::get<0>(rhs));
-    }
+template<>
+struct RunCursor<AKU_CURSOR_DIR_BACKWARD> {
+    const TimeSeriesValue* pos;
+    const TimeSeriesValue* end;
+    RunCursor(Sequencer::Range const& range) : pos(range.second), end(range.first) {}
+    TimeSeriesValue const& front() const { return *(pos - 1); }
+    void advance() { pos--; }
+    bool empty() const { return pos == end; }
 };
 
-template<class TRun, int dir>
-struct RunIter;
-
-template<class TRun>
-struct RunIter<std::shared_ptr<TRun>, AKU_CURSOR_DIR_FORWARD> {
-    typedef boost::iterator_range<typename TRun::const_iterator> range_type;
-    typedef typename TRun::value_type value_type;
-    static range_type make_range(std::shared_ptr<TRun> const& run) {
-        return boost::make_iterator_range(run->begin(), run->end());
+//! Make ranges from the list of runs, runs shouldn't be modified concurrently
+static vector<Sequencer::Range> make_ranges(vector<Sequencer::PSortedRun> const& runs) {
+    vector<Sequencer::Range> ranges;
+    ranges.reserve(runs.size());
+    for (auto const& run: runs) {
+        ranges.push_back(std::make_pair(run->begin(), run->end()));
     }
-};
+    return ranges;
+}
 
-template<class TRun>
-struct RunIter<std::shared_ptr<TRun>, AKU_CURSOR_DIR_BACKWARD> {
-    typedef boost::iterator_range<typename TRun::const_reverse_iterator> range_type;
-    typedef typename TRun::value_type value_type;
-    static range_type make_range(std::shared_ptr<TRun> const& run) {
-        return boost::make_iterator_range(run->rbegin(), run->rend());
+/** Merge sequences and push it to consumer.
+  * Merge is performed using loser tree with packed (timestamp, id) keys. Merged values
+  * are written to the output buffer in bulk and passed to consumer afterwards, consumer
+  * can interrupt the merge by returning false.
+  */
+template <int dir, class Consumer>
+void kway_merge(vector<Sequencer::Range> const& ranges, Consumer& cons) {
+    typedef RunCursor<dir> Cursor;
+    std::vector<Cursor> cursors;
+    cursors.reserve(ranges.size());
+    for (auto const& range: ranges) {
+        cursors.emplace_back(range);
     }
-};
 
-/** Merge sequences and push it to consumer */
-template <
-        //! Merge predicate for time-series values
-        template<class PredKey, int PredDirection> class Predicate,
-        int dir,
-        class Consumer
->
-void kway_merge(vector<Sequencer::PSortedRun> const& runs, Consumer& cons) {
-    typedef RunIter<Sequencer::PSortedRun, dir> RIter;
-    typedef typename RIter::range_type range_t;
-    typedef typename RIter::value_type KeyType;
-    std::vector<range_t> ranges;
-    for(auto i = runs.begin(); i != runs.end(); i++) {
-        ranges.push_back(RIter::make_range(*i));
-    }
-
-    typedef tuple<KeyType, int> HeapItem;
-    typedef Predicate<HeapItem, dir> Comp;
-    typedef boost::heap::skew_heap<HeapItem, boost::heap::compare<Comp>> Heap;
-    Heap heap;
-
-    int index = 0;
-    for(auto& range: ranges) {
-        if (!range.empty()) {
-            KeyType value = range.front();
-            range.advance_begin(1);
-            heap.push(make_tuple(value, index));
+    LoserTree tree(static_cast<uint32_t>(cursors.size()));
+    for (uint32_t i = 0; i < cursors.size(); i++) {
+        if (!cursors[i].empty()) {
+            auto const& value = cursors[i].front();
+            tree.set(i, make_merge_key<dir>(value.key_ts_, value.key_id_));
         }
-        index++;
     }
-
-    while(!heap.empty()) {
-        HeapItem item = heap.top();
-        KeyType point = get<0>(item);
-        int index = get<1>(item);
-        if (!cons(point)) {
-            // Interrupted
-            return;
+    tree.build();
+
+    TimeSeriesValue buffer[MERGE_BUFFER_SIZE];
+    while (!tree.empty()) {
+        size_t nvalues = 0;
+        while (nvalues < MERGE_BUFFER_SIZE && !tree.empty()) {
+            Cursor& cursor = cursors[tree.top()];
+            buffer[nvalues++] = cursor.front();
+            cursor.advance();
+            if (!cursor.empty()) {
+                auto const& value = cursor.front();
+                tree.replace_top(make_merge_key<dir>(value.key_ts_, value.key_id_));
+            } else {
+                tree.pop_top();
+            }
         }
-        heap.pop();
-        if (!ranges[index].empty()) {
-            KeyType point = ranges[index].front();
-            ranges[index].advance_begin(1);
-            heap.push(make_tuple(point, index));
+        for (size_t i = 0; i < nvalues; i++) {
+            if (!cons(buffer[i])) {
+                // Interrupted
+                return;
+            }
         }
     }
 }
@@ -427,15 +444,17 @@ void Sequencer::merge(Caller& caller, InternalCursor* cur) {
         return cur->put(caller, result);
     };
 
-    kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(ready_, consumer);
+    kway_merge<AKU_CURSOR_DIR_FORWARD>(make_ranges(ready_), consumer);
 
+    Lock guard(runs_resize_lock_);
     ready_.clear();
+    guard.unlock();
     cur->complete(caller);
 
     sequence_number_.fetch_add(1);  // progress_flag_ is even again
 }
 
-aku_Status Sequencer::merge_and_compress(PageHeader* target) {
+aku_Status Sequencer::merge_and_compress(PageHeader* target, Mutex* page_lock) {
     bool owns_lock = sequence_number_.load() % 2;  // progress_flag_ must be odd to start
     if (!owns_lock) {
         return AKU_EBUSY;
@@ -445,24 +464,43 @@ aku_Status Sequencer::merge_and_compress(PageHeader* target) {
     }
 
     UncompressedChunk chunk_header;
+    size_t nelements = 0u;
+    for (auto const& run: ready_) {
+        nelements += run->size();
+    }
+    chunk_header.timestamps.reserve(nelements);
+    chunk_header.paramids.reserve(nelements);
+    chunk_header.values.reserve(nelements);
 
     auto consumer = [&](TimeSeriesValue const& val) {
         val.add_to_header(&chunk_header);
         return true;
     };
 
-    kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(ready_, consumer);
-    ready_.clear();
+    kway_merge<AKU_CURSOR_DIR_FORWARD>(make_ranges(ready_), consumer);
 
     UncompressedChunk reindexed_header;
     if (!CompressionUtil::convert_from_time_order(chunk_header, &reindexed_header)) {
         AKU_PANIC("Invalid chunk");
     }
 
-    auto status = target->complete_chunk(reindexed_header);
+    aku_Status status = AKU_SUCCESS;
+    if (page_lock != nullptr) {
+        Lock guard(*page_lock);
+        status = target->complete_chunk(reindexed_header);
+    } else {
+        status = target->complete_chunk(reindexed_header);
+    }
     if (status != AKU_SUCCESS) {
         return status;
     }
+    // Compressed chunk is visible to readers now, ready_ can be removed from snapshots.
+    // Readers that still hold old snapshot will not read the new chunk because
+    // of the page limit.
+    Lock guard(runs_resize_lock_);
+    ready_.clear();
+    guard.unlock();
+    ready_estimate_.store(0u);
     sequence_number_.fetch_add(1);  // progress_flag_ is even again
     return AKU_SUCCESS;
 }
@@ -474,60 +512,62 @@ std::tuple<aku_Timestamp, int> Sequencer::get_window() const {
 }
 
 uint32_t Sequencer::get_space_estimate() const {
-    // ready_ must be empty here
-    return space_estimate_ + SPACE_PER_ELEMENT;
+    // ready_ can be non-empty here if merge_and_compress is running in background
+    return space_estimate_ + ready_estimate_.load() + SPACE_PER_ELEMENT;
 }
 
-void Sequencer::filterV2(PSortedRun run, std::shared_ptr<QP::IQueryProcessor> q, std::vector<PSortedRun>* results) const {
-    if (run->empty()) {
+void Sequencer::filterV2(SortedRun::Snapshot const& run, std::shared_ptr<QP::IQueryProcessor> q, std::vector<Range>* results) const {
+    if (run.size == 0u) {
         return;
     }
-    PSortedRun result(new SortedRun);
     auto lkey = TimeSeriesValue(q->lowerbound(), 0u, 0u, 0u);
     auto rkey = TimeSeriesValue(q->upperbound(), ~0u, 0u, 0u);
-    auto begin = std::lower_bound(run->begin(), run->end(), lkey);
-    auto end = std::upper_bound(run->begin(), run->end(), rkey);
-    std::copy(begin, end, std::back_inserter(*result));
-    results->push_back(move(result));
+    auto begin = std::lower_bound(run.begin(), run.end(), lkey);
+    auto end = std::upper_bound(run.begin(), run.end(), rkey);
+    if (begin < end) {
+        results->push_back(std::make_pair(begin, end));
+    }
 }
 
-void Sequencer::searchV2(std::shared_ptr<QP::IQueryProcessor> query, int sequence_number) const {
-    int seq_id = sequence_number_.load();
-    if (seq_id % 2 != 0 || sequence_number != seq_id) {
-        query->set_error(AKU_EBUSY);
-        return;
-    }
-    std::vector<PSortedRun> filtered;
-    std::vector<PSortedRun> pruns;
+Sequencer::Snapshot Sequencer::get_snapshot() const {
+    Snapshot snapshot;
     Lock runs_guard(runs_resize_lock_);
-    pruns = runs_;
-    runs_guard.unlock();
-    int run_ix = 0;
-    for (auto const& run: pruns) {
-        auto ix = run_ix & RUN_LOCK_FLAGS_MASK;
-        auto& rwlock = run_locks_.at(ix);
-        rwlock.rdlock();
+    snapshot.runs.reserve(runs_.size() + ready_.size());
+    for (auto const& run: ready_) {
+        snapshot.runs.push_back(run->snapshot());
+    }
+    for (auto const& run: runs_) {
+        snapshot.runs.push_back(run->snapshot());
+    }
+    // If ready_ is not empty, compressed chunk for it can be added to the page at any moment
+    // (or already added), it shouldn't be visible through this snapshot.
+    snapshot.page_limit = ready_.empty() ? (page_ ? page_->get_entries_count() : 0u)
+                                         : ready_page_limit_;
+    return snapshot;
+}
+
+bool Sequencer::searchV2(std::shared_ptr<QP::IQueryProcessor> query, Snapshot const& snapshot) const {
+    // Snapshot is immutable and can't be affected by the writer or by the checkpoint.
+    std::vector<Range> filtered;
+    for (auto const& run: snapshot.runs) {
         filterV2(run, query, &filtered);
-        rwlock.unlock();
-        run_ix++;
     }
 
     auto page = page_;
-    auto consumer = [query, page](TimeSeriesValue const& val) {
+    QP::BatchBuilder batch(*query);
+    bool proceed = true;
+    auto consumer = [&batch, &proceed, page](TimeSeriesValue const& val) {
         aku_Sample result = val.to_result(page);
-        return query->put(result);
+        proceed = batch.put(result);
+        return proceed;
     };
 
     if (query->direction() == AKU_CURSOR_DIR_FORWARD) {
-        kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(filtered, consumer);
+        kway_merge<AKU_CURSOR_DIR_FORWARD>(filtered, consumer);
     } else {
-        kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_BACKWARD>(filtered, consumer);
-    }
-
-    if (seq_id != sequence_number_.load()) {
-        query->set_error(AKU_EBUSY);
-        return;
+        kway_merge<AKU_CURSOR_DIR_BACKWARD>(filtered, consumer);
     }
+    return proceed && batch.flush();
 }
 
 }  // namespace Akumuli
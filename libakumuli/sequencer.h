@@ -30,6 +30,7 @@
 #include <algorithm>
 #include <memory>
 #include <mutex>
+#include <atomic>
 
 namespace Akumuli {
 
@@ -79,6 +80,66 @@ struct TimeSeriesValue {
 } __attribute__((packed));
 
 
+/** Append-only sorted run.
+  * @brief Run can be modified by one writer and read by many readers at the same
+  * time without locking. Values are stored in storage blocks that never move, value
+  * is written to the current block first and after that new length of the run is
+  * published. When current block is full, its content is copied to the new (larger)
+  * block and the new block is published. Readers that hold a snapshot can use the old
+  * block until the snapshot is destroyed.
+  */
+class SortedRun {
+public:
+    typedef TimeSeriesValue                 value_type;
+    typedef const TimeSeriesValue*          const_iterator;
+    typedef std::vector<TimeSeriesValue, HugePageAllocator<TimeSeriesValue>> Block;  //< Uses huge pages if enabled
+    typedef std::shared_ptr<const Block>    PBlock;
+
+    //! Immutable view of the run
+    struct Snapshot {
+        PBlock block;
+        size_t size;
+
+        const_iterator begin() const;
+        const_iterator end() const;
+    };
+
+private:
+    static const size_t MIN_CAPACITY = 8;
+    std::shared_ptr<Block>  block_;     //< Current block, published using atomic_store
+    std::atomic<size_t>     size_;      //< Published length of the run
+
+public:
+    SortedRun();
+
+    //! Create run from range of sorted values
+    SortedRun(const_iterator begin, const_iterator end);
+
+    SortedRun(SortedRun const&) = delete;
+    SortedRun& operator = (SortedRun const&) = delete;
+
+    /** Get consistent snapshot of the run.
+      * Can be called concurrently with `push_back`.
+      */
+    Snapshot snapshot() const;
+
+    // Writer interface, this methods shouldn't be called by readers
+
+    //! Append value to the run and publish it
+    void push_back(TimeSeriesValue const& value);
+
+    TimeSeriesValue const& back() const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+};
+
+
 /** Time-series sequencer.
   * @brief Akumuli can accept unordered time-series (this is the case when
   * clocks of the different time-series sources are slightly out of sync).
@@ -86,19 +147,27 @@ struct TimeSeriesValue {
   * all the remaining samples by timestamp and parameter id.
   */
 struct Sequencer {
-    typedef std::vector<TimeSeriesValue> SortedRun;
+    typedef Akumuli::SortedRun           SortedRun;
     typedef std::shared_ptr<SortedRun>   PSortedRun;
     typedef std::mutex                   Mutex;
     typedef std::unique_lock<Mutex>      Lock;
-
-    static const int RUN_LOCK_MAX_BACKOFF = 0x100;
-    static const int RUN_LOCK_BUSY_COUNT = 0xFFF;
-    static const int RUN_LOCK_FLAGS_MASK = 0x0FF;
-    static const int RUN_LOCK_FLAGS_SIZE = 0x100;
+    //! Range of sorted values (begin, end)
+    typedef std::pair<SortedRun::const_iterator, SortedRun::const_iterator> Range;
+
+    /** Consistent view of the sequencer and the page.
+      * Contains active runs and runs that wait for compression (ready set). Ready set
+      * stays in the snapshot until compressed chunk becomes visible in the page, page
+      * entries with index larger or equal to `page_limit` shouldn't be read by the
+      * query that uses this snapshot.
+      */
+    struct Snapshot {
+        std::vector<SortedRun::Snapshot> runs;
+        uint32_t                         page_limit;
+    };
 
     std::vector<PSortedRun>      runs_;             //< Active sorted runs
     std::vector<PSortedRun>      ready_;            //< Ready to merge
-    PSortedRun                   key_;
+    uint32_t                     ready_page_limit_; //< Number of page entries before ready_ was formed
     const aku_Duration           window_size_;
     const PageHeader* const      page_;
     aku_Timestamp                top_timestamp_;    //< Largest timestamp ever seen
@@ -107,9 +176,9 @@ struct Sequencer {
                                                     //< search will return inaccurate results.
                                                     //< If progress_flag_ is odd - merge is in progress if it is
                                                     //< even - there is no merge and search will work correctly.
-    mutable Mutex                runs_resize_lock_;
-    mutable std::vector<RWLock>  run_locks_;
+    mutable Mutex                runs_resize_lock_; //< Guards runs_ and ready_ vectors (not the content of the runs)
     uint32_t                     space_estimate_;   //< Space estimate for storing all data
+    std::atomic<uint32_t>        ready_estimate_;   //< Space estimate for data in ready_ (not yet compressed)
     const size_t                 c_threshold_;      //< Compression threshold
 
     Sequencer(PageHeader const* page, aku_Config config);
@@ -125,9 +194,13 @@ struct Sequencer {
 
     /** Merge all values (ts, id, offset, length)
       * and write it to target page.
-      * caller and cur parameters used for communication with storage (error reporting).
+      * @param target is a page that will receive compressed chunk
+      * @param page_lock should guard target page from concurrent writers (can be null)
+      * @note this method can be called from background thread while writer continues
+      * to add new values to the sequencer. Only the final write to the page is performed
+      * under `page_lock`.
       */
-    aku_Status merge_and_compress(PageHeader* target);
+    aku_Status merge_and_compress(PageHeader* target, Mutex* page_lock = nullptr);
 
     //! Close cache for writing, merge everything to page header.
     aku_Status close(PageHeader* target);
@@ -138,23 +211,27 @@ struct Sequencer {
       */
     int reset();
 
+    /** Get snapshot of the sequencer data.
+      * Snapshot is immutable, writes and checkpoints that happens after this call
+      * doesn't affect it.
+      */
+    Snapshot get_snapshot() const;
+
     /** Search in sequencer data.
       * @param query represents search query
-      * @param sequence_number sequence number obtained with get_window function
-      * @note search method follows common pattern used by all methods except sequence_number
-      * parameter. This parameter is used to organize optimistic concurrency control. User must
-      * call get_window fn and get current window and seq-number. This seq-number then passed to
-      * search method. If seq-number is changed between calls to get_window and search - search
-      * will be aborted and AKU_EBUSY.error code will be returned If merge occures during search -
-      * search will be aborted and AKU_EBUSY error code will be returned.
+      * @param snapshot snapshot obtained with get_snapshot function
+      * @note page should be searched using the same snapshot (`snapshot.page_limit` entries),
+      * in this case results will be consistent even if merge occures during search.
+      * @return false if query processor interrupted the search
       */
-    void searchV2(std::shared_ptr<QP::IQueryProcessor> query, int sequence_number) const;
+    bool searchV2(std::shared_ptr<QP::IQueryProcessor> query, Snapshot const& snapshot) const;
 
     std::tuple<aku_Timestamp, int> get_window() const;
 
     /** Returns number of bytes needed to store all data from the checkpoint
      *  in compressed mode. This number can be more than actually needed but
      *  can't be less (only overshoot is ok, undershoot is error).
+     *  Data that waits for compression in background is included.
      */
     uint32_t get_space_estimate() const;
 
@@ -165,14 +242,17 @@ private:
     //! Convert checkpoint id to timestamp
     aku_Timestamp get_timestamp_(aku_Timestamp cp) const;
 
-    // move sorted runs to ready_ collection
-    int make_checkpoint_(aku_Timestamp new_checkpoint);
+    /** Move sorted runs to ready_ collection.
+      * @returns error code (AKU_EBUSY if previous checkpoint is not merged yet) and new sequence number
+      */
+    std::tuple<int, int> make_checkpoint_(aku_Timestamp new_checkpoint);
 
     /** Check timestamp and make checkpoint if timestamp is large enough.
       * @returns error code and flag that indicates whether or not new checkpoint is created
       */
     std::tuple<int, int> check_timestamp_(aku_Timestamp ts);
 
-    void filterV2(PSortedRun run, std::shared_ptr<QP::IQueryProcessor> query, std::vector<PSortedRun>* results) const;
+    //! Select values that match the query from the snapshot, no data is copied
+    void filterV2(SortedRun::Snapshot const& run, std::shared_ptr<QP::IQueryProcessor> query, std::vector<Range>* results) const;
 };
 }
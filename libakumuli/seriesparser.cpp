@@ -22,6 +22,8 @@
 #include <string>
 #include <map>
 #include <algorithm>
+#include <limits>
+#include <tuple>
 #include <regex>
 
 #include <boost/property_tree/ptree.hpp>
@@ -29,11 +31,44 @@
 
 namespace Akumuli {
 
+static const SeriesMatcher::StringT EMPTY = std::make_pair(nullptr, 0);
+
 //                          //
-//      Series Matcher      //
+//    Query Series Names    //
 //                          //
 
-static const SeriesMatcher::StringT EMPTY = std::make_pair(nullptr, 0);
+QuerySeriesNames::QuerySeriesNames()
+    : table(StringTools::create_table(0x100))
+    , series_id(AKU_QUERY_SERIES_ID)
+{
+}
+
+uint64_t QuerySeriesNames::add(const char* begin, const char* end) {
+    std::lock_guard<std::mutex> guard(mutex);
+    StringT str = std::make_pair(begin, static_cast<int>(end - begin));
+    auto it = table.find(str);
+    if (it != table.end()) {
+        return it->second;
+    }
+    auto id = series_id++;
+    StringT pstr = pool.add(begin, end, id);
+    table[pstr] = id;
+    inv_table[id] = pstr;
+    return id;
+}
+
+QuerySeriesNames::StringT QuerySeriesNames::id2str(uint64_t tokenid) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = inv_table.find(tokenid);
+    if (it == inv_table.end()) {
+        return EMPTY;
+    }
+    return it->second;
+}
+
+//                          //
+//      Series Matcher      //
+//                          //
 
 SeriesMatcher::SeriesMatcher(uint64_t starting_id)
     : table(StringTools::create_table(0x1000))
@@ -78,6 +113,9 @@ uint64_t SeriesMatcher::match(const char* begin, const char* end) {
 }
 
 SeriesMatcher::StringT SeriesMatcher::id2str(uint64_t tokenid) {
+    if (tokenid >= AKU_QUERY_SERIES_ID) {
+        return query_names.id2str(tokenid);
+    }
     auto it = inv_table.find(tokenid);
     if (it == inv_table.end()) {
         return EMPTY;
@@ -109,6 +147,10 @@ static boost::optional<const boost::property_tree::ptree&> parse_sampling_params
     return ptree.get_child_optional("sample");
 }
 
+static boost::optional<const boost::property_tree::ptree&> parse_aggregate_params(boost::property_tree::ptree const& ptree) {
+    return ptree.get_child_optional("aggregate");
+}
+
 static std::vector<std::string> parse_metric(boost::property_tree::ptree const& ptree,
                                              aku_logger_cb_t logger) {
     std::vector<std::string> metrics;
@@ -208,6 +250,171 @@ static std::vector<aku_ParamId> parse_where_clause(boost::property_tree::ptree c
     return ids;
 }
 
+static std::vector<std::string> parse_group_by_tags(boost::property_tree::ptree const& ptree) {
+    std::vector<std::string> tags;
+    auto group_by = ptree.get_child_optional("group_by");
+    if (group_by) {
+        auto tag = group_by->get_child_optional("tag");
+        if (tag && tag->empty()) {
+            tags.push_back(tag->get_value<std::string>());
+        } else if (tag) {
+            for (auto child: *tag) {
+                tags.push_back(child.second.get_value<std::string>());
+            }
+        }
+    }
+    // Keys should be ordered alphabetically in normal form
+    std::sort(tags.begin(), tags.end());
+    return tags;
+}
+
+//! Output series of the query (normalized name -> id)
+typedef std::map<std::string, aku_ParamId> QueryOutputNames;
+
+/** Convert series name to normal form (name without tags is a valid query output name).
+  * @throws QueryParserError if name is not valid
+  */
+static std::string normalize_series_name(std::string const& name) {
+    std::stringstream stream(name);
+    std::string metric, tag;
+    if (stream >> metric && !(stream >> tag)) {
+        return metric;
+    }
+    char buffer[AKU_LIMITS_MAX_SNAME];
+    const char* keystr_begin = nullptr;
+    const char* keystr_end = nullptr;
+    const char* begin = name.data();
+    const char* end = begin + name.size();
+    auto status = SeriesParser::to_normal_form(begin, end,
+                                               buffer, buffer+AKU_LIMITS_MAX_SNAME,
+                                               &keystr_begin, &keystr_end);
+    if (status != AKU_SUCCESS) {
+        std::string msg = "invalid series name `" + name + "`";
+        QueryParserError error(msg.c_str());
+        BOOST_THROW_EXCEPTION(error);
+    }
+    return std::string(static_cast<const char*>(buffer), keystr_end);
+}
+
+/** Map series to groups.
+  * Group name consists of the metric name and values of the `tags` (in normal form), e.g.
+  * series "cpu host=A region=eu" belongs to group "cpu region=eu" if grouped by "region".
+  * Tags that series doesn't have are omitted. Groups are output series of the query, their
+  * ids are issued by `query_names` of the matcher (series table is not modified) and
+  * are added to `outputs`.
+  */
+static std::vector<aku_ParamId> map_series_to_groups(std::vector<aku_ParamId> const& ids,
+                                                     std::vector<std::string> const& tags,
+                                                     SeriesMatcher* matcher,
+                                                     QueryOutputNames* outputs)
+{
+    std::vector<aku_ParamId> groups;
+    std::string name;
+    for (auto id: ids) {
+        auto str = matcher->id2str(id);
+        std::string series(str.first, static_cast<size_t>(str.second));
+        // Series name is in normal form - metric followed by key=value pairs separated by space
+        std::vector<std::string> tokens;
+        std::stringstream stream(series);
+        std::string token;
+        while (stream >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) {
+            groups.push_back(0u);
+            continue;
+        }
+        name = tokens.front();
+        for (auto const& tag: tags) {
+            auto prefix = tag + "=";
+            for (size_t i = 1; i < tokens.size(); i++) {
+                if (tokens[i].compare(0, prefix.size(), prefix) == 0) {
+                    name += " " + tokens[i];
+                    break;
+                }
+            }
+        }
+        name = normalize_series_name(name);
+        auto it = outputs->find(name);
+        if (it == outputs->end()) {
+            auto group = matcher->query_names.add(name.data(), name.data() + name.size());
+            it = outputs->insert(std::make_pair(name, group)).first;
+        }
+        groups.push_back(it->second);
+    }
+    return groups;
+}
+
+/** Find series by name (name is converted to normal form first).
+  * Output series of the query (groups) are checked before stored series.
+  * @throws QueryParserError if name is not valid or series not found
+  */
+static aku_ParamId find_series(std::string const& name, QueryOutputNames const& outputs, SeriesMatcher* matcher) {
+    auto normal = normalize_series_name(name);
+    auto it = outputs.find(normal);
+    if (it != outputs.end()) {
+        return it->second;
+    }
+    auto id = matcher->match(normal.data(), normal.data() + normal.size());
+    if (id == 0u) {
+        std::string msg = "series `" + name + "` not found";
+        QueryParserError error(msg.c_str());
+        BOOST_THROW_EXCEPTION(error);
+    }
+    return id;
+}
+
+/** Parse value filter, e.g. { "gt": 100, "le": 200 } (all conditions should match).
+  */
+static std::shared_ptr<QP::ValueFilter> parse_value_filter(boost::property_tree::ptree const& ptree,
+                                                           aku_logger_cb_t logger)
+{
+    auto filter = ptree.get_child_optional("filter");
+    if (!filter) {
+        return std::shared_ptr<QP::ValueFilter>();
+    }
+    auto result = std::make_shared<QP::ValueFilter>();
+    for (auto const& child: *filter) {
+        double value = child.second.get_value<double>();
+        if (child.first == "gt" || child.first == "ge") {
+            if (value >= result->lowerbound) {
+                result->lower_inclusive = child.first == "ge" && (value > result->lowerbound || result->lower_inclusive);
+                result->lowerbound = value;
+            }
+        } else if (child.first == "lt" || child.first == "le") {
+            if (value <= result->upperbound) {
+                result->upper_inclusive = child.first == "le" && (value < result->upperbound || result->upper_inclusive);
+                result->upperbound = value;
+            }
+        } else {
+            (*logger)(AKU_LOG_ERROR, "Invalid `filter` statement");
+            auto rte = std::runtime_error("Invalid `filter` statement, `gt`, `ge`, `lt` or `le` expected");
+            BOOST_THROW_EXCEPTION(rte);
+        }
+    }
+    return result;
+}
+
+/** Parse limit and offset, e.g. "limit": 100, "offset": 1000.
+  * Returns (limit, offset) pair, limit is zero if query is not limited.
+  */
+static std::pair<uint64_t, uint64_t> parse_limit(boost::property_tree::ptree const& ptree,
+                                                 aku_logger_cb_t logger)
+{
+    auto limit = ptree.get_optional<uint64_t>("limit");
+    auto offset = ptree.get_optional<uint64_t>("offset");
+    if (limit && *limit == 0) {
+        (*logger)(AKU_LOG_ERROR, "Invalid `limit` statement");
+        auto rte = std::runtime_error("Invalid `limit` statement, positive integer expected");
+        BOOST_THROW_EXCEPTION(rte);
+    }
+    if (!limit && !offset) {
+        return std::pair<uint64_t, uint64_t>(0u, 0u);
+    }
+    return std::pair<uint64_t, uint64_t>(limit ? *limit : std::numeric_limits<uint64_t>::max(),
+                                         offset ? *offset : 0u);
+}
+
 static std::string to_json(boost::property_tree::ptree const& ptree, bool pretty_print = true) {
     std::stringstream ss;
     boost::property_tree::write_json(ss, ptree, pretty_print);
@@ -253,6 +460,30 @@ SeriesMatcher::build_query_processor(const char* query, std::shared_ptr<QP::Node
         // Read sampling method
         auto sampling_params = parse_sampling_params(ptree);
 
+        // Read aggregation parameters
+        auto aggregate_params = parse_aggregate_params(ptree);
+
+        // Read value filter
+        auto value_filter = parse_value_filter(ptree, logger);
+
+        // Read limit and offset
+        uint64_t limit, offset;
+        std::tie(limit, offset) = parse_limit(ptree, logger);
+
+        // Read resampling parameters
+        auto resample_params = ptree.get_child_optional("resample");
+
+        // Read arithmetic expressions
+        auto transform_params = ptree.get_child_optional("transform");
+        auto combine_params = ptree.get_child_optional("combine");
+
+        // Read top-k parameters
+        auto top_params = ptree.get_child_optional("top");
+        auto bottom_params = ptree.get_child_optional("bottom");
+
+        // Read group-by tags
+        auto group_by_tags = parse_group_by_tags(ptree);
+
         // Read where clause
         std::vector<aku_ParamId> ids_included;
         std::vector<aku_ParamId> ids_excluded;
@@ -272,13 +503,101 @@ SeriesMatcher::build_query_processor(const char* query, std::shared_ptr<QP::Node
             BOOST_THROW_EXCEPTION(rte);
         }
 
+        if (aggregate_params && (select || sampling_params)) {
+            (*logger)(AKU_LOG_ERROR, "Can't combine aggregate with select or sample statements");
+            auto rte = std::runtime_error("`aggregate` can't be used with `sample` or `select`");
+            BOOST_THROW_EXCEPTION(rte);
+        }
+
+        if ((top_params || bottom_params) &&
+            ((top_params && bottom_params) || select || sampling_params || aggregate_params))
+        {
+            (*logger)(AKU_LOG_ERROR, "Can't combine top or bottom with other statements");
+            auto rte = std::runtime_error("`top` and `bottom` can't be used with `aggregate`, `sample` or `select`");
+            BOOST_THROW_EXCEPTION(rte);
+        }
+
+        if (resample_params &&
+            (select || sampling_params || aggregate_params || top_params || bottom_params))
+        {
+            (*logger)(AKU_LOG_ERROR, "Can't combine resample with other statements");
+            auto rte = std::runtime_error("`resample` can't be used with `aggregate`, `top`, `bottom`, `sample` or `select`");
+            BOOST_THROW_EXCEPTION(rte);
+        }
+
+        if ((transform_params || combine_params) && (select || sampling_params)) {
+            (*logger)(AKU_LOG_ERROR, "Can't combine transform or combine with select or sample statements");
+            auto rte = std::runtime_error("`transform` and `combine` can't be used with `sample` or `select`");
+            BOOST_THROW_EXCEPTION(rte);
+        }
+
         // Build topology
         std::shared_ptr<Node> next = terminal;
+        if (limit && !select) {
+            // Applied to the output of the topology, interrupts the scan when reached
+            next = NodeBuilder::make_limit(limit, offset, next, logger);
+        }
         if (!select) {
             // Read timestamps
             auto ts_begin = parse_range_timestamp(ptree, "from", logger);
             auto ts_end = parse_range_timestamp(ptree, "to", logger);
 
+            // Series ids are used to preallocate per-series state of the processing nodes
+            std::vector<aku_ParamId> series_ids;
+            bool stateful = aggregate_params || top_params || bottom_params || resample_params || transform_params;
+            if (stateful) {
+                series_ids = ids_included;
+                if (series_ids.empty()) {
+                    for (auto val: table) {
+                        series_ids.push_back(val.second);
+                    }
+                }
+            }
+            // Group ids should be known before combine clause is parsed
+            std::vector<aku_ParamId> group_ids, groups, output_ids = series_ids;
+            QueryOutputNames outputs;
+            if (!group_by_tags.empty() && (aggregate_params || top_params || bottom_params)) {
+                group_ids = series_ids;
+                groups = map_series_to_groups(group_ids, group_by_tags, this, &outputs);
+                // Aggregation (or ranking) is performed for groups, 0 is not a group
+                output_ids.clear();
+                std::copy_if(groups.begin(), groups.end(), std::back_inserter(output_ids),
+                             [](aku_ParamId id) { return id != 0u; });
+            }
+            if (combine_params) {
+                // Binary operation is applied to the final series (or groups)
+                auto op = combine_params->get<std::string>("op");
+                auto lhs = find_series(combine_params->get<std::string>("lhs"), outputs, this);
+                auto rhs = find_series(combine_params->get<std::string>("rhs"), outputs, this);
+                auto name = combine_params->get_optional<std::string>("name");
+                aku_ParamId out = lhs;
+                if (name) {
+                    // Result is an output series of the query, it's not stored
+                    auto normal = normalize_series_name(*name);
+                    out = query_names.add(normal.data(), normal.data() + normal.size());
+                }
+                next = NodeBuilder::make_combine(op, lhs, rhs, out, next, logger);
+            }
+            if (resample_params) {
+                next = NodeBuilder::make_resampler(*resample_params, next, logger, series_ids);
+            }
+            if (aggregate_params) {
+                // Aggregation is performed after filtering
+                next = NodeBuilder::make_aggregate(*aggregate_params, next, logger, output_ids);
+            }
+            if (top_params || bottom_params) {
+                // Series are ranked after filtering
+                bool bottom = !top_params;
+                next = NodeBuilder::make_topk(bottom ? *bottom_params : *top_params, bottom, next, logger, output_ids);
+            }
+            if (!group_ids.empty()) {
+                // Groups are aggregated (or ranked) instead of individual series
+                next = NodeBuilder::make_group_by(group_ids, groups, next, logger);
+            }
+            if (transform_params) {
+                // Transformation is applied to individual series before grouping
+                next = NodeBuilder::make_transform(*transform_params, next, logger, series_ids);
+            }
             if (!ids_included.empty()) {
                 next = NodeBuilder::make_filter_by_id_list(ids_included, next, logger);
             }
@@ -290,8 +609,12 @@ SeriesMatcher::build_query_processor(const char* query, std::shared_ptr<QP::Node
                                                      next,
                                                      logger);
             }
+            if (value_filter) {
+                // Should be applied first, storage can apply the same filter during scan
+                next = NodeBuilder::make_filter_by_value(*value_filter, next, logger);
+            }
             // Build query processor
-            return std::make_shared<ScanQueryProcessor>(next, metrics, ts_begin, ts_end);
+            return std::make_shared<ScanQueryProcessor>(next, metrics, ts_begin, ts_end, value_filter);
         }
 
         if (ids_included.empty() && metrics.empty()) {
@@ -310,6 +633,11 @@ SeriesMatcher::build_query_processor(const char* query, std::shared_ptr<QP::Node
                                 std::back_inserter(tmp));
             std::swap(tmp, ids_included);
         }
+        if (limit) {
+            auto first = std::min<uint64_t>(offset, ids_included.size());
+            auto last = first + std::min<uint64_t>(limit, ids_included.size() - first);
+            ids_included = std::vector<aku_ParamId>(ids_included.begin() + first, ids_included.begin() + last);
+        }
         return std::make_shared<MetadataQueryProcessor>(ids_included, next);
 
     } catch(std::exception const& e) {
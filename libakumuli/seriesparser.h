@@ -36,8 +36,35 @@ struct QueryParserError : std::runtime_error {
 };
 
 
+/** Names of the series produced by queries (groups, combined series).
+  * Ids are issued starting from AKU_QUERY_SERIES_ID (SeriesMatcher never issues them),
+  * the same name always gets the same id. Names are not persisted and can't be matched
+  * by the `where` clause. Can be used by several query threads.
+  */
+struct QuerySeriesNames {
+    typedef StringTools::StringT StringT;
+    typedef StringTools::TableT  TableT;
+    typedef StringTools::InvT    InvT;
+
+    StringPool               pool;       //! String pool that stores names
+    TableT                   table;      //! Name to id mapping
+    InvT                     inv_table;  //! Id to name mapping
+    uint64_t                 series_id;  //! Series ID counter
+    std::mutex               mutex;
+
+    QuerySeriesNames();
+
+    //! Get id of the name, new name gets new id
+    uint64_t add(const char* begin, const char* end);
+
+    //! Convert id to string
+    StringT id2str(uint64_t tokenid);
+};
+
 /** Series matcher. Table that maps series names to series
   * ids. Should be initialized on startup from sqlite table.
+  * Series are added only by the writer thread, query output
+  * series are registered in `query_names` instead.
   */
 struct SeriesMatcher {
     // TODO: add LRU cache
@@ -56,6 +83,7 @@ struct SeriesMatcher {
     uint64_t                 series_id;  //! Series ID counter
     std::vector<SeriesNameT> names;      //! List of recently added names
     std::mutex               mutex;      //! Mutex for shared data
+    QuerySeriesNames         query_names;  //! Names of the query output series
 
     SeriesMatcher(uint64_t starting_id);
 
@@ -73,7 +101,7 @@ struct SeriesMatcher {
       */
     uint64_t match(const char* begin, const char* end);
 
-    //! Convert id to string
+    //! Convert id to string (query output series ids are supported)
     StringT id2str(uint64_t tokenid);
 
     /** Push all new elements to the buffer.
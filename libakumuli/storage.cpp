@@ -19,6 +19,7 @@
 #include "storage.h"
 #include "util.h"
 #include "cursor.h"
+#include "loser_tree.h"
 
 #include <cstdlib>
 #include <cstdarg>
@@ -27,6 +28,7 @@
 #include <new>
 #include <atomic>
 #include <sstream>
+#include <deque>
 #include <cassert>
 #include <functional>
 #include <sstream>
@@ -40,7 +42,7 @@
 
 namespace Akumuli {
 
-static apr_status_t create_page_file(const char* file_name, uint32_t page_index, uint32_t npages, aku_logger_cb_t logger);
+static apr_status_t create_page_file(const char* file_name, uint32_t page_index, uint32_t npages, uint64_t size, aku_logger_cb_t logger);
 
 //----------------------------------Volume----------------------------------------------
 
@@ -48,8 +50,9 @@ static apr_status_t create_page_file(const char* file_name, uint32_t page_index,
 Volume::Volume(const char* file_name,
                aku_Config const& conf,
                bool enable_huge_tlb,
-               aku_logger_cb_t logger)
-    : mmap_(file_name, enable_huge_tlb, logger)
+               aku_logger_cb_t logger,
+               bool direct_io)
+    : mmap_(file_name, enable_huge_tlb, logger, direct_io)
     , window_(conf.window_size)
     , max_cache_size_(conf.max_cache_size)
     , file_path_(file_name)
@@ -57,10 +60,17 @@ Volume::Volume(const char* file_name,
     , logger_(logger)
     , is_temporary_ {0}
     , huge_tlb_(enable_huge_tlb)
+    , direct_io_(direct_io)
+    , preallocated_payload_(0u)
+    , preallocation_enabled_(true)
 {
     mmap_.panic_if_bad();  // panic if can't mmap volume
     page_ = reinterpret_cast<PageHeader*>(mmap_.get_pointer());
     cache_.reset(new Sequencer(page_, conf));
+    flushed_offset_ = page_->get_next_offset();
+    flushed_count_ = page_->get_entries_count();
+    preallocated_index_ = mmap_.get_size();
+    index_.update(page_);
 }
 
 Volume::~Volume() {
@@ -73,7 +83,28 @@ PageHeader* Volume::get_page() const {
     return page_;
 }
 
-std::shared_ptr<Volume> Volume::safe_realloc() {
+std::shared_ptr<Volume> Volume::prepare_next() const {
+    std::string next_file_name = file_path_;
+                next_file_name += ".next";
+
+    // File can be left by the previous run
+    boost::system::error_code error;
+    boost::filesystem::remove(next_file_name, error);
+
+    auto status = create_page_file(next_file_name.c_str(), page_->get_page_id(), page_->get_numpages(),
+                                   mmap_.get_size(), logger_);
+    if (status != APR_SUCCESS) {
+        (*logger_)(AKU_LOG_ERROR, "Failed to prepare next volume");
+        return std::shared_ptr<Volume>();
+    }
+    std::shared_ptr<Volume> newvol;
+    newvol.reset(new Volume(next_file_name.c_str(), config_, huge_tlb_, logger_, direct_io_));
+    // File should be removed if volume wouldn't be used
+    newvol->is_temporary_.store(true);
+    return newvol;
+}
+
+std::shared_ptr<Volume> Volume::safe_realloc(std::shared_ptr<Volume> prepared) {
     uint32_t page_id = page_->get_page_id();
     uint32_t open_count = page_->get_open_count();
     uint32_t close_count = page_->get_close_count();
@@ -89,16 +120,29 @@ std::shared_ptr<Volume> Volume::safe_realloc() {
     is_temporary_.store(true);
 
     std::shared_ptr<Volume> newvol;
-    auto status = create_page_file(file_path_.c_str(), page_id, npages, logger_);
-    if (status != AKU_SUCCESS) {
-        (*logger_)(AKU_LOG_ERROR, "Failed to create new volume");
-        // Try to restore previous state on disk
-        mmap_.move_file(file_path_.c_str());
-        mmap_.panic_if_bad();
-        AKU_PANIC("can't create new page file (out of space?)");
+    if (prepared) {
+        // Prepared file is already created and mapped, only rename is needed
+        prepared->mmap_.move_file(file_path_.c_str());
+        if (prepared->mmap_.is_bad()) {
+            (*logger_)(AKU_LOG_ERROR, "Failed to rename prepared volume");
+        } else {
+            prepared->file_path_ = file_path_;
+            prepared->is_temporary_.store(false);
+            newvol = prepared;
+        }
+    }
+    if (!newvol) {
+        // New file should have the same size as the old one
+        auto status = create_page_file(file_path_.c_str(), page_id, npages, mmap_.get_size(), logger_);
+        if (status != AKU_SUCCESS) {
+            (*logger_)(AKU_LOG_ERROR, "Failed to create new volume");
+            // Try to restore previous state on disk
+            mmap_.move_file(file_path_.c_str());
+            mmap_.panic_if_bad();
+            AKU_PANIC("can't create new page file (out of space?)");
+        }
+        newvol.reset(new Volume(file_path_.c_str(), config_, huge_tlb_, logger_, direct_io_));
     }
-
-    newvol.reset(new Volume(file_path_.c_str(), config_, huge_tlb_, logger_));
     newvol->page_->set_open_count(open_count);
     newvol->page_->set_close_count(close_count);
     return newvol;
@@ -106,22 +150,104 @@ std::shared_ptr<Volume> Volume::safe_realloc() {
 
 void Volume::open() {
     page_->reuse();
-    mmap_.flush();
+    index_.reset();
+    flushed_offset_ = 0u;
+    flushed_count_ = 0u;
+    // Page content is not used after reuse, only header should be synced
+    mmap_.flush(0, sizeof(PageHeader));
 }
 
 void Volume::close() {
+    flush_dirty_ranges_();
     page_->close();
-    mmap_.flush();
+    mmap_.flush(0, sizeof(PageHeader));
+}
+
+void Volume::flush_dirty_ranges_() {
+    std::pair<size_t, size_t> payload, index;
+    uint32_t next_offset, count;
+    {
+        std::lock_guard<Sequencer::Mutex> guard(page_lock_);
+        next_offset = page_->get_next_offset();
+        count = page_->get_entries_count();
+        payload = page_->get_payload_range(flushed_offset_);
+        index = page_->get_index_range(flushed_count_);
+    }
+    // Payload should be synced before index entries that refer to it
+    mmap_.flush(payload.first, payload.second);
+    mmap_.flush(index.first, index.second);
+    flushed_offset_ = next_offset;
+    flushed_count_ = count;
 }
 
 void Volume::flush() {
-    mmap_.flush();
-    page_->create_checkpoint();
+    flush_dirty_ranges_();
+    {
+        std::lock_guard<Sequencer::Mutex> guard(page_lock_);
+        // Checkpoint can't point to index entries that wasn't synced
+        if (page_->get_entries_count() == flushed_count_) {
+            page_->create_checkpoint();
+        }
+    }
     mmap_.flush(0, sizeof(PageHeader));
 }
 
+const size_t Volume::PAYLOAD_PREALLOCATION_STEP;
+const size_t Volume::INDEX_PREALLOCATION_STEP;
+
+void Volume::preallocate() {
+    if (!preallocation_enabled_) {
+        return;
+    }
+    std::pair<size_t, size_t> payload, index;
+    {
+        std::lock_guard<Sequencer::Mutex> guard(page_lock_);
+        payload = page_->get_payload_range(0u);
+        index = page_->get_index_range(0u);
+    }
+    // Payload grows up, index grows down, new range is allocated when
+    // half of the previous one is used
+    size_t payload_from = preallocated_payload_, payload_to = preallocated_payload_;
+    if (payload.second + PAYLOAD_PREALLOCATION_STEP/2 > preallocated_payload_) {
+        payload_to = std::min(payload.second + PAYLOAD_PREALLOCATION_STEP, index.first);
+    }
+    size_t index_from = preallocated_index_, index_to = preallocated_index_;
+    if (index.first < preallocated_index_ + INDEX_PREALLOCATION_STEP/2) {
+        index_from = index.first > payload_to + INDEX_PREALLOCATION_STEP
+                   ? index.first - INDEX_PREALLOCATION_STEP
+                   : payload_to;
+    }
+    auto status = mmap_.preallocate(payload_from, payload_to);
+    if (status == APR_SUCCESS) {
+        status = mmap_.preallocate(index_from, index_to);
+    }
+    if (status != APR_SUCCESS) {
+        // Space will be allocated on write
+        std::stringstream fmt;
+        fmt << "Can't preallocate space in " << file_path_ << ", error " << apr_error_message(status);
+        (*logger_)(AKU_LOG_INFO, fmt.str().c_str());
+        preallocation_enabled_ = false;
+        return;
+    }
+    preallocated_payload_ = std::max(preallocated_payload_, payload_to);
+    preallocated_index_ = std::min(preallocated_index_, index_from);
+}
+
 //----------------------------------Storage---------------------------------------------
 
+/** Get largest timestamp stored in the page.
+  * @returns false if page is empty
+  */
+static bool get_last_timestamp(PageHeader const* page, aku_Timestamp* result) {
+    auto count = page->get_entries_count();
+    if (count == 0u) {
+        return false;
+    }
+    // Entries are added in timestamp order
+    *result = page->page_index(static_cast<int>(count - 1))->timestamp;
+    return true;
+}
+
 struct VolumeIterator {
     uint32_t                 compression_threshold;
     uint64_t                 max_cache_size;
@@ -184,6 +310,13 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
     , logger_(params.logger)
     , durability_(params.durability)
     , huge_tlb_(params.enable_huge_tlb != 0)
+    , direct_io_(params.enable_direct_io != 0)
+    , wal_path_(params.enable_wal ? std::string(path) + ".wal" : std::string())
+    , wal_fsync_interval_(params.wal_fsync_interval)
+    , query_threads_(params.query_threads)
+    , compaction_lock_(0)
+    , compaction_stop_(false)
+    , compaction_status_(AKU_SUCCESS)
 {
     // 0. Check that file exists
     auto filedesc = std::fopen(const_cast<char*>(path), "r");
@@ -195,6 +328,11 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
     }
     std::fclose(filedesc);
 
+    // Hot in-memory structures (sorted runs, series tables) should use huge pages
+    if (huge_tlb_ && HugePageArena::instance().enable() != AKU_SUCCESS) {
+        (*logger_)(AKU_LOG_ERROR, "can't reserve address space for huge page arena");
+    }
+
     // 1. Open db
     try {
         metadata_ = std::make_shared<MetadataStorage>(path, logger_);
@@ -222,16 +360,29 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
     // create volumes list
     for(auto path: v_iter.volume_names) {
         PVolume vol;
-        vol.reset(new Volume(path.c_str(), config_, huge_tlb_, logger_));
+        vol.reset(new Volume(path.c_str(), config_, huge_tlb_, logger_, direct_io_));
         volumes_.push_back(vol);
     }
 
     select_active_page();
 
+    // Compaction thread should be started before cache prepopulation because
+    // replay of the write-ahead log can produce checkpoints
+    compaction_thread_ = std::thread(&Storage::compaction_loop_, this);
+    prepare_next_volume_();
+
     prepopulate_cache(config_.max_cache_size);
 }
 
+Storage::~Storage() {
+    stop_compaction_();
+}
+
 void Storage::close() {
+    if (wait_for_compaction_() != AKU_SUCCESS) {
+        log_error("Background compaction failed, some data would be lost");
+    }
+    stop_compaction_();
     auto status = active_volume_->cache_->close(active_page_);
     if (status != AKU_SUCCESS) {
         log_error("Can't merge cached values back to disk, some data would be lost");
@@ -244,6 +395,144 @@ void Storage::close() {
     if (!names.empty()) {
         metadata_->insert_new_names(names);
     }
+    if (wal_) {
+        // Everything is stored in the page
+        wal_->reset();
+    }
+}
+
+aku_Status Storage::start_compaction_(PVolume volume, int merge_lock) {
+    std::unique_lock<LockType> guard(compaction_mutex_);
+    compaction_cond_.wait(guard, [this] { return !compaction_volume_; });
+    auto status = compaction_status_;
+    compaction_status_ = AKU_SUCCESS;
+    compaction_volume_ = volume;
+    compaction_lock_ = merge_lock;
+    compaction_cond_.notify_all();
+    return status;
+}
+
+aku_Status Storage::wait_for_compaction_() {
+    std::unique_lock<LockType> guard(compaction_mutex_);
+    compaction_cond_.wait(guard, [this] { return !compaction_volume_; });
+    auto status = compaction_status_;
+    compaction_status_ = AKU_SUCCESS;
+    return status;
+}
+
+void Storage::stop_compaction_() {
+    if (!compaction_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<LockType> guard(compaction_mutex_);
+        compaction_stop_ = true;
+        compaction_cond_.notify_all();
+    }
+    compaction_thread_.join();
+}
+
+void Storage::prepare_next_volume_() {
+    std::lock_guard<LockType> guard(compaction_mutex_);
+    prepare_volume_ = volumes_.at((active_volume_index_ + 1) % volumes_.size());
+    compaction_cond_.notify_all();
+}
+
+Storage::PVolume Storage::take_next_volume_(PVolume volume) {
+    PVolume result;
+    {
+        std::unique_lock<LockType> guard(compaction_mutex_);
+        compaction_cond_.wait(guard, [this] { return !prepare_volume_; });
+        std::swap(result, next_volume_);
+    }
+    if (result && result->get_page()->get_page_id() != volume->get_page()->get_page_id()) {
+        // Wrong volume was prepared, it will be removed
+        result.reset();
+    }
+    return result;
+}
+
+void Storage::compaction_loop_() {
+    std::unique_lock<LockType> guard(compaction_mutex_);
+    auto has_work = [this] { return compaction_stop_ || compaction_volume_ || prepare_volume_; };
+    while (true) {
+        while (!has_work()) {
+            if (wal_ && wal_fsync_interval_) {
+                // Buffered records of the write-ahead log should be synced even if writes stop
+                auto interval = std::chrono::milliseconds(wal_fsync_interval_);
+                if (compaction_cond_.wait_for(guard, interval) == std::cv_status::timeout) {
+                    PWriteAheadLog wal = wal_;
+                    guard.unlock();
+                    if (wal->sync_if_stale() != AKU_SUCCESS) {
+                        log_error("Can't sync write-ahead log");
+                    }
+                    guard.lock();
+                }
+            } else {
+                compaction_cond_.wait(guard);
+            }
+        }
+        if (!compaction_volume_) {
+            if (compaction_stop_) {
+                // Stop requested and there is no pending work
+                prepare_volume_.reset();
+                compaction_cond_.notify_all();
+                break;
+            }
+            // Prepare next volume in the ring when there is no compaction work
+            PVolume volume = prepare_volume_;
+            guard.unlock();
+            PVolume next = volume->prepare_next();
+            guard.lock();
+            next_volume_ = next;
+            prepare_volume_.reset();
+            compaction_cond_.notify_all();
+            continue;
+        }
+        PVolume volume = compaction_volume_;
+        int merge_lock = compaction_lock_;
+        guard.unlock();
+
+        volume->preallocate();
+
+        // Move data from cache to disk
+        auto status = volume->cache_->merge_and_compress(volume->get_page(), &volume->page_lock_);
+        if (status == AKU_SUCCESS) {
+            volume->index_.update(volume->get_page());
+            bool flush = false;
+            switch(durability_) {
+            case AKU_MAX_DURABILITY:
+                // Max durability
+                flush = true;
+                break;
+            case AKU_DURABILITY_SPEED_TRADEOFF:
+                // Compromice some durability for speed
+                flush = (merge_lock % 8) == 1;
+                break;
+            case AKU_MAX_WRITE_SPEED:
+                // Max speed
+                flush = (merge_lock % 32) == 1;
+                break;
+            };
+            if (flush) {
+                volume->flush();
+                aku_Timestamp durable;
+                if (wal_ && get_last_timestamp(volume->get_page(), &durable)) {
+                    // WAL segments that contains only flushed data are not needed anymore
+                    wal_->truncate(durable);
+                }
+            }
+        } else {
+            log_error(aku_error_message(status));
+        }
+
+        guard.lock();
+        if (status != AKU_SUCCESS) {
+            compaction_status_ = status;
+        }
+        compaction_volume_.reset();
+        compaction_cond_.notify_all();
+    }
 }
 
 void Storage::select_active_page() {
@@ -283,6 +572,42 @@ void Storage::prepopulate_cache(int64_t max_cache_size) {
     if (status != AKU_SUCCESS) {
         AKU_PANIC("Can't read series names from sqlite");
     }
+
+    if (wal_path_.empty()) {
+        return;
+    }
+    // Replay write-ahead log. All records with timestamps less or equal to the
+    // largest timestamp stored in pages are already durable (values are merged
+    // to the page in timestamp order), they should be skipped.
+    bool has_durable = false;
+    aku_Timestamp durable = AKU_MIN_TIMESTAMP;
+    for (auto const& volume: volumes_) {
+        aku_Timestamp last;
+        if (get_last_timestamp(volume->get_page(), &last)) {
+            durable = has_durable ? std::max(durable, last) : last;
+            has_durable = true;
+        }
+    }
+    auto wal = std::make_shared<WriteAheadLog>(wal_path_, wal_fsync_interval_, logger_);
+    uint64_t nreplayed = 0u;
+    status = wal->replay([&](TimeSeriesValue const& value, aku_MemRange data) {
+        if (has_durable && value.get_timestamp() <= durable) {
+            return AKU_SUCCESS;
+        }
+        nreplayed++;
+        auto status = _write_impl(value, data);
+        // Late writes was rejected during normal operation too
+        return status == AKU_ELATE_WRITE ? AKU_SUCCESS : status;
+    });
+    if (status != AKU_SUCCESS) {
+        log_error("Can't replay write-ahead log, some data would be lost");
+    }
+    log_message("write-ahead log replayed, samples", nreplayed);
+    // Compaction thread reads wal_
+    wait_for_compaction_();
+    std::lock_guard<LockType> guard(compaction_mutex_);
+    wal_ = wal;
+    compaction_cond_.notify_all();
 }
 
 aku_Status Storage::get_open_error() const {
@@ -299,20 +624,32 @@ void Storage::advance_volume_(int local_rev) {
         auto old_page_id = active_page_->get_page_id();
         AKU_UNUSED(old_page_id);
 
+        // Previous checkpoint should be merged before volume can be closed
+        if (wait_for_compaction_() != AKU_SUCCESS) {
+            log_error("Background compaction failed, some data would be lost");
+        }
+
         int close_lock = active_volume_->cache_->reset();
         if (close_lock % 2 == 1) {
             active_volume_->cache_->merge_and_compress(active_page_);
         }
         active_volume_->close();
+        active_volume_->index_.update(active_page_);
+        if (wal_) {
+            // All data from the log is stored in the closed volume
+            wal_->reset();
+        }
         log_message("page complete");
 
         // select next page in round robin order
         active_volume_index_++;
         auto last_volume = volumes_[active_volume_index_ % volumes_.size()];
-        volumes_[active_volume_index_ % volumes_.size()] = last_volume->safe_realloc();
+        // Replacement is usually prepared in background, rotation is a rename
+        volumes_[active_volume_index_ % volumes_.size()] = last_volume->safe_realloc(take_next_volume_(last_volume));
         active_volume_ = volumes_[active_volume_index_ % volumes_.size()];
         active_volume_->open();
         active_page_ = active_volume_->page_;
+        prepare_next_volume_();
 
         auto new_page_id = active_page_->get_page_id();
         AKU_UNUSED(new_page_id);
@@ -350,6 +687,205 @@ struct SearchError : std::runtime_error
     SearchError(const char* msg, aku_Status err) : std::runtime_error(msg), error_code(err) {}
 };
 
+/** Query processor that collects samples found by the worker thread.
+  * Samples are passed to the query thread in batches, worker is blocked
+  * when too many batches are waiting to be consumed.
+  */
+struct VolumeScan : QP::IQueryProcessor {
+    static const size_t BATCH_SIZE = 0x1000;
+    static const size_t MAX_BATCHES = 16;
+
+    const aku_Timestamp                 lowerbound_;
+    const aku_Timestamp                 upperbound_;
+    const int                           direction_;
+    std::mutex                          mutex_;
+    std::condition_variable             cond_;
+    std::deque<std::vector<aku_Sample>> batches_;   //< Batches ready to be consumed
+    std::vector<aku_Sample>             current_;   //< Batch being filled by the worker
+    bool                                done_;      //< Worker is done
+    bool                                cancelled_; //< Query thread doesn't need more samples
+    aku_Status                          error_;
+    std::unique_ptr<QP::ValueFilter>    filter_;    //< Copy of the query's value filter
+
+    VolumeScan(QP::IQueryProcessor const& query)
+        : lowerbound_(query.lowerbound())
+        , upperbound_(query.upperbound())
+        , direction_(query.direction())
+        , done_(false)
+        , cancelled_(false)
+        , error_(AKU_SUCCESS)
+    {
+        if (query.value_filter()) {
+            filter_.reset(new QP::ValueFilter(*query.value_filter()));
+        }
+    }
+
+    // IQueryProcessor interface (worker side)
+
+    aku_Timestamp lowerbound() const {
+        return lowerbound_;
+    }
+
+    aku_Timestamp upperbound() const {
+        return upperbound_;
+    }
+
+    int direction() const {
+        return direction_;
+    }
+
+    bool start() {
+        return true;
+    }
+
+    QP::ValueFilter const* value_filter() const {
+        return filter_.get();
+    }
+
+    bool put(const aku_Sample& sample) {
+        current_.push_back(sample);
+        if (current_.size() < BATCH_SIZE) {
+            return true;
+        }
+        return publish_(false);
+    }
+
+    bool put_batch(QP::SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            current_.push_back(batch.get(i));
+            if (current_.size() == BATCH_SIZE && !publish_(false)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void stop() {
+        publish_(true);
+    }
+
+    void set_error(aku_Status error) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        error_ = error;
+    }
+
+    bool publish_(bool done) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        cond_.wait(guard, [this] { return cancelled_ || batches_.size() < MAX_BATCHES; });
+        if (!current_.empty() && !cancelled_) {
+            batches_.push_back(std::move(current_));
+        }
+        current_ = std::vector<aku_Sample>();
+        done_ = done;
+        cond_.notify_all();
+        return !cancelled_;
+    }
+
+    // Query thread side
+
+    bool is_cancelled() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return cancelled_;
+    }
+
+    /** Get next batch of samples.
+      * @returns false if worker is done and all batches was consumed
+      */
+    bool pop(std::vector<aku_Sample>* batch, aku_Status* error) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        cond_.wait(guard, [this] { return done_ || !batches_.empty(); });
+        if (batches_.empty()) {
+            *error = error_;
+            return false;
+        }
+        batch->swap(batches_.front());
+        batches_.pop_front();
+        cond_.notify_all();
+        return true;
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        cancelled_ = true;
+        cond_.notify_all();
+    }
+};
+
+//! Cancels volume scans and joins worker threads on scope exit (including search errors)
+struct ScanWorkers {
+    std::vector<std::shared_ptr<VolumeScan>> scans;
+    std::vector<std::thread>                 threads;
+
+    ~ScanWorkers() {
+        for (auto& scan: scans) {
+            scan->cancel();
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    }
+};
+
+/** Merge outputs of the volume scans [first, last) and pass the result to `output`.
+  * Volumes can overlap in time (late writes that was accepted after rotation), so
+  * their outputs can't be simply concatenated.
+  * @returns false if query processor was interrupted or one of the scans failed
+  */
+template<int dir>
+static bool merge_volume_scans(std::vector<std::shared_ptr<VolumeScan>> const& scans,
+                               size_t first,
+                               size_t last,
+                               QP::IQueryProcessor& query,
+                               QP::BatchBuilder& output)
+{
+    auto nscans = static_cast<uint32_t>(last - first);
+    std::vector<std::vector<aku_Sample>> buffers(nscans);
+    std::vector<size_t> positions(nscans, 0u);
+    aku_Status error = AKU_SUCCESS;
+    auto refill = [&](uint32_t ix) {
+        positions[ix] = 0u;
+        while (scans[first + ix]->pop(&buffers[ix], &error)) {
+            if (!buffers[ix].empty()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto key = [](aku_Sample const& sample) {
+        return make_merge_key<dir>(sample.timestamp, sample.paramid);
+    };
+
+    LoserTree tree(nscans);
+    for (uint32_t ix = 0; ix < nscans; ix++) {
+        if (refill(ix)) {
+            tree.set(ix, key(buffers[ix].front()));
+        } else if (error != AKU_SUCCESS) {
+            query.set_error(error);
+            return false;
+        }
+    }
+    tree.build();
+    while (!tree.empty()) {
+        auto ix = tree.top();
+        auto& pos = positions[ix];
+        if (!output.put(buffers[ix][pos++])) {
+            return false;
+        }
+        if (pos == buffers[ix].size()) {
+            if (!refill(ix)) {
+                if (error != AKU_SUCCESS) {
+                    query.set_error(error);
+                    return false;
+                }
+                tree.pop_top();
+                continue;
+            }
+        }
+        tree.replace_top(key(buffers[ix][pos]));
+    }
+    return output.flush();
+}
+
 struct TerminalNode : QP::Node {
 
     Caller &caller;
@@ -371,6 +907,15 @@ struct TerminalNode : QP::Node {
         return cursor->put(caller, sample);
     }
 
+    bool put_batch(QP::SampleBatch const& batch) {
+        for (uint32_t i = 0; i < batch.size; i++) {
+            if (!cursor->put(caller, batch.get(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     void set_error(aku_Status status) {
         cursor->set_error(caller, status);
         throw SearchError("search error detected", status);
@@ -398,29 +943,157 @@ void Storage::searchV2(Caller &caller, InternalCursor* cur, const char* query) c
 
         if (query_processor->start()) {
 
-            uint32_t starting_ix = active_volume_->get_page()->get_page_id();
-            if (query_processor->direction() == AKU_CURSOR_DIR_FORWARD) {
-                for (uint32_t ix = starting_ix; ix < (starting_ix + volumes_.size()); ix++) {
-                    int seq_id;
-                    aku_Timestamp window;
-                    uint32_t index = ix % volumes_.size();
-                    PVolume volume = volumes_.at(index);
-                    tie(window, seq_id) = volume->cache_->get_window();
-                    volume->get_page()->searchV2(query_processor, cache_);
-                    volume->cache_->searchV2(query_processor, seq_id);
+            int direction = query_processor->direction();
+            if (direction != AKU_CURSOR_DIR_FORWARD && direction != AKU_CURSOR_DIR_BACKWARD) {
+                AKU_PANIC("data corruption in query processor");
+            }
+            auto lowerbound = query_processor->lowerbound();
+            auto upperbound = query_processor->upperbound();
+
+            // Collect volumes that can contain matching data
+            struct Target {
+                PVolume             volume;
+                Sequencer::Snapshot snapshot;
+                bool                search_page;
+                aku_Timestamp       begin;          //< Time range of the volume data (page and
+                aku_Timestamp       end;            //< snapshot) clamped to the query range
+            };
+            std::vector<Target> targets;
+            for (auto volume: volumes_) {
+                Target target = { volume, volume->cache_->get_snapshot(), false, AKU_MAX_TIMESTAMP, AKU_MIN_TIMESTAMP };
+                aku_Timestamp begin, end;
+                auto limit = target.snapshot.page_limit;
+                if (!volume->index_.get_bounds(limit, &begin, &end) && limit != 0) {
+                    // Index wasn't updated yet (newly added entries), page index is ordered by time
+                    begin = volume->page_->page_index(0)->timestamp;
+                    end = volume->page_->page_index(static_cast<int>(limit - 1))->timestamp;
+                }
+                if (limit != 0 && begin <= upperbound && end >= lowerbound) {
+                    target.search_page = true;
+                    target.begin = begin;
+                    target.end = end;
                 }
-            } else if (query_processor->direction() == AKU_CURSOR_DIR_BACKWARD) {
-                for (int64_t ix = (starting_ix + volumes_.size() - 1); ix >= starting_ix; ix--) {
-                    int seq_id;
-                    aku_Timestamp window;
-                    uint32_t index = static_cast<uint32_t>(ix % volumes_.size());
-                    PVolume volume = volumes_.at(index);
-                    tie(window, seq_id) = volume->cache_->get_window();
-                    volume->cache_->searchV2(query_processor, seq_id);
-                    volume->get_page()->searchV2(query_processor, cache_);
+                for (auto const& run: target.snapshot.runs) {
+                    // Runs are sorted by timestamp
+                    if (run.begin() != run.end()) {
+                        target.begin = std::min(target.begin, run.begin()->key_ts_);
+                        target.end = std::max(target.end, (run.end() - 1)->key_ts_);
+                    }
                 }
+                target.begin = std::max(target.begin, lowerbound);
+                target.end = std::min(target.end, upperbound);
+                if (target.begin <= target.end) {
+                    targets.push_back(std::move(target));
+                }
+            }
+
+            // Visit volumes in time order
+            if (direction == AKU_CURSOR_DIR_FORWARD) {
+                std::stable_sort(targets.begin(), targets.end(), [](Target const& lhs, Target const& rhs) {
+                    return lhs.begin < rhs.begin;
+                });
             } else {
-                AKU_PANIC("data corruption in query processor");
+                std::stable_sort(targets.begin(), targets.end(), [](Target const& lhs, Target const& rhs) {
+                    return lhs.end > rhs.end;
+                });
+            }
+
+            // Volumes that overlap in time form a cluster, outputs of the volumes from
+            // the same cluster should be merged. Clusters are ordered and don't overlap.
+            std::vector<size_t> clusters;   // Index of the first target of each cluster
+            size_t max_cluster = 0u;
+            aku_Timestamp cluster_begin = AKU_MAX_TIMESTAMP, cluster_end = AKU_MIN_TIMESTAMP;
+            for (size_t ix = 0; ix < targets.size(); ix++) {
+                auto const& target = targets[ix];
+                bool overlaps = !clusters.empty() && target.begin <= cluster_end && target.end >= cluster_begin;
+                if (!overlaps) {
+                    clusters.push_back(ix);
+                    cluster_begin = target.begin;
+                    cluster_end = target.end;
+                } else {
+                    cluster_begin = std::min(cluster_begin, target.begin);
+                    cluster_end = std::max(cluster_end, target.end);
+                }
+                max_cluster = std::max(max_cluster, ix + 1 - clusters.back());
+            }
+            clusters.push_back(targets.size());
+
+            // Returns false if query processor interrupted the scan (e.g. limit is reached)
+            auto scan_volume = [this, direction](Target const& target, std::shared_ptr<QP::IQueryProcessor> proc) {
+                auto page = target.volume->get_page();
+                auto index = &target.volume->index_;
+                if (direction == AKU_CURSOR_DIR_FORWARD) {
+                    if (target.search_page && !page->searchV2(proc, cache_, target.snapshot.page_limit, index)) {
+                        return false;
+                    }
+                    return target.volume->cache_->searchV2(proc, target.snapshot);
+                } else {
+                    if (!target.volume->cache_->searchV2(proc, target.snapshot)) {
+                        return false;
+                    }
+                    if (target.search_page) {
+                        return page->searchV2(proc, cache_, target.snapshot.page_limit, index);
+                    }
+                    return true;
+                }
+            };
+
+            if (max_cluster < 2 && (query_threads_ < 2 || targets.size() < 2)) {
+                // Volumes doesn't overlap, results can be concatenated
+                for (auto const& target: targets) {
+                    if (!scan_volume(target, query_processor)) {
+                        break;
+                    }
+                }
+            } else {
+                // Volumes are scanned by the workers in parallel, results are consumed
+                // cluster by cluster. Workers take volumes in order and all volumes of
+                // the cluster should be scanned simultaneously (otherwise the merge will
+                // wait for the volume that can't be started because all workers are
+                // blocked), so there should be at least `max_cluster` workers.
+                ScanWorkers workers;
+                for (size_t ix = 0; ix < targets.size(); ix++) {
+                    workers.scans.push_back(std::make_shared<VolumeScan>(*query_processor));
+                }
+                std::atomic<size_t> next_target(0u);
+                auto worker = [&]() {
+                    while (true) {
+                        size_t ix = next_target++;
+                        if (ix >= targets.size()) {
+                            break;
+                        }
+                        // Exception shouldn't escape the thread
+                        try {
+                            if (!workers.scans[ix]->is_cancelled()) {
+                                scan_volume(targets[ix], workers.scans[ix]);
+                            }
+                        } catch (SearchError const& err) {
+                            workers.scans[ix]->set_error(err.error_code);
+                        } catch (std::exception const& err) {
+                            log_error(err.what());
+                            workers.scans[ix]->set_error(AKU_EGENERAL);
+                        } catch (...) {
+                            log_error("unknown error during volume scan");
+                            workers.scans[ix]->set_error(AKU_EGENERAL);
+                        }
+                        workers.scans[ix]->stop();
+                    }
+                };
+                auto nthreads = std::min(std::max(static_cast<size_t>(query_threads_), max_cluster), targets.size());
+                for (size_t i = 0; i < nthreads; i++) {
+                    workers.threads.emplace_back(worker);
+                }
+                QP::BatchBuilder output(*query_processor);
+                for (size_t ic = 0; ic + 1 < clusters.size(); ic++) {
+                    bool proceed = direction == AKU_CURSOR_DIR_FORWARD
+                                 ? merge_volume_scans<AKU_CURSOR_DIR_FORWARD>(workers.scans, clusters[ic], clusters[ic + 1],
+                                                                              *query_processor, output)
+                                 : merge_volume_scans<AKU_CURSOR_DIR_BACKWARD>(workers.scans, clusters[ic], clusters[ic + 1],
+                                                                               *query_processor, output);
+                    if (!proceed) {
+                        break;
+                    }
+                }
             }
 
             query_processor->stop();
@@ -436,6 +1109,7 @@ void Storage::get_stats(aku_StorageStats* rcv_stats) {
     for (PVolume const& vol: volumes_) {
         vol->page_->get_stats(rcv_stats);
     }
+    cache_->get_stats(rcv_stats);
 }
 
 // Writing
@@ -445,13 +1119,36 @@ aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
         int local_rev = active_volume_index_.load();
         auto space_required = active_volume_->cache_->get_space_estimate();
         int status = AKU_SUCCESS;
-        if (ts_value.is_blob()) {
-            status = active_page_->add_chunk(data, space_required, &ts_value.payload.blob.value);
+        {
+            std::lock_guard<Sequencer::Mutex> guard(active_volume_->page_lock_);
+            if (ts_value.is_blob()) {
+                status = active_page_->add_chunk(data, space_required, &ts_value.payload.blob.value);
+            } else if (active_page_->get_free_space() < space_required) {
+                // Page should have enough space for compressed sequencer data
+                status = AKU_EOVERFLOW;
+            }
         }
         switch (status) {
             case AKU_SUCCESS: {
+                if (wal_) {
+                    // Sample should be logged before it becomes visible, late writes
+                    // rejected by the sequencer are skipped during replay
+                    status = wal_->append(ts_value, data);
+                    if (status != AKU_SUCCESS) {
+                        return status;
+                    }
+                }
                 int merge_lock = 0;
                 std::tie(status, merge_lock) = active_volume_->cache_->add(ts_value);
+                if (status == AKU_EBUSY) {
+                    // Previous checkpoint is still being merged in background,
+                    // payload is already written so only sequencer should be updated.
+                    status = wait_for_compaction_();
+                    if (status != AKU_SUCCESS) {
+                        return status;
+                    }
+                    std::tie(status, merge_lock) = active_volume_->cache_->add(ts_value);
+                }
                 if (merge_lock % 2 == 1) {
 
                     // Slow path //
@@ -463,27 +1160,10 @@ aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
                         metadata_->insert_new_names(names);
                     }
 
-                    // Move data from cache to disk
-                    status = active_volume_->cache_->merge_and_compress(active_volume_->get_page());
-                    if (status == AKU_SUCCESS) {
-                        switch(durability_) {
-                        case AKU_MAX_DURABILITY:
-                            // Max durability
-                            active_volume_->flush();
-                            break;
-                        case AKU_DURABILITY_SPEED_TRADEOFF:
-                            // Compromice some durability for speed
-                            if ((merge_lock % 8) == 1) {
-                                active_volume_->flush();
-                            }
-                            break;
-                        case AKU_MAX_WRITE_SPEED:
-                            // Max speed
-                            if ((merge_lock % 32) == 1) {
-                                active_volume_->flush();
-                            }
-                            break;
-                        };
+                    // Move data from cache to disk in background
+                    auto compaction_status = start_compaction_(active_volume_, merge_lock);
+                    if (compaction_status != AKU_SUCCESS) {
+                        return compaction_status;
                     }
                 }
                 return status;
@@ -596,12 +1276,12 @@ static apr_status_t create_file(const char* file_name, uint64_t size, aku_logger
 
 
 /** This function creates one of the page files with specified
-  * name and index.
+  * name, index and size. File is sparse, disk space is allocated
+  * on demand (see Volume::preallocate).
   */
-static apr_status_t create_page_file(const char* file_name, uint32_t page_index, uint32_t npages, aku_logger_cb_t logger) {
+static apr_status_t create_page_file(const char* file_name, uint32_t page_index, uint32_t npages, uint64_t size, aku_logger_cb_t logger) {
     using namespace std;
     apr_status_t status;
-    int64_t size = AKU_MAX_PAGE_SIZE;
 
     status = create_file(file_name, size, logger);
     if (status != APR_SUCCESS) {
@@ -617,7 +1297,7 @@ static apr_status_t create_page_file(const char* file_name, uint32_t page_index,
 
     // Create index page
     auto index_ptr = mfile.get_pointer();
-    auto index_page = new (index_ptr) PageHeader(0, AKU_MAX_PAGE_SIZE, page_index, npages);
+    auto index_page = new (index_ptr) PageHeader(0, size, page_index, npages);
 
     // Activate the first page
     if (page_index == 0) {
@@ -628,10 +1308,10 @@ static apr_status_t create_page_file(const char* file_name, uint32_t page_index,
 
 /** Create page files, return list of statuses.
   */
-static std::vector<apr_status_t> create_page_files(std::vector<std::string> const& targets, aku_logger_cb_t logger) {
+static std::vector<apr_status_t> create_page_files(std::vector<std::string> const& targets, uint64_t size, aku_logger_cb_t logger) {
     std::vector<apr_status_t> results(targets.size(), APR_SUCCESS);
     for (size_t ix = 0; ix < targets.size(); ix++) {
-        apr_status_t res = create_page_file(targets[ix].c_str(), (uint32_t)ix, (uint32_t)targets.size(), logger);
+        apr_status_t res = create_page_file(targets[ix].c_str(), (uint32_t)ix, (uint32_t)targets.size(), size, logger);
         results[ix] = res;
     }
     return results;
@@ -729,8 +1409,20 @@ apr_status_t Storage::new_storage(const char  *file_name,
                                   uint32_t     compression_threshold,
                                   uint64_t     window_size,
                                   uint32_t     max_cache_size,
+                                  uint64_t     volume_size,
                                   aku_logger_cb_t logger)
 {
+    // Offsets inside the page are 32-bit
+    if (volume_size < AKU_MIN_VOLUME_SIZE || volume_size > static_cast<uint64_t>(AKU_MAX_PAGE_SIZE)) {
+        std::stringstream err;
+        err << "Invalid volume size " << volume_size << ", should be in ["
+            << AKU_MIN_VOLUME_SIZE << ", " << AKU_MAX_PAGE_SIZE << "] range";
+        (*logger)(AKU_LOG_ERROR, err.str().c_str());
+        return APR_EINVAL;
+    }
+    // Round volume size down to memory page boundary
+    volume_size &= ~static_cast<uint64_t>(get_page_size() - 1);
+
     apr_pool_t* mempool;
     apr_status_t status = apr_pool_create(&mempool, NULL);
     if (status != APR_SUCCESS)
@@ -772,7 +1464,7 @@ apr_status_t Storage::new_storage(const char  *file_name,
         (*logger)(AKU_LOG_INFO, "Volumes dir already exists");
     }
 
-    std::vector<apr_status_t> page_creation_statuses = create_page_files(page_names, logger);
+    std::vector<apr_status_t> page_creation_statuses = create_page_files(page_names, volume_size, logger);
     for(auto creation_status: page_creation_statuses) {
         if (creation_status != APR_SUCCESS) {
             (*logger)(AKU_LOG_ERROR, "Not all pages successfullly created. Cleaning up.");
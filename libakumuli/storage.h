@@ -30,6 +30,7 @@
 #include <thread>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
 
 // APR headers
 #include <apr.h>
@@ -38,6 +39,7 @@
 #include "page.h"
 #include "util.h"
 #include "sequencer.h"
+#include "wal.h"
 #include "cursor.h"
 #include "seriesparser.h"
 #include "akumuli_def.h"
@@ -51,6 +53,11 @@ namespace Akumuli {
   */
 struct Volume : std::enable_shared_from_this<Volume>
 {
+    //! Payload space preallocated ahead of the write cursor
+    static const size_t PAYLOAD_PREALLOCATION_STEP = 0x4000000;
+    //! Index space preallocated ahead of the index tail
+    static const size_t INDEX_PREALLOCATION_STEP = 0x100000;
+
     MemoryMappedFile mmap_;
     PageHeader* page_;
     aku_Duration window_;
@@ -61,20 +68,38 @@ struct Volume : std::enable_shared_from_this<Volume>
     aku_logger_cb_t logger_;
     std::atomic_bool is_temporary_;  //< True if this is temporary volume and underlying file should be deleted
     const bool huge_tlb_;
+    const bool direct_io_;           //< Page is written using pwrite instead of shared mmap
+    Sequencer::Mutex page_lock_;     //< Serializes writes to the page (writer and compaction thread)
+    uint32_t flushed_offset_;        //< Payload offset at the moment of the last flush
+    uint32_t flushed_count_;         //< Number of index entries at the moment of the last flush
+    size_t preallocated_payload_;    //< End of the preallocated payload range
+    size_t preallocated_index_;      //< Beginning of the preallocated index range
+    bool preallocation_enabled_;     //< False if file system doesn't support preallocation
+    SparseIndex index_;              //< In-memory index of the page (updated by compaction thread)
 
     //! Create new volume stored in file
     Volume(const char           *file_path,
            const aku_Config&     conf,
            bool                  enable_huge_tlb,
-           aku_logger_cb_t       logger);
+           aku_logger_cb_t       logger,
+           bool                  direct_io = false);
 
     ~Volume();
 
     //! Get pointer to page
     PageHeader* get_page() const;
 
-    //! Reallocate space safely
-    std::shared_ptr<Volume> safe_realloc();
+    /** Create empty volume that can replace this one (file `<path>.next`).
+      * Called by the background thread ahead of time to make `safe_realloc` cheap.
+      * @returns new volume or null on error
+      */
+    std::shared_ptr<Volume> prepare_next() const;
+
+    /** Reallocate space safely.
+      * @param prepared is a volume created by `prepare_next` (optional), if present
+      *        it replaces this volume without creating new file
+      */
+    std::shared_ptr<Volume> safe_realloc(std::shared_ptr<Volume> prepared = std::shared_ptr<Volume>());
 
     //! Open page for writing
     void open();
@@ -82,8 +107,21 @@ struct Volume : std::enable_shared_from_this<Volume>
     //! Flush all data and close volume for write until reallocation
     void close();
 
-    //! Flush page
+    /** Flush page.
+      * Only the data added since the previous flush is synced: payload first, then
+      * index entries and then the page header (with new checkpoint).
+      */
     void flush();
+
+    /** Allocate disk space ahead of the payload write cursor and index tail.
+      * Volume file is sparse, this method should be called periodically by the
+      * background thread to avoid block allocation on the write path.
+      */
+    void preallocate();
+
+private:
+    //! Sync payload and index ranges modified since the previous flush
+    void flush_dirty_ranges_();
 };
 
 /** Interface to page manager
@@ -95,6 +133,7 @@ struct Storage
     typedef std::shared_ptr<MetadataStorage>    PMetadataStorage;
     typedef std::shared_ptr<SeriesMatcher>      PSeriesMatcher;
     typedef std::shared_ptr<ChunkCache>         PCache;
+    typedef std::shared_ptr<WriteAheadLog>      PWriteAheadLog;
 
     // Active volume state
     aku_Config                config_;
@@ -115,17 +154,37 @@ struct Storage
     Rand                      rand_;
     const uint32_t            durability_;                //< Copy of the durability parameter
     const bool                huge_tlb_;                  //< Copy of enable_huge_tlb parameter
+    const bool                direct_io_;                 //< Copy of enable_direct_io parameter
     PCache                    cache_;
+    const std::string         wal_path_;                  //< Write-ahead log path (empty if disabled)
+    const uint32_t            wal_fsync_interval_;        //< Copy of wal_fsync_interval parameter
+    PWriteAheadLog            wal_;                       //< Write-ahead log (null if disabled)
+    const uint32_t            query_threads_;             //< Copy of query_threads parameter
+
+    // Background compaction
+    std::thread               compaction_thread_;         //< Runs merge_and_compress
+    LockType                  compaction_mutex_;
+    std::condition_variable   compaction_cond_;
+    PVolume                   compaction_volume_;         //< Volume that should be compacted (or null)
+    int                       compaction_lock_;           //< Merge lock (sequence number) of the pending task
+    bool                      compaction_stop_;
+    aku_Status                compaction_status_;         //< Error code of the last failed compaction
+    PVolume                   prepare_volume_;            //< Volume that needs replacement (or null)
+    PVolume                   next_volume_;               //< Replacement prepared by compaction thread (or null)
 
     /** Storage c-tor.
       * @param file_name path to metadata file
       */
     Storage(const char *path, aku_FineTuneParams const& conf);
 
+    ~Storage();
+
     //! Select page that was active last time
     void select_active_page();
 
-    //! Prepopulate cache
+    /** Prepopulate cache.
+      * Restores active page and replays write-ahead log (if enabled) into the sequencer.
+      */
     void prepopulate_cache(int64_t max_cache_size);
 
     void log_message(const char* message) const;
@@ -144,6 +203,33 @@ struct Storage
       */
     void advance_volume_(int ix);
 
+    /** Pass volume to compaction thread.
+      * @param volume is a volume that contains checkpoint to merge
+      * @param merge_lock is a sequence number returned by Sequencer::add
+      * @returns error code of the previous compaction
+      */
+    aku_Status start_compaction_(PVolume volume, int merge_lock);
+
+    /** Wait until compaction thread completes its current task.
+      * @returns error code of the last compaction
+      */
+    aku_Status wait_for_compaction_();
+
+    //! Stop compaction thread
+    void stop_compaction_();
+
+    //! Ask compaction thread to prepare replacement for the next volume in the ring
+    void prepare_next_volume_();
+
+    /** Wait until replacement volume is ready and take it.
+      * @param volume is a volume that should be replaced
+      * @returns prepared volume or null if it's not available
+      */
+    PVolume take_next_volume_(PVolume volume);
+
+    //! Compaction thread main loop
+    void compaction_loop_();
+
     //! Write binary data.
     aku_Status write_blob(aku_ParamId param, aku_Timestamp ts, aku_MemRange data);
 
@@ -175,6 +261,7 @@ struct Storage
       * @param storage_name storage name
       * @param metadata_path path to metadata dir
       * @param volumes_path path to volumes dir
+      * @param volume_size size of the volume file in bytes (should be less or equal to AKU_MAX_PAGE_SIZE)
       */
     static apr_status_t new_storage(const char     *file_name,
                                     const char     *metadata_path,
@@ -183,6 +270,7 @@ struct Storage
                                     uint32_t        compression_threshold,
                                     uint64_t        window_size,
                                     uint32_t        max_cache_size,
+                                    uint64_t        volume_size,
                                     aku_logger_cb_t logger);
 
     /** Remove all volumes
@@ -34,7 +34,7 @@ StringPool::StringT StringPool::add(const char* begin, const char* end, uint64_t
         return std::make_pair("", 0);
     }
     size += 2 + sizeof(uint64_t);  // 2 is for two \0 characters
-    std::vector<char>* bin = &pool.back();
+    BinT* bin = &pool.back();
     if (static_cast<int>(bin->size()) + size > MAX_BIN_SIZE) {
         // New bin
         pool.emplace_back();
@@ -60,7 +60,7 @@ StringPool::StringT StringPool::add(const char* begin, const char* end, uint64_t
 std::vector<StringPool::StringT> StringPool::regex_match(const char *regex) const {
     std::vector<StringPool::StringT> results;
     boost::regex series_regex(regex, boost::regex_constants::optimize);
-    typedef std::vector<char> const* PBuffer;
+    typedef BinT const* PBuffer;
     std::vector<PBuffer> buffers;
     {
         std::lock_guard<std::mutex> guard(pool_mutex);
@@ -22,15 +22,17 @@
 #include <mutex>
 
 #include "akumuli_def.h"
+#include "util.h"
 
 namespace Akumuli {
 
 struct StringPool {
 
     typedef std::pair<const char*, int> StringT;
+    typedef std::vector<char, HugePageAllocator<char>> BinT;  //< Uses huge pages if enabled
     const int MAX_BIN_SIZE = AKU_LIMITS_MAX_SNAME*0x1000;
 
-    std::deque<std::vector<char>> pool;
+    std::deque<BinT> pool;
     mutable std::mutex pool_mutex;
 
     StringT add(const char* begin, const char *end, uint64_t payload);
@@ -46,10 +48,14 @@ struct StringTools {
 
     typedef std::unordered_map<StringT, uint64_t,
                                decltype(&StringTools::hash),
-                               decltype(&StringTools::equal)> TableT;
+                               decltype(&StringTools::equal),
+                               HugePageAllocator<std::pair<const StringT, uint64_t>>> TableT;
 
     //! Inverted table type (id to string mapping)
-    typedef std::unordered_map<uint64_t, StringT> InvT;
+    typedef std::unordered_map<uint64_t, StringT,
+                               std::hash<uint64_t>,
+                               std::equal_to<uint64_t>,
+                               HugePageAllocator<std::pair<const uint64_t, StringT>>> InvT;
 
     static TableT create_table(size_t size);
 };
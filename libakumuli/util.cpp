@@ -24,6 +24,8 @@
 #include <iostream>
 
 #include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "akumuli_def.h"
 
 namespace Akumuli
@@ -71,10 +73,14 @@ std::ostream& operator << (std::ostream& str, Exception const& e) {
     return str;
 }
 
-MemoryMappedFile::MemoryMappedFile(const char* file_name, bool enable_huge_tlb, aku_logger_cb_t logger)
+MemoryMappedFile::MemoryMappedFile(const char* file_name, bool enable_huge_tlb, aku_logger_cb_t logger, bool direct_io)
     : path_(file_name)
     , logger_(logger)
     , enable_huge_tlb_(enable_huge_tlb)
+    , direct_io_(direct_io)
+    , base_(nullptr)
+    , size_(0u)
+    , write_fd_(-1)
 {
     map_file();
 }
@@ -108,11 +114,19 @@ apr_status_t MemoryMappedFile::map_file() {
             status_ = apr_file_info_get(&finfo_, APR_FINFO_SIZE, fp_);
             if (status_ == APR_SUCCESS) {
                 success_count++;
-                apr_int32_t flags = APR_MMAP_WRITE | APR_MMAP_READ;
-                if (enable_huge_tlb_) {
-                    flags |= MAP_HUGETLB;
+                if (direct_io_) {
+                    status_ = map_private();
+                } else {
+                    apr_int32_t flags = APR_MMAP_WRITE | APR_MMAP_READ;
+                    if (enable_huge_tlb_) {
+                        flags |= MAP_HUGETLB;
+                    }
+                    status_ = apr_mmap_create(&mmap_, fp_, 0, finfo_.size, flags, mem_pool_);
+                    if (status_ == APR_SUCCESS) {
+                        base_ = mmap_->mm;
+                        size_ = mmap_->size;
+                    }
                 }
-                status_ = apr_mmap_create(&mmap_, fp_, 0, finfo_.size, flags, mem_pool_);
                 if (status_ == APR_SUCCESS)
                     success_count++; }}}
 
@@ -125,6 +139,34 @@ apr_status_t MemoryMappedFile::map_file() {
     return status_;
 }
 
+apr_status_t MemoryMappedFile::map_private() {
+    size_ = static_cast<size_t>(finfo_.size);
+    int fd = ::open(path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return APR_FROM_OS_ERROR(errno);
+    }
+    // Changes are not written back by the kernel, `flush` writes them explicitly
+    base_ = mmap(nullptr, size_, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+        base_ = nullptr;
+        return APR_FROM_OS_ERROR(errno);
+    }
+    write_fd_ = ::open(path_.c_str(), O_WRONLY|O_DIRECT);
+    if (write_fd_ < 0 && errno == EINVAL) {
+        // File system doesn't support O_DIRECT
+        (*logger_)(AKU_LOG_INFO, "O_DIRECT is not supported, buffered I/O will be used");
+        write_fd_ = ::open(path_.c_str(), O_WRONLY);
+    }
+    if (write_fd_ < 0) {
+        auto status = APR_FROM_OS_ERROR(errno);
+        munmap(base_, size_);
+        base_ = nullptr;
+        return status;
+    }
+    return APR_SUCCESS;
+}
+
 void MemoryMappedFile::remap_file_destructive() {
     using namespace std;
     apr_off_t file_size = finfo_.size;
@@ -207,7 +249,13 @@ void MemoryMappedFile::free_resources(int cnt)
     {
     default:
     case 4:
-        apr_mmap_delete(mmap_);
+        if (direct_io_) {
+            munmap(base_, size_);
+            ::close(write_fd_);
+            write_fd_ = -1;
+        } else {
+            apr_mmap_delete(mmap_);
+        }
     case 3:
     case 2:
         apr_file_close(fp_);
@@ -222,20 +270,99 @@ MemoryMappedFile::~MemoryMappedFile() {
 }
 
 void* MemoryMappedFile::get_pointer() const {
-    return mmap_->mm;
+    return base_;
 }
 
 size_t MemoryMappedFile::get_size() const {
-    return mmap_->size;
+    return size_;
 }
 
 apr_status_t MemoryMappedFile::flush() {
-    return flush(0, mmap_->size);
+    return flush(0, size_);
+}
+
+apr_status_t MemoryMappedFile::write_range(size_t from, size_t to) {
+    // O_DIRECT requires aligned offsets, lengths and buffers, whole pages are written
+    static const size_t BOUNCE_BUFFER_SIZE = 0x100000;
+    const size_t page_size = get_page_size();
+    size_t begin = from & ~(page_size - 1);
+    size_t end = std::min((to + page_size - 1) & ~(page_size - 1), size_);
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, page_size, BOUNCE_BUFFER_SIZE) != 0) {
+        return APR_ENOMEM;
+    }
+    apr_status_t status = APR_SUCCESS;
+    const char* source = static_cast<const char*>(base_);
+    for (size_t offset = begin; offset < end && status == APR_SUCCESS;) {
+        size_t len = std::min(BOUNCE_BUFFER_SIZE, end - offset);
+        memcpy(buffer, source + offset, len);
+        auto nwritten = pwrite(write_fd_, buffer, len, static_cast<off_t>(offset));
+        if (nwritten < 0) {
+            if (errno != EINTR) {
+                status = APR_FROM_OS_ERROR(errno);
+            }
+            continue;
+        }
+        offset += static_cast<size_t>(nwritten);
+    }
+    free(buffer);
+    if (status == APR_SUCCESS && fdatasync(write_fd_) != 0) {
+        status = APR_FROM_OS_ERROR(errno);
+    }
+    if (status == APR_SUCCESS) {
+        // Release private copies of the pages that was completely written, next access
+        // will map them from the file. Partially written pages (first and last) can be
+        // modified concurrently and should be preserved.
+        size_t rbegin = (from + page_size - 1) & ~(page_size - 1);
+        size_t rend = to & ~(page_size - 1);
+        if (rbegin < rend) {
+            madvise(static_cast<char*>(base_) + rbegin, rend - rbegin, MADV_DONTNEED);
+        }
+    }
+    return status;
+}
+
+apr_status_t MemoryMappedFile::preallocate(size_t from, size_t to) {
+    to = std::min(to, size_);
+    if (from >= to) {
+        return APR_SUCCESS;
+    }
+    int fd = open(path_.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return APR_FROM_OS_ERROR(errno);
+    }
+    apr_status_t status = APR_SUCCESS;
+    // File size is not changed, only holes in the range are filled
+    if (fallocate(fd, 0, static_cast<off_t>(from), static_cast<off_t>(to - from)) != 0) {
+        status = APR_FROM_OS_ERROR(errno);
+    }
+    close(fd);
+    if (status == APR_SUCCESS && !direct_io_) {
+        // Load allocated pages into page cache to avoid major faults on first write
+        char* begin = static_cast<char*>(align_to_page(static_cast<char*>(base_) + from, get_page_size()));
+        madvise(begin, static_cast<size_t>((static_cast<char*>(base_) + to) - begin), MADV_WILLNEED);
+    }
+    return status;
 }
 
 apr_status_t MemoryMappedFile::flush(size_t from, size_t to) {
-    void* p = align_to_page(static_cast<char*>(mmap_->mm) + from, get_page_size());
-    size_t len = to - from;
+    if (from >= to) {
+        return AKU_SUCCESS;
+    }
+    if (direct_io_) {
+        auto status = write_range(from, to);
+        if (status != APR_SUCCESS) {
+            std::stringstream err;
+            err << "Can't write to " << path_ << ", error " << apr_error_message(status);
+            (*logger_)(AKU_LOG_ERROR, err.str().c_str());
+            return AKU_EGENERAL;
+        }
+        return AKU_SUCCESS;
+    }
+    char* begin = static_cast<char*>(base_) + from;
+    char* p = static_cast<char*>(align_to_page(begin, get_page_size()));
+    // length should include the gap between page boundary and `from`
+    size_t len = (to - from) + static_cast<size_t>(begin - p);
     if (msync(p, len, MS_SYNC) == 0) {
         return AKU_SUCCESS;
     }
@@ -297,6 +424,241 @@ void prefetch_mem(const void* ptr, size_t mem_size) {
     }
 }
 
+void readahead_mem(const void* ptr, size_t mem_size) {
+    auto begin = static_cast<const char*>(align_to_page(ptr, get_page_size()));
+    auto end = static_cast<const char*>(ptr) + mem_size;
+    // Errors are ignored, this is only a hint
+    madvise(const_cast<char*>(begin), static_cast<size_t>(end - begin), MADV_WILLNEED);
+}
+
+void release_mem(const void* ptr, size_t mem_size) {
+#ifdef MADV_COLD
+    // Only pages that completely belongs to the range are affected
+    auto page_size = get_page_size();
+    auto begin = static_cast<const char*>(align_to_page(static_cast<const char*>(ptr) + page_size - 1, page_size));
+    auto end = static_cast<const char*>(align_to_page(static_cast<const char*>(ptr) + mem_size, page_size));
+    if (begin < end) {
+        madvise(const_cast<char*>(begin), static_cast<size_t>(end - begin), MADV_COLD);
+    }
+#else
+    AKU_UNUSED(ptr);
+    AKU_UNUSED(mem_size);
+#endif
+}
+
+//                      //
+//    Huge page arena   //
+//                      //
+
+HugePageArena::HugePageArena()
+    : base_(nullptr)
+    , end_(nullptr)
+    , top_(nullptr)
+    , hugetlb_(true)
+    , released_(0u)
+{
+    std::fill(free_lists_, free_lists_ + NCLASSES, nullptr);
+}
+
+HugePageArena& HugePageArena::instance() {
+    static HugePageArena* arena = new HugePageArena();
+    return *arena;
+}
+
+aku_Status HugePageArena::enable() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (base_.load() != nullptr) {
+        return AKU_SUCCESS;
+    }
+    // Address space is reserved but not committed, extra region is needed for alignment
+    void* addr = mmap(nullptr, RESERVE_SIZE + REGION_SIZE, PROT_NONE,
+                      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        return AKU_ENO_MEM;
+    }
+    auto aligned = (reinterpret_cast<uintptr_t>(addr) + REGION_SIZE - 1) & ~(REGION_SIZE - 1);
+    top_ = reinterpret_cast<char*>(aligned);
+    end_.store(top_ + RESERVE_SIZE);
+    base_.store(top_);  // should be the last one, non-null base_ means that arena is enabled
+    return AKU_SUCCESS;
+}
+
+bool HugePageArena::is_enabled() const {
+    return base_.load() != nullptr;
+}
+
+bool HugePageArena::owns(const void* ptr) const {
+    auto p = static_cast<const char*>(ptr);
+    auto base = base_.load();
+    return base != nullptr && p >= base && p < end_.load();
+}
+
+size_t HugePageArena::committed() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto base = base_.load();
+    return base == nullptr ? 0u : static_cast<size_t>(top_ - base) - released_;
+}
+
+int HugePageArena::size_class_(size_t size) {
+    int cls = 0;
+    size_t block_size = MIN_BLOCK_SIZE;
+    while (block_size < size) {
+        block_size <<= 1;
+        cls++;
+    }
+    return cls;
+}
+
+char* HugePageArena::commit_(size_t size) {
+    if (static_cast<size_t>(end_.load() - top_) < size) {
+        return nullptr;
+    }
+    char* addr = top_;
+    if (!map_(addr, size)) {
+        return nullptr;
+    }
+    top_ += size;
+    return addr;
+}
+
+bool HugePageArena::map_(char* addr, size_t size) {
+    void* res = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugetlb_) {
+        // Anonymous hugetlb mapping fails before the reserved range is touched
+        // if there is not enough huge pages in the pool.
+        res = mmap(addr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_HUGETLB, -1, 0);
+        if (res == MAP_FAILED) {
+            // Huge pages are not configured or exhausted, don't try again
+            hugetlb_ = false;
+        }
+    }
+#endif
+    if (res == MAP_FAILED) {
+        res = mmap(addr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+        if (res == MAP_FAILED) {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        // Errors are ignored, this is only a hint
+        madvise(addr, size, MADV_HUGEPAGE);
+#endif
+    }
+    return true;
+}
+
+void HugePageArena::unmap_(char* addr, size_t size) {
+    // New mapping replaces the old one and releases its memory (hugetlb pages are
+    // returned to the pool), errors are ignored - range stays committed in this case
+    mmap(addr, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_NORESERVE, -1, 0);
+}
+
+void HugePageArena::insert_span_(char* addr, size_t size) {
+    free_spans_.insert(std::make_pair(addr, size));
+    spans_by_size_.insert(std::make_pair(size, addr));
+}
+
+void HugePageArena::erase_span_(std::map<char*, size_t>::iterator it) {
+    auto range = spans_by_size_.equal_range(it->second);
+    for (auto i = range.first; i != range.second; i++) {
+        if (i->second == it->first) {
+            spans_by_size_.erase(i);
+            break;
+        }
+    }
+    free_spans_.erase(it);
+}
+
+void* HugePageArena::allocate(size_t size) {
+    if (is_enabled()) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (size <= MAX_BLOCK_SIZE) {
+            int cls = size_class_(size);
+            if (free_lists_[cls] == nullptr) {
+                char* region = commit_(REGION_SIZE);
+                if (region != nullptr) {
+                    // Split region into blocks of the same size
+                    size_t block_size = MIN_BLOCK_SIZE << cls;
+                    for (size_t offset = REGION_SIZE; offset != 0;) {
+                        offset -= block_size;
+                        auto block = reinterpret_cast<FreeBlock*>(region + offset);
+                        block->next = free_lists_[cls];
+                        free_lists_[cls] = block;
+                    }
+                }
+            }
+            FreeBlock* block = free_lists_[cls];
+            if (block != nullptr) {
+                free_lists_[cls] = block->next;
+                return block;
+            }
+        } else {
+            size_t span = (size + REGION_SIZE - 1) & ~(REGION_SIZE - 1);
+            // Best fit, the rest of the free range stays free
+            auto it = spans_by_size_.lower_bound(span);
+            if (it != spans_by_size_.end()) {
+                char* addr = it->second;
+                size_t free_size = it->first;
+                if (map_(addr, span)) {
+                    erase_span_(free_spans_.find(addr));
+                    if (free_size > span) {
+                        insert_span_(addr + span, free_size - span);
+                    }
+                    released_ -= span;
+                    return addr;
+                }
+            }
+            char* addr = commit_(span);
+            if (addr != nullptr) {
+                return addr;
+            }
+        }
+    }
+    // Arena is disabled or exhausted
+    return ::operator new(size);
+}
+
+void HugePageArena::deallocate(void* ptr, size_t size) {
+    if (!owns(ptr)) {
+        ::operator delete(ptr);
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (size <= MAX_BLOCK_SIZE) {
+        int cls = size_class_(size);
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = free_lists_[cls];
+        free_lists_[cls] = block;
+    } else {
+        size_t span = (size + REGION_SIZE - 1) & ~(REGION_SIZE - 1);
+        char* addr = static_cast<char*>(ptr);
+        unmap_(addr, span);
+        released_ += span;
+        // Coalesce with adjacent free ranges
+        auto next = free_spans_.find(addr + span);
+        if (next != free_spans_.end()) {
+            span += next->second;
+            erase_span_(next);
+        }
+        auto prev = free_spans_.lower_bound(addr);
+        if (prev != free_spans_.begin()) {
+            --prev;
+            if (prev->first + prev->second == addr) {
+                addr = prev->first;
+                span += prev->second;
+                erase_span_(prev);
+            }
+        }
+        if (addr + span == top_) {
+            // Range at the top of the arena becomes uncommitted space again
+            top_ = addr;
+            released_ -= span;
+        } else {
+            insert_span_(addr, span);
+        }
+    }
+}
+
 static const unsigned char MINCORE_MASK = 1;
 
 PageInfo::PageInfo(const void* start_addr, size_t len_bytes)
@@ -27,6 +27,8 @@
 #include <stdexcept>
 #include <ostream>
 #include <atomic>
+#include <mutex>
+#include <map>
 #include <vector>
 #include <tuple>
 #include <random>
@@ -71,6 +73,10 @@ namespace Akumuli
 
     /** Memory mapped file
       * maps all file on construction
+      * @note In direct I/O mode file is mapped privately (copy-on-write) and changes are
+      * written to disk explicitly by `flush` using aligned `pwrite` calls (with O_DIRECT
+      * if file system supports it). Written pages are released and mapped to the file again,
+      * so mapping can be used for reading as usual.
       */
     class MemoryMappedFile
     {
@@ -82,8 +88,12 @@ namespace Akumuli
         std::string path_;
         aku_logger_cb_t logger_;
         const bool enable_huge_tlb_;
+        const bool direct_io_;  //< Direct I/O mode
+        void* base_;            //< Pointer to mapped memory
+        size_t size_;           //< Size of the mapping
+        int write_fd_;          //< File descriptor used for writing in direct I/O mode
     public:
-        MemoryMappedFile(const char* file_name, bool enable_huge_tlb, aku_logger_cb_t logger);
+        MemoryMappedFile(const char* file_name, bool enable_huge_tlb, aku_logger_cb_t logger, bool direct_io = false);
         ~MemoryMappedFile();
         void move_file(const char* new_name);
         void delete_file();
@@ -93,6 +103,8 @@ namespace Akumuli
         apr_status_t flush(size_t from, size_t to);
         //! Flush full page
         apr_status_t flush();
+        //! Allocate disk space for the range of the (sparse) file
+        apr_status_t preallocate(size_t from, size_t to);
         bool is_bad() const;
         std::string error_message() const;
         void panic_if_bad();
@@ -102,6 +114,10 @@ namespace Akumuli
     private:
         //! Map file into virtual address space
         apr_status_t map_file();
+        //! Map file privately (direct I/O mode)
+        apr_status_t map_private();
+        //! Write range to file in direct I/O mode
+        apr_status_t write_range(size_t from, size_t to);
         //! Free OS resources associated with object
         void free_resources(int cnt);
     };
@@ -119,6 +135,121 @@ namespace Akumuli
 
     void prefetch_mem(const void* ptr, size_t mem_size);
 
+    //! Start asynchronous readahead of the memory range (doesn't block)
+    void readahead_mem(const void* ptr, size_t mem_size);
+
+    //! Mark pages of the memory range as cold, they will be reclaimed first (no-op if not supported)
+    void release_mem(const void* ptr, size_t mem_size);
+
+    /** Process wide memory arena backed by huge pages.
+      * Arena reserves large range of the address space and commits it by 2MB regions
+      * using anonymous MAP_HUGETLB mappings. If huge pages are not configured in the
+      * system, regular anonymous mapping is used and transparent huge pages are
+      * requested using madvise. Small allocations are served from per size class
+      * free lists (memory of small blocks is never returned to OS), large ones occupy
+      * whole regions. Freed large allocations are returned to OS, their address ranges
+      * are coalesced with adjacent free ranges and reused (best fit, split if larger
+      * than needed).
+      * Arena is disabled by default (until `enable` is called), in this case all
+      * allocations are forwarded to global operator new.
+      */
+    class HugePageArena {
+    public:
+        //! Size of the huge page
+        static const size_t REGION_SIZE = 0x200000;
+        //! Smallest size class
+        static const size_t MIN_BLOCK_SIZE = 0x40;
+        //! Largest size class, larger allocations occupy whole regions
+        static const size_t MAX_BLOCK_SIZE = REGION_SIZE / 2;
+        //! Reserved address space (allocations are forwarded to operator new when exhausted)
+        static const size_t RESERVE_SIZE = 0x1000000000ul;
+    private:
+        static const int NCLASSES = 15;  // 64B, 128B, ..., 1MB
+
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        mutable std::mutex          mutex_;
+        std::atomic<char*>          base_;      //< Beginning of the reserved range
+        std::atomic<char*>          end_;       //< End of the reserved range
+        char*                       top_;       //< Beginning of the uncommitted space
+        bool                        hugetlb_;   //< False if MAP_HUGETLB doesn't work
+        FreeBlock*                  free_lists_[NCLASSES];
+        std::map<char*, size_t>     free_spans_;        //< Released address ranges (by address)
+        std::multimap<size_t, char*> spans_by_size_;    //< Released address ranges (by size)
+        size_t                      released_;          //< Size of the released address ranges
+
+        HugePageArena();
+
+        //! Commit `size` bytes at the top of the arena (should be called under lock)
+        char* commit_(size_t size);
+
+        //! Map memory to the reserved address range
+        bool map_(char* addr, size_t size);
+
+        //! Return memory to OS, address range stays reserved
+        void unmap_(char* addr, size_t size);
+
+        void insert_span_(char* addr, size_t size);
+
+        void erase_span_(std::map<char*, size_t>::iterator it);
+
+        static int size_class_(size_t size);
+    public:
+        //! Get arena instance (it's never destroyed, memory can be freed by static d-tors)
+        static HugePageArena& instance();
+
+        /** Reserve address space and start serving allocations.
+          * @returns AKU_SUCCESS or AKU_ENO_MEM if address space can't be reserved
+          */
+        aku_Status enable();
+
+        bool is_enabled() const;
+
+        //! Check if memory block was allocated inside the arena
+        bool owns(const void* ptr) const;
+
+        //! Get amount of memory committed by the arena (in bytes)
+        size_t committed() const;
+
+        void* allocate(size_t size);
+
+        //! Free memory block (`size` should be equal to the size passed to `allocate`)
+        void deallocate(void* ptr, size_t size);
+    };
+
+    /** Standard allocator that uses HugePageArena.
+      * Can be used with std containers that hold hot data.
+      */
+    template<class T>
+    struct HugePageAllocator {
+        typedef T value_type;
+
+        HugePageAllocator() {}
+
+        template<class U>
+        HugePageAllocator(HugePageAllocator<U> const&) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(HugePageArena::instance().allocate(n*sizeof(T)));
+        }
+
+        void deallocate(T* ptr, size_t n) {
+            HugePageArena::instance().deallocate(ptr, n*sizeof(T));
+        }
+    };
+
+    template<class T, class U>
+    bool operator == (HugePageAllocator<T> const&, HugePageAllocator<U> const&) {
+        return true;
+    }
+
+    template<class T, class U>
+    bool operator != (HugePageAllocator<T> const&, HugePageAllocator<U> const&) {
+        return false;
+    }
+
     /** Wrapper for mincore syscall.
      * If everything is OK works as simple wrapper
      * (memory needed for mincore syscall managed by wrapper itself).
@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "wal.h"
+
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Akumuli {
+
+namespace {
+
+//! Record header, blob payload follows the header
+struct RecordHeader {
+    uint32_t        checksum;   //< Checksum of the record (without this field)
+    uint32_t        length;     //< Payload length (0 for numeric values)
+    uint32_t        type;       //< TimeSeriesValue::ValueType
+    aku_ParamId     paramid;
+    aku_Timestamp   timestamp;
+    double          value;
+} __attribute__((packed));
+
+//! FNV-1a hash
+uint32_t checksum(const char* begin, const char* end, uint32_t hash = 2166136261u) {
+    for (const char* it = begin; it != end; it++) {
+        hash ^= static_cast<unsigned char>(*it);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t record_checksum(RecordHeader const& header, const char* payload) {
+    auto begin = reinterpret_cast<const char*>(&header) + sizeof(header.checksum);
+    auto end = reinterpret_cast<const char*>(&header) + sizeof(RecordHeader);
+    auto hash = checksum(begin, end);
+    return checksum(payload, payload + header.length, hash);
+}
+
+//! Write the whole buffer to file
+bool write_all(int fd, const char* data, size_t size) {
+    while (size) {
+        auto nwritten = ::write(fd, data, size);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += nwritten;
+        size -= static_cast<size_t>(nwritten);
+    }
+    return true;
+}
+
+//! Read the whole file to memory
+bool read_file(std::string const& path, std::vector<char>* output) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char buffer[0x10000];
+    while (true) {
+        auto nread = ::read(fd, buffer, sizeof(buffer));
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            return false;
+        }
+        if (nread == 0) {
+            break;
+        }
+        output->insert(output->end(), buffer, buffer + nread);
+    }
+    ::close(fd);
+    return true;
+}
+
+}  // namespace
+
+
+WriteAheadLog::WriteAheadLog(std::string base_path, uint32_t fsync_interval, aku_logger_cb_t logger)
+    : base_path_(base_path)
+    , fsync_interval_(fsync_interval)
+    , logger_(logger)
+    , fd_(-1)
+    , current_size_(0u)
+    , next_id_(0u)
+    , dirty_(false)
+{
+    namespace fs = boost::filesystem;
+    // Find segments created by previous run
+    fs::path base(base_path_);
+    fs::path dir = base.parent_path();
+    if (dir.empty()) {
+        dir = fs::current_path();
+    }
+    std::string prefix = base.filename().string() + ".";
+    boost::system::error_code error;
+    for (fs::directory_iterator it(dir, error), end; !error && it != end; it.increment(error)) {
+        std::string name = it->path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        uint64_t id = 0u;
+        try {
+            id = boost::lexical_cast<uint64_t>(name.substr(prefix.size()));
+        } catch (boost::bad_lexical_cast const&) {
+            continue;
+        }
+        // Timestamps of the old segments are unknown until replay
+        segments_.push_back({id, it->path().string(), AKU_MAX_TIMESTAMP});
+    }
+    segments_.sort([](Segment const& lhs, Segment const& rhs) { return lhs.id < rhs.id; });
+    if (!segments_.empty()) {
+        next_id_ = segments_.back().id + 1;
+    }
+    buffer_.reserve(BUFFER_SIZE);
+    last_sync_ = Clock::now();
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd_ >= 0) {
+        sync_();
+        close_segment_();
+    }
+}
+
+void WriteAheadLog::log_error_(const char* message, std::string const& path) const {
+    std::stringstream fmt;
+    fmt << "WAL: " << message << " " << path << ", " << std::strerror(errno);
+    (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+}
+
+aku_Status WriteAheadLog::replay(Callback const& cb) {
+    std::vector<char> data;
+    for (auto& segment: segments_) {
+        data.clear();
+        if (!read_file(segment.path, &data)) {
+            log_error_("can't read segment", segment.path);
+            return AKU_EGENERAL;
+        }
+        segment.max_timestamp = AKU_MIN_TIMESTAMP;
+        const char* it = data.data();
+        const char* end = data.data() + data.size();
+        while (static_cast<size_t>(end - it) >= sizeof(RecordHeader)) {
+            RecordHeader header;
+            memcpy(&header, it, sizeof(RecordHeader));
+            const char* payload = it + sizeof(RecordHeader);
+            if (static_cast<size_t>(end - payload) < header.length ||
+                record_checksum(header, payload) != header.checksum)
+            {
+                // Incomplete write, the rest of the segment can't be trusted
+                std::stringstream fmt;
+                fmt << "WAL: damaged record detected in " << segment.path;
+                (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+                break;
+            }
+            it = payload + header.length;
+
+            segment.max_timestamp = std::max(segment.max_timestamp, header.timestamp);
+            aku_MemRange range = {};
+            TimeSeriesValue value;
+            if (header.type == TimeSeriesValue::BLOB) {
+                range.address = const_cast<char*>(payload);
+                range.length = header.length;
+                value = TimeSeriesValue(header.timestamp, header.paramid, 0u, header.length);
+            } else {
+                value = TimeSeriesValue(header.timestamp, header.paramid, header.value);
+            }
+            auto status = cb(value, range);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status WriteAheadLog::open_segment_() {
+    std::stringstream fmt;
+    fmt << base_path_ << "." << next_id_;
+    current_ = {next_id_++, fmt.str(), AKU_MIN_TIMESTAMP};
+    fd_ = ::open(current_.path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+    if (fd_ < 0) {
+        log_error_("can't create segment", current_.path);
+        return AKU_EGENERAL;
+    }
+    current_size_ = 0u;
+    // Directory entry of the new segment should be durable too
+    auto dir = boost::filesystem::path(current_.path).parent_path();
+    int dirfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (dirfd >= 0) {
+        ::fsync(dirfd);
+        ::close(dirfd);
+    }
+    return AKU_SUCCESS;
+}
+
+void WriteAheadLog::close_segment_() {
+    ::close(fd_);
+    fd_ = -1;
+    std::lock_guard<std::mutex> guard(segments_lock_);
+    segments_.push_back(current_);
+}
+
+aku_Status WriteAheadLog::write_buffer_() {
+    if (buffer_.empty()) {
+        return AKU_SUCCESS;
+    }
+    if (!write_all(fd_, buffer_.data(), buffer_.size())) {
+        log_error_("can't write to segment", current_.path);
+        return AKU_EGENERAL;
+    }
+    current_size_ += buffer_.size();
+    buffer_.clear();
+    dirty_ = true;
+    return AKU_SUCCESS;
+}
+
+aku_Status WriteAheadLog::append(TimeSeriesValue const& value, aku_MemRange data) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (fd_ < 0) {
+        auto status = open_segment_();
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+
+    RecordHeader header;
+    header.type = value.type_;
+    header.paramid = value.get_paramid();
+    header.timestamp = value.get_timestamp();
+    if (value.is_blob()) {
+        header.length = data.length;
+        header.value = 0.0;
+    } else {
+        header.length = 0u;
+        header.value = value.payload.value;
+        data.address = nullptr;
+    }
+    const char* payload = static_cast<const char*>(data.address);
+    header.checksum = record_checksum(header, payload);
+
+    auto hptr = reinterpret_cast<const char*>(&header);
+    buffer_.insert(buffer_.end(), hptr, hptr + sizeof(RecordHeader));
+    buffer_.insert(buffer_.end(), payload, payload + header.length);
+    current_.max_timestamp = std::max(current_.max_timestamp, header.timestamp);
+
+    aku_Status status = AKU_SUCCESS;
+    if (buffer_.size() >= BUFFER_SIZE) {
+        status = write_buffer_();
+    }
+    if (status == AKU_SUCCESS && Clock::now() - last_sync_ >= fsync_interval_) {
+        // Group commit, all records accumulated since the last fsync are synced at once
+        status = sync_();
+    }
+    if (status == AKU_SUCCESS && current_size_ >= SEGMENT_SIZE) {
+        status = sync_();
+        close_segment_();
+    }
+    return status;
+}
+
+aku_Status WriteAheadLog::sync() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return sync_();
+}
+
+aku_Status WriteAheadLog::sync_if_stale() {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (fd_ < 0 || (buffer_.empty() && !dirty_) || Clock::now() - last_sync_ < fsync_interval_) {
+        return AKU_SUCCESS;
+    }
+    return sync_();
+}
+
+aku_Status WriteAheadLog::sync_() {
+    if (fd_ < 0) {
+        return AKU_SUCCESS;
+    }
+    auto status = write_buffer_();
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    if (dirty_) {
+        if (::fdatasync(fd_) != 0) {
+            log_error_("fsync failed", current_.path);
+            return AKU_EGENERAL;
+        }
+        dirty_ = false;
+    }
+    last_sync_ = Clock::now();
+    return AKU_SUCCESS;
+}
+
+void WriteAheadLog::truncate(aku_Timestamp durable) {
+    std::lock_guard<std::mutex> guard(segments_lock_);
+    while (!segments_.empty() && segments_.front().max_timestamp <= durable) {
+        if (::unlink(segments_.front().path.c_str()) != 0) {
+            log_error_("can't remove segment", segments_.front().path);
+        }
+        segments_.pop_front();
+    }
+}
+
+void WriteAheadLog::reset() {
+    std::lock_guard<std::mutex> guard(lock_);
+    buffer_.clear();
+    dirty_ = false;
+    if (fd_ >= 0) {
+        close_segment_();
+    }
+    truncate(AKU_MAX_TIMESTAMP);
+}
+
+}  // namespace
@@ -0,0 +1,128 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Write-ahead log for the sequencer data.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+#include "akumuli.h"
+#include "akumuli_def.h"
+#include "sequencer.h"
+
+namespace Akumuli {
+
+/** Write-ahead log.
+  * @brief Append-only log of the samples accepted by the sequencer. Samples are
+  * stored in memory until they are compressed and synced to the page, log makes
+  * them durable using sequential writes. Records are accumulated in the buffer and
+  * written to disk in groups (group commit), log file is fsync-ed at most once per
+  * `fsync_interval` milliseconds (each write is synced if interval is zero).
+  * Log consists of segments (`<base_path>.<N>`), segment can be removed when all its
+  * records are synced to the page.
+  * @note Records should be added by one thread, `sync_if_stale` and `truncate` can be
+  * called from another thread.
+  */
+class WriteAheadLog {
+public:
+    //! Replay callback, receives sample and blob payload (empty range for numeric values)
+    typedef std::function<aku_Status(TimeSeriesValue const&, aku_MemRange)> Callback;
+
+    //! Max segment size, new segment is created when current one gets larger
+    static const size_t SEGMENT_SIZE = 0x4000000;
+
+    //! Write buffer size
+    static const size_t BUFFER_SIZE = 0x10000;
+
+private:
+    struct Segment {
+        uint64_t        id;
+        std::string     path;
+        aku_Timestamp   max_timestamp;  //< Largest timestamp in the segment
+    };
+
+    typedef std::chrono::steady_clock   Clock;
+
+    const std::string           base_path_;
+    const std::chrono::milliseconds fsync_interval_;
+    aku_logger_cb_t             logger_;
+    std::list<Segment>          segments_;      //< Complete segments (oldest first)
+    std::mutex                  segments_lock_; //< Guards segments_
+    std::mutex                  lock_;          //< Guards current segment and write buffer
+    int                         fd_;            //< Current segment or -1
+    Segment                     current_;       //< Current segment
+    size_t                      current_size_;  //< Current segment size
+    uint64_t                    next_id_;       //< Id of the next segment
+    std::vector<char>           buffer_;        //< Write buffer
+    Clock::time_point           last_sync_;     //< Time of the last fsync
+    bool                        dirty_;         //< True if there is data that wasn't fsync-ed
+
+    aku_Status open_segment_();
+    aku_Status write_buffer_();
+    aku_Status sync_();
+    void close_segment_();
+    void log_error_(const char* message, std::string const& path) const;
+
+public:
+    /** C-tor
+      * @param base_path is a path prefix of the segment files
+      * @param fsync_interval is a max interval between fsync calls in milliseconds
+      * @param logger is a logger callback
+      */
+    WriteAheadLog(std::string base_path, uint32_t fsync_interval, aku_logger_cb_t logger);
+
+    ~WriteAheadLog();
+
+    WriteAheadLog(WriteAheadLog const&) = delete;
+    WriteAheadLog& operator = (WriteAheadLog const&) = delete;
+
+    /** Read all segments that exists on disk and pass their records to callback.
+      * Should be called before first `append`. Rest of the segment is skipped if
+      * damaged record (incomplete write) is found.
+      * @returns AKU_SUCCESS or first error returned by callback
+      */
+    aku_Status replay(Callback const& cb);
+
+    //! Add sample to log (data is used only if value is blob)
+    aku_Status append(TimeSeriesValue const& value, aku_MemRange data);
+
+    //! Write buffered records and fsync current segment
+    aku_Status sync();
+
+    /** Sync buffered records if the last fsync was performed more than `fsync_interval`
+      * ago. Should be called periodically, otherwise records are synced only by `append`
+      * and can stay in the buffer indefinitely when writes stop.
+      */
+    aku_Status sync_if_stale();
+
+    /** Remove complete segments that doesn't contain records newer than `durable`.
+      * @param durable is a largest timestamp durably stored in the page
+      */
+    void truncate(aku_Timestamp durable);
+
+    //! Remove all segments (everything is durably stored in the pages)
+    void reset();
+};
+
+}  // namespace
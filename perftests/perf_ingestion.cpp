@@ -118,7 +118,13 @@ void print_storage_stats(aku_StorageStats& ss) {
     std::cout << ss.n_entries << " elenents in" << std::endl
               << ss.n_volumes << " volumes with" << std::endl
               << ss.used_space << " bytes used and" << std::endl
-              << ss.free_space << " bytes free" << std::endl;
+              << ss.free_space << " bytes free" << std::endl
+              << "Chunk cache" << std::endl
+              << ss.cache.n_hits << " hits" << std::endl
+              << ss.cache.n_misses << " misses" << std::endl
+              << ss.cache.n_evictions << " evictions" << std::endl
+              << ss.cache.n_rejected << " rejected" << std::endl
+              << ss.cache.size << " bytes used" << std::endl;
 }
 
 void print_search_stats(aku_SearchStats& ss) {
@@ -204,7 +210,7 @@ int main(int cnt, const char** args)
         uint64_t windowsize = 100000;
         uint64_t cachesize =  10*1024*1024;  // 10Mb
         apr_status_t result = aku_create_database(DB_NAME, DB_PATH, DB_PATH, DB_SIZE,
-                                                  threshold, windowsize, cachesize, &logger_);
+                                                  threshold, windowsize, cachesize, 0, &logger_);
         if (result != APR_SUCCESS) {
             std::cout << "Error in new_storage" << std::endl;
             return (int)result;
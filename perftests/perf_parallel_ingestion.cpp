@@ -35,7 +35,13 @@ void print_storage_stats(aku_StorageStats& ss) {
     std::cout << ss.n_entries << " elements in" << std::endl
               << ss.n_volumes << " volumes with" << std::endl
               << ss.used_space << " bytes used and" << std::endl
-              << ss.free_space << " bytes free" << std::endl;
+              << ss.free_space << " bytes free" << std::endl
+              << "Chunk cache" << std::endl
+              << ss.cache.n_hits << " hits" << std::endl
+              << ss.cache.n_misses << " misses" << std::endl
+              << ss.cache.n_evictions << " evictions" << std::endl
+              << ss.cache.n_rejected << " rejected" << std::endl
+              << ss.cache.size << " bytes used" << std::endl;
 }
 
 void print_search_stats(aku_SearchStats& ss) {
@@ -220,7 +226,7 @@ int main(int cnt, const char** args)
     delete_storage();
 
     // Create database
-    apr_status_t result = aku_create_database(DB_NAME, DB_PATH, DB_PATH, DB_SIZE, 0, 0, 0, nullptr);
+    apr_status_t result = aku_create_database(DB_NAME, DB_PATH, DB_PATH, DB_SIZE, 0, 0, 0, 0, nullptr);
     if (result != APR_SUCCESS) {
         std::cout << "Error in new_storage" << std::endl;
         return (int)result;
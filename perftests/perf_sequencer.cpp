@@ -60,9 +60,100 @@ struct BufferedCursor : InternalCursor {
 };
 
 
+//! Query processor node that counts samples and checks their order
+struct CountingNode : QP::Node {
+    size_t count;
+    aku_Timestamp last;
+    int direction;
+    bool ordered;
+
+    CountingNode(int dir)
+        : count(0)
+        , last(dir == AKU_CURSOR_DIR_FORWARD ? AKU_MIN_TIMESTAMP : AKU_MAX_TIMESTAMP)
+        , direction(dir)
+        , ordered(true)
+    {
+    }
+
+    void complete() {}
+
+    bool put(const aku_Sample &sample) {
+        ordered &= direction == AKU_CURSOR_DIR_FORWARD ? sample.timestamp >= last
+                                                       : sample.timestamp <= last;
+        last = sample.timestamp;
+        count++;
+        return true;
+    }
+
+    void set_error(aku_Status status) {
+        std::cout << "Error: " << aku_error_message(status) << std::endl;
+    }
+
+    NodeType get_type() const {
+        return Node::Mock;
+    }
+};
+
+/** K-way merge perf-test.
+  * Sequencer is filled with `nruns` interleaved sorted runs with `run_length` elements each
+  * and then merged using searchV2 (in both directions) and merge.
+  */
+int perf_kway_merge(uint32_t nruns, uint32_t run_length) {
+    std::cout << "Sequencer perf-test, k-way merge of " << nruns << " runs" << std::endl;
+    const uint64_t total = static_cast<uint64_t>(nruns)*run_length;
+    Sequencer seq(nullptr, {0, total + 1, 0});
+    for (uint32_t run = 0u; run < nruns; run++) {
+        for (uint32_t ix = 0u; ix < run_length; ix++) {
+            aku_Timestamp ts = static_cast<aku_Timestamp>(ix)*nruns + run;
+            TimeSeriesValue value(ts, run & 0xFF, static_cast<double>(ix));
+            int status = 0;
+            int lock = 0;
+            tie(status, lock) = seq.add(value);
+            if (status != AKU_SUCCESS || lock % 2 == 1) {
+                std::cout << "Unexpected checkpoint or error" << std::endl;
+                return -1;
+            }
+        }
+    }
+    std::vector<std::string> metrics;
+    for (int dir: {AKU_CURSOR_DIR_FORWARD, AKU_CURSOR_DIR_BACKWARD}) {
+        auto node = std::make_shared<CountingNode>(dir);
+        auto qproc = dir == AKU_CURSOR_DIR_FORWARD
+                   ? std::make_shared<QP::ScanQueryProcessor>(node, metrics, AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP)
+                   : std::make_shared<QP::ScanQueryProcessor>(node, metrics, AKU_MAX_TIMESTAMP, AKU_MIN_TIMESTAMP);
+        boost::timer timer;
+        seq.searchV2(qproc, seq.get_snapshot());
+        double elapsed = timer.elapsed();
+        if (node->count != total || !node->ordered) {
+            std::cout << "Error: invalid merge result" << std::endl;
+            return -1;
+        }
+        std::cout << (dir == AKU_CURSOR_DIR_FORWARD ? "searchV2 forward:  " : "searchV2 backward: ")
+                  << elapsed << "s, " << (total/elapsed/1000000.0) << " M samples/s" << std::endl;
+    }
+    seq.reset();
+    std::vector<aku_Sample> results(total);
+    BufferedCursor cursor(results.data(), results.size());
+    Caller caller;
+    boost::timer timer;
+    seq.merge(caller, &cursor);
+    double elapsed = timer.elapsed();
+    if (cursor.count != total) {
+        std::cout << "Error: invalid merge result" << std::endl;
+        return -1;
+    }
+    std::cout << "merge:             " << elapsed << "s, " << (total/elapsed/1000000.0) << " M samples/s" << std::endl;
+    return 0;
+}
+
 int main(int cnt, const char** args)
 {
     aku_initialize(nullptr);
+    for (uint32_t nruns: {2u, 16u, 128u, 1024u}) {
+        if (perf_kway_merge(nruns, 10*1000*1000/nruns) != 0) {
+            return -1;
+        }
+    }
     {
         std::cout << "Sequencer perf-test, ordered timestamps" << std::endl;
         // Patience sort perf-test
@@ -0,0 +1,167 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "buffer_cache.h"
+
+using namespace Akumuli;
+
+static std::shared_ptr<DecodedChunk> make_chunk(int nelements) {
+    UncompressedChunk chunk;
+    for (int i = 0; i < nelements; i++) {
+        ChunkValue value;
+        value.type = ChunkValue::FLOAT;
+        value.value.floatval = i;
+        chunk.timestamps.push_back(i);
+        chunk.paramids.push_back(i);
+        chunk.values.push_back(value);
+    }
+    return std::make_shared<DecodedChunk>(chunk);
+}
+
+//! Read item through cache the same way as page search does
+static bool read_through(ChunkCache& cache, ChunkCache::KeyT key) {
+    if (cache.get(key)) {
+        return true;
+    }
+    cache.put(key, make_chunk(256));
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(Test_decoded_chunk) {
+    // Chunk order - two series, second one contains blobs
+    UncompressedChunk chunk;
+    for (int id = 1; id <= 2; id++) {
+        for (int i = 0; i < 100; i++) {
+            ChunkValue value;
+            if (id == 1) {
+                value.type = ChunkValue::FLOAT;
+                value.value.floatval = i*0.5;
+            } else {
+                value.type = ChunkValue::BLOB;
+                value.value.blobval.offset = i;
+                value.value.blobval.length = 10*i;
+            }
+            chunk.timestamps.push_back(i);
+            chunk.paramids.push_back(id);
+            chunk.values.push_back(value);
+        }
+    }
+    DecodedChunk decoded(chunk);
+    BOOST_REQUIRE_EQUAL(decoded.size(), 200u);
+    BOOST_REQUIRE(decoded.has_blobs());
+    // Time order
+    for (uint32_t i = 0; i < decoded.size(); i++) {
+        auto ts = decoded.timestamps()[i];
+        auto id = decoded.paramids()[i];
+        BOOST_REQUIRE_EQUAL(ts, i/2);
+        BOOST_REQUIRE_EQUAL(id, 1 + i%2);
+        if (id == 1) {
+            BOOST_REQUIRE(!decoded.is_blob(i));
+            BOOST_REQUIRE_EQUAL(decoded.get_float(i), ts*0.5);
+        } else {
+            BOOST_REQUIRE(decoded.is_blob(i));
+            BOOST_REQUIRE_EQUAL(decoded.get_blob(i).offset, ts);
+            BOOST_REQUIRE_EQUAL(decoded.get_blob(i).length, 10*ts);
+        }
+    }
+    // Range of float values (blobs are not counted)
+    BOOST_REQUIRE_EQUAL(decoded.min_value(), 0.0);
+    BOOST_REQUIRE_EQUAL(decoded.max_value(), 49.5);
+
+    // Malformed chunk
+    chunk.values.pop_back();
+    BOOST_REQUIRE_THROW(DecodedChunk bad(chunk), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(Test_chunk_cache_get_put) {
+    ChunkCache cache(0x100000);
+    auto key = std::make_tuple(1, 2);
+    BOOST_REQUIRE(!cache.contains(key));
+    BOOST_REQUIRE(!cache.get(key));
+    auto chunk = make_chunk(100);
+    cache.put(key, chunk);
+    BOOST_REQUIRE(cache.contains(key));
+    BOOST_REQUIRE_EQUAL(cache.get(key), chunk);
+    BOOST_REQUIRE(!cache.get(std::make_tuple(2, 1)));
+
+    size_t expected_size = sizeof(DecodedChunk) + 100*(sizeof(aku_Timestamp) + sizeof(aku_ParamId) + sizeof(double));
+    BOOST_REQUIRE_EQUAL(chunk->mem_size(), expected_size);
+    BOOST_REQUIRE_EQUAL(cache.size(), expected_size);
+
+    aku_StorageStats stats = {};
+    cache.get_stats(&stats);
+    BOOST_REQUIRE_EQUAL(stats.cache.n_hits, 1u);
+    BOOST_REQUIRE_EQUAL(stats.cache.n_misses, 2u);
+    BOOST_REQUIRE_EQUAL(stats.cache.size, expected_size);
+
+    // Replace
+    cache.put(key, make_chunk(10));
+    BOOST_REQUIRE_EQUAL(cache.get(key)->size(), 10u);
+    BOOST_REQUIRE(cache.size() < expected_size);
+}
+
+BOOST_AUTO_TEST_CASE(Test_chunk_cache_scan_resistance) {
+    const size_t LIMIT = 0x100000;
+    ChunkCache cache(LIMIT);
+    // Hot set
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8; i++) {
+            read_through(cache, std::make_tuple(0, i));
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        BOOST_REQUIRE(cache.contains(std::make_tuple(0, i)));
+    }
+    // Large scan, each chunk is read only once, hot set is still in use
+    for (int i = 0; i < 10000; i++) {
+        read_through(cache, std::make_tuple(1, i));
+        BOOST_REQUIRE(cache.size() <= LIMIT);
+        if (i % 100 == 0) {
+            for (int j = 0; j < 8; j++) {
+                BOOST_REQUIRE(read_through(cache, std::make_tuple(0, j)));
+            }
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        BOOST_REQUIRE(cache.contains(std::make_tuple(0, i)));
+    }
+    aku_StorageStats stats = {};
+    cache.get_stats(&stats);
+    BOOST_REQUIRE(stats.cache.n_rejected > 0);
+    BOOST_REQUIRE_EQUAL(stats.cache.n_hits, 24u + 800u);
+
+    // Chunk that is used often should be admitted
+    auto key = std::make_tuple(2, 0);
+    for (int i = 0; i < 10; i++) {
+        read_through(cache, key);
+    }
+    BOOST_REQUIRE(cache.contains(key));
+    cache.get_stats(&stats);
+    BOOST_REQUIRE(stats.cache.n_evictions > 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_chunk_cache_default_size) {
+    // Default cache size of the library and the value used by akumulid
+    size_t limits[] = { AKU_DEFAULT_MAX_CACHE_SIZE, 100000u };
+    for (auto limit: limits) {
+        ChunkCache cache(limit);
+        auto chunk = make_chunk(AKU_DEFAULT_COMPRESSION_THRESHOLD);
+        auto key = std::make_tuple(1, 1);
+        BOOST_REQUIRE(!cache.get(key));
+        cache.put(key, chunk);
+        BOOST_REQUIRE(cache.contains(key));
+        BOOST_REQUIRE(cache.size() <= limit);
+
+        // Chunks that are read only once should replace each other
+        for (int i = 2; i < 100; i++) {
+            auto next = std::make_tuple(1, i);
+            BOOST_REQUIRE(!cache.get(next));
+            cache.put(next, make_chunk(AKU_DEFAULT_COMPRESSION_THRESHOLD));
+            BOOST_REQUIRE(cache.contains(next));
+            BOOST_REQUIRE(cache.size() <= limit);
+        }
+    }
+}
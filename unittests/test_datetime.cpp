@@ -28,3 +28,16 @@ BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_conversion) {
     BOOST_REQUIRE_EQUAL(std::string(buffer), std::string(timestamp_str));
 
 }
+
+BOOST_AUTO_TEST_CASE(Test_duration_parsing) {
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("100"), 100u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("100ns"), 100u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("10us"), 10000u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("10ms"), 10000000u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("10s"), 10000000000u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("5m"), 300000000000u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("1h"), 3600000000000u);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("1d"), 86400000000000u);
+    BOOST_REQUIRE_THROW(DateTimeUtil::parse_duration("s"), std::exception);
+    BOOST_REQUIRE_THROW(DateTimeUtil::parse_duration("10x"), std::exception);
+}
@@ -3,6 +3,7 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
 #include <boost/test/unit_test.hpp>
+#include <sys/stat.h>
 #include <apr.h>
 
 #include "akumuli_def.h"
@@ -132,3 +133,138 @@ BOOST_AUTO_TEST_CASE(TestMmap4)
 
     delete_tmp_file(tmp_file);
 }
+
+BOOST_AUTO_TEST_CASE(TestMmap_direct_io)
+{
+    const char* tmp_file = "testfile";
+    const int size = 0x4000;
+    delete_tmp_file(tmp_file);
+    create_tmp_file(tmp_file, size);
+    {
+        MemoryMappedFile mmap(tmp_file, false, &test_logger, true);
+        BOOST_REQUIRE(mmap.is_bad() == false);
+        BOOST_REQUIRE(mmap.get_size() == size);
+        char* begin = (char*)mmap.get_pointer();
+        for (int i = 100; i < 0x3000; i++) {
+            begin[i] = static_cast<char>(i % 127);
+        }
+        begin[size - 1] = 42;  // not flushed
+        BOOST_REQUIRE_EQUAL(mmap.flush(100, 0x3000), AKU_SUCCESS);
+        // Written pages are still readable
+        for (int i = 100; i < 0x3000; i++) {
+            BOOST_REQUIRE_EQUAL(begin[i], static_cast<char>(i % 127));
+        }
+        BOOST_REQUIRE(begin[size - 1] == 42);
+    }
+
+    {
+        MemoryMappedFile mmap(tmp_file, false, &test_logger);
+        BOOST_REQUIRE(mmap.is_bad() == false);
+        char* begin = (char*)mmap.get_pointer();
+        for (int i = 100; i < 0x3000; i++) {
+            BOOST_REQUIRE_EQUAL(begin[i], static_cast<char>(i % 127));
+        }
+        // Changes are written to file only by flush
+        BOOST_REQUIRE(begin[size - 1] == 0);
+    }
+
+    delete_tmp_file(tmp_file);
+}
+
+BOOST_AUTO_TEST_CASE(TestMmap_preallocate)
+{
+    const char* tmp_file = "testfile";
+    const int size = 0x1000000;
+    const int range = 0x400000;
+    delete_tmp_file(tmp_file);
+    create_tmp_file(tmp_file, size);
+    {
+        MemoryMappedFile mmap(tmp_file, false, &test_logger);
+        BOOST_REQUIRE(mmap.is_bad() == false);
+        struct stat before;
+        BOOST_REQUIRE(stat(tmp_file, &before) == 0);
+        // File is sparse
+        BOOST_REQUIRE(before.st_blocks*512 < range);
+        auto status = mmap.preallocate(0x1000, 0x1000 + range);
+        if (status == APR_FROM_OS_ERROR(EOPNOTSUPP)) {
+            BOOST_MESSAGE("fallocate is not supported by file system");
+        } else {
+            BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+            struct stat after;
+            BOOST_REQUIRE(stat(tmp_file, &after) == 0);
+            BOOST_REQUIRE(after.st_blocks*512 >= range);
+            BOOST_REQUIRE_EQUAL(after.st_size, size);
+        }
+        // Content is not changed
+        char* begin = (char*)mmap.get_pointer();
+        for (int i = 0; i < size; i += 0x1000) {
+            BOOST_REQUIRE(begin[i] == 0);
+        }
+    }
+    delete_tmp_file(tmp_file);
+}
+
+BOOST_AUTO_TEST_CASE(Test_huge_page_arena)
+{
+    auto& arena = HugePageArena::instance();
+    // Memory allocated before the arena was enabled
+    std::vector<int, HugePageAllocator<int>> old_vec(100, 1);
+    BOOST_REQUIRE(arena.is_enabled() || !arena.owns(old_vec.data()));
+
+    BOOST_REQUIRE_EQUAL(arena.enable(), AKU_SUCCESS);
+    BOOST_REQUIRE(arena.is_enabled());
+
+    // Small allocations
+    void* a = arena.allocate(100);
+    void* b = arena.allocate(100);
+    BOOST_REQUIRE(arena.owns(a));
+    BOOST_REQUIRE(arena.owns(b));
+    BOOST_REQUIRE(std::abs(static_cast<char*>(a) - static_cast<char*>(b)) >= 128);
+    arena.deallocate(a, 100);
+    BOOST_REQUIRE_EQUAL(arena.allocate(120), a);  // same size class
+    arena.deallocate(a, 120);
+    arena.deallocate(b, 100);
+
+    // Large allocations
+    size_t large = HugePageArena::REGION_SIZE + 1;
+    void* c = arena.allocate(large);
+    BOOST_REQUIRE(arena.owns(c));
+    BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(c) % HugePageArena::REGION_SIZE, 0u);
+    memset(c, 0xFF, large);
+    auto committed = arena.committed();
+    arena.deallocate(c, large);
+    BOOST_REQUIRE_EQUAL(arena.committed(), committed - 2*HugePageArena::REGION_SIZE);
+    BOOST_REQUIRE_EQUAL(arena.allocate(large), c);
+    BOOST_REQUIRE_EQUAL(arena.committed(), committed);
+    arena.deallocate(c, large);
+
+    // Freed ranges are coalesced and split
+    const size_t region = HugePageArena::REGION_SIZE;
+    char* d = static_cast<char*>(arena.allocate(2*region));
+    char* e = static_cast<char*>(arena.allocate(2*region));
+    void* guard = arena.allocate(region);  // prevents merging with the top of the arena
+    BOOST_REQUIRE_EQUAL(e, d + 2*region);
+    committed = arena.committed();
+    arena.deallocate(e, 2*region);
+    arena.deallocate(d, 2*region);
+    BOOST_REQUIRE_EQUAL(arena.committed(), committed - 4*region);
+    char* f = static_cast<char*>(arena.allocate(3*region));
+    char* g = static_cast<char*>(arena.allocate(region));
+    BOOST_REQUIRE_EQUAL(f, d);
+    BOOST_REQUIRE_EQUAL(g, d + 3*region);
+    memset(f, 0xFF, 3*region);
+    BOOST_REQUIRE_EQUAL(arena.committed(), committed);
+    arena.deallocate(f, 3*region);
+    arena.deallocate(g, region);
+    arena.deallocate(guard, region);
+
+    // Containers
+    std::vector<int, HugePageAllocator<int>> vec;
+    for (int i = 0; i < 1000000; i++) {
+        vec.push_back(i);
+    }
+    BOOST_REQUIRE(arena.owns(vec.data()));
+    BOOST_REQUIRE_EQUAL(vec[999999], 999999);
+    old_vec.resize(1000, 2);  // frees memory allocated by operator new
+    BOOST_REQUIRE(arena.owns(old_vec.data()));
+}
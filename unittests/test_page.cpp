@@ -23,6 +23,12 @@ struct AkumuliInitializer {
 
 namespace {
 
+void logger_stub(int level, const char* msg) {
+    if (level == AKU_LOG_ERROR) {
+        BOOST_MESSAGE(msg);
+    }
+}
+
 /** Simple cursor implementation for testing.
   * Stores all values in std::vector.
   */
@@ -167,6 +173,40 @@ BOOST_AUTO_TEST_CASE(TestPaging6)
     BOOST_CHECK_EQUAL(entry->param_id, 3333);
 }
 
+BOOST_AUTO_TEST_CASE(TestPaging_dirty_ranges)
+{
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 4096);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+    auto payload = page->get_payload_range(0u);
+    auto index = page->get_index_range(0u);
+    BOOST_CHECK_EQUAL(payload.first, payload.second);
+    BOOST_CHECK_EQUAL(index.first, index.second);
+    BOOST_CHECK_EQUAL(index.second, page_mem.size());
+
+    char buffer[100];
+    aku_MemRange range = {buffer, 100};
+    BOOST_REQUIRE_EQUAL(page->add_entry(1, 1, range), AKU_WRITE_STATUS_SUCCESS);
+    auto offset = page->get_next_offset();
+    BOOST_REQUIRE_EQUAL(page->add_entry(1, 2, range), AKU_WRITE_STATUS_SUCCESS);
+
+    // Everything
+    payload = page->get_payload_range(0u);
+    index = page->get_index_range(0u);
+    BOOST_CHECK_EQUAL(payload.first, sizeof(PageHeader));
+    BOOST_CHECK_EQUAL(payload.second, sizeof(PageHeader) + page->get_next_offset());
+    BOOST_CHECK_EQUAL(index.first, page_mem.size() - 2*sizeof(aku_EntryIndexRecord));
+    BOOST_CHECK_EQUAL(index.second, page_mem.size());
+
+    // Only second entry
+    payload = page->get_payload_range(offset);
+    index = page->get_index_range(1u);
+    BOOST_CHECK_EQUAL(payload.first, sizeof(PageHeader) + offset);
+    BOOST_CHECK_EQUAL(payload.second - payload.first, sizeof(aku_Entry) + 100);
+    BOOST_CHECK_EQUAL(index.first, page_mem.size() - 2*sizeof(aku_EntryIndexRecord));
+    BOOST_CHECK_EQUAL(index.second, page_mem.size() - sizeof(aku_EntryIndexRecord));
+}
+
 BOOST_AUTO_TEST_CASE(TestPaging7)
 {
     std::vector<char> page_mem;
@@ -512,6 +552,70 @@ BOOST_AUTO_TEST_CASE(Test_SingleParamCursor_search_range_large)
     }
 }
 
+BOOST_AUTO_TEST_CASE(Test_SingleParamCursor_search_with_sparse_index)
+{
+    const int                   buf_len = 1024*1024*8;
+    std::vector<char>           buffer(buf_len);
+    std::vector<aku_Timestamp>  timestamps;
+    aku_Timestamp               time_stamp = 0L;
+    PageHeader*                 page = new (&buffer[0]) PageHeader(0, buf_len, 0, 1);
+    SparseIndex                 index;
+
+    for(int i = 0; true; i++)
+    {
+        aku_MemRange range = {(void*)&i, sizeof(i)};
+        if(page->add_entry(1, time_stamp, range) == AKU_WRITE_STATUS_OVERFLOW) {
+            break;
+        }
+        timestamps.push_back(time_stamp);
+        if (i == 100000) {
+            // Index doesn't cover the tail of the page
+            index.update(page);
+        }
+        // skewed data with duplicates
+        time_stamp += (rand() % 16 == 0) ? rand() % 1000 : rand() % 2;
+    }
+    BOOST_REQUIRE(timestamps.size() > 2*100000);
+
+    auto search = [&](aku_Timestamp begin, aku_Timestamp end, int dir, SparseIndex const* pindex) {
+        auto recorder = std::make_shared<Recorder>(1u);
+        auto qproc = make_proc(recorder, begin, end, dir);
+        page->searchV2(qproc, std::shared_ptr<ChunkCache>(), ~0u, pindex);
+        std::vector<aku_Timestamp> result;
+        for (auto const& sample: recorder->cursor.results) {
+            result.push_back(sample.timestamp);
+        }
+        return result;
+    };
+
+    // Bounds are not known for entries added after the update
+    aku_Timestamp begin, end;
+    BOOST_REQUIRE(!index.get_bounds(page->get_entries_count(), &begin, &end));
+    BOOST_REQUIRE(index.get_bounds(100001u, &begin, &end));
+    BOOST_REQUIRE_EQUAL(begin, timestamps.front());
+    BOOST_REQUIRE_EQUAL(end, timestamps.at(100000));
+
+    for (int round = 0; round < 100; round++) {
+        if (round == 50) {
+            index.update(page);
+            BOOST_REQUIRE(index.get_bounds(page->get_entries_count(), &begin, &end));
+            BOOST_REQUIRE_EQUAL(end, timestamps.back());
+        }
+        int dir = (rand() & 1) ? AKU_CURSOR_DIR_FORWARD : AKU_CURSOR_DIR_BACKWARD;
+        aku_Timestamp begin = timestamps.at(rand() % timestamps.size()) + rand() % 2;
+        aku_Timestamp end = begin + rand() % 10000;
+        auto expected = search(begin, end, dir, nullptr);
+        auto actual = search(begin, end, dir, &index);
+        BOOST_REQUIRE(expected == actual);
+        // All duplicates of the boundary timestamps should be found
+        size_t nmatches = 0;
+        for (auto ts: timestamps) {
+            nmatches += (ts >= begin && ts <= end) ? 1 : 0;
+        }
+        BOOST_REQUIRE_EQUAL(actual.size(), nmatches);
+    }
+}
+
 
 void generic_compression_test
     ( aku_ParamId param_id
@@ -631,3 +735,183 @@ BOOST_AUTO_TEST_CASE(Test_Compression_backward_0) {
 BOOST_AUTO_TEST_CASE(Test_Compression_backward_1) {
     generic_compression_test(1u, 0ul, AKU_CURSOR_DIR_BACKWARD, 100);
 }
+
+void value_filter_test(int dir) {
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x10000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+
+    // Two chunks, values of the first one are in [0, 100) range, values of
+    // the second one - in [1000, 1100) range
+    aku_Timestamp ts = 100u;
+    for (int chunk = 0; chunk < 2; chunk++) {
+        UncompressedChunk header;
+        for (int i = 0; i < 100; i++) {
+            ChunkValue value;
+            value.type = ChunkValue::FLOAT;
+            value.value.floatval = chunk*1000 + i;
+            header.values.push_back(value);
+            header.paramids.push_back(1u);
+            header.timestamps.push_back(ts++);
+        }
+        BOOST_REQUIRE_EQUAL(page->complete_chunk(header), AKU_SUCCESS);
+    }
+
+    auto cache = std::make_shared<ChunkCache>(0x100000);
+    QP::ValueFilter filter;
+    filter.lowerbound = 1050;
+    filter.lower_inclusive = false;
+    for (int pass = 0; pass < 2; pass++) {
+        // Second pass reads decoded chunks from cache
+        auto recorder = std::make_shared<Recorder>(1u);
+        std::vector<std::string> m;
+        aku_Timestamp begin = dir == AKU_CURSOR_DIR_FORWARD ? 0u : 1000u;
+        aku_Timestamp end = dir == AKU_CURSOR_DIR_FORWARD ? 1000u : 0u;
+        auto qproc = std::make_shared<QP::ScanQueryProcessor>(recorder, m, begin, end,
+                                                              std::make_shared<QP::ValueFilter>(filter));
+        page->searchV2(qproc, cache);
+        auto const& results = recorder->cursor.results;
+        BOOST_REQUIRE_EQUAL(results.size(), 49u);
+        for (size_t i = 0; i < results.size(); i++) {
+            double expected = dir == AKU_CURSOR_DIR_FORWARD ? 1051 + i : 1099 - i;
+            BOOST_REQUIRE_EQUAL(results[i].payload.value.float64, expected);
+        }
+    }
+
+    // Value range of the chunk is stored in chunk descriptor
+    auto entry = page->read_entry_at(0);
+    BOOST_REQUIRE_EQUAL(entry->length, sizeof(CompressedChunkDesc));
+    auto desc = reinterpret_cast<CompressedChunkDesc const*>(&entry->value[0]);
+    BOOST_REQUIRE_EQUAL(desc->min_value, 0.0);
+    BOOST_REQUIRE_EQUAL(desc->max_value, 99.0);
+
+    // First chunk shouldn't be decoded (it's damaged now and can't pass checksum test)
+    auto data = const_cast<char*>(static_cast<const char*>(page->read_entry_data(desc->begin_offset)));
+    data[0] ^= 0xFF;
+    auto recorder = std::make_shared<Recorder>(1u);
+    std::vector<std::string> m;
+    aku_Timestamp begin = dir == AKU_CURSOR_DIR_FORWARD ? 0u : 1000u;
+    aku_Timestamp end = dir == AKU_CURSOR_DIR_FORWARD ? 1000u : 0u;
+    auto qproc = std::make_shared<QP::ScanQueryProcessor>(recorder, m, begin, end,
+                                                          std::make_shared<QP::ValueFilter>(filter));
+    page->searchV2(qproc);
+    BOOST_REQUIRE_EQUAL(recorder->cursor.results.size(), 49u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_value_filter_forward) {
+    value_filter_test(AKU_CURSOR_DIR_FORWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_value_filter_backward) {
+    value_filter_test(AKU_CURSOR_DIR_BACKWARD);
+}
+
+void large_scan_test(int dir) {
+    // Number of chunks is larger than LARGE_SCAN_CHUNKS and READAHEAD_ENTRIES, readahead
+    // window moves several times and compressed data of the most chunks is released
+    const int NCHUNKS = 64;
+    const int CHUNK_SIZE = 1000;
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x400000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<double> values;
+    aku_Timestamp ts = 100u;
+    for (int chunk = 0; chunk < NCHUNKS; chunk++) {
+        UncompressedChunk header;
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            ChunkValue value;
+            value.type = ChunkValue::FLOAT;
+            value.value.floatval = static_cast<double>(std::rand()) / RAND_MAX;
+            header.values.push_back(value);
+            header.paramids.push_back(1u);
+            header.timestamps.push_back(ts);
+            timestamps.push_back(ts);
+            values.push_back(value.value.floatval);
+            ts += 1 + std::rand() % 3;
+        }
+        BOOST_REQUIRE_EQUAL(page->complete_chunk(header), AKU_SUCCESS);
+    }
+
+    auto check = [&](aku_Timestamp begin, aku_Timestamp end) {
+        auto recorder = std::make_shared<Recorder>(1u);
+        BOOST_REQUIRE(page->searchV2(make_proc(recorder, begin, end, dir)));
+        auto lo = std::lower_bound(timestamps.begin(), timestamps.end(), begin) - timestamps.begin();
+        auto hi = std::upper_bound(timestamps.begin(), timestamps.end(), end) - timestamps.begin();
+        auto const& results = recorder->cursor.results;
+        BOOST_REQUIRE_EQUAL(results.size(), static_cast<size_t>(hi - lo));
+        for (size_t i = 0; i < results.size(); i++) {
+            auto ix = dir == AKU_CURSOR_DIR_FORWARD ? lo + i : hi - 1 - i;
+            BOOST_REQUIRE_EQUAL(results[i].timestamp, timestamps[ix]);
+            BOOST_REQUIRE_EQUAL(results[i].payload.value.float64, values[ix]);
+        }
+    };
+    // Second pass reads released data again
+    for (int pass = 0; pass < 2; pass++) {
+        check(0u, ts);
+    }
+    // Scan that starts and stops in the middle of the page
+    check(timestamps[10*CHUNK_SIZE + 17], timestamps[50*CHUNK_SIZE + 3]);
+}
+
+BOOST_AUTO_TEST_CASE(Test_large_scan_forward) {
+    large_scan_test(AKU_CURSOR_DIR_FORWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_large_scan_backward) {
+    large_scan_test(AKU_CURSOR_DIR_BACKWARD);
+}
+
+void limit_test(int dir) {
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x10000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+
+    aku_Timestamp ts = 100u;
+    for (int chunk = 0; chunk < 2; chunk++) {
+        UncompressedChunk header;
+        for (int i = 0; i < 100; i++) {
+            ChunkValue value;
+            value.type = ChunkValue::FLOAT;
+            value.value.floatval = chunk*100 + i;
+            header.values.push_back(value);
+            header.paramids.push_back(1u);
+            header.timestamps.push_back(ts++);
+        }
+        BOOST_REQUIRE_EQUAL(page->complete_chunk(header), AKU_SUCCESS);
+    }
+
+    aku_Timestamp begin = dir == AKU_CURSOR_DIR_FORWARD ? 0u : 1000u;
+    aku_Timestamp end = dir == AKU_CURSOR_DIR_FORWARD ? 1000u : 0u;
+    std::vector<std::string> m;
+    {
+        // Scan should be interrupted inside the first chunk
+        auto recorder = std::make_shared<Recorder>(1u);
+        auto limit = QP::NodeBuilder::make_limit(5u, 10u, recorder, &logger_stub);
+        auto qproc = std::make_shared<QP::ScanQueryProcessor>(limit, m, begin, end);
+        BOOST_REQUIRE(!page->searchV2(qproc));
+        auto const& results = recorder->cursor.results;
+        BOOST_REQUIRE_EQUAL(results.size(), 5u);
+        for (size_t i = 0; i < results.size(); i++) {
+            double expected = dir == AKU_CURSOR_DIR_FORWARD ? 10 + i : 189 - i;
+            BOOST_REQUIRE_EQUAL(results[i].payload.value.float64, expected);
+        }
+    }
+    {
+        // Limit is not reached, page is scanned completely
+        auto recorder = std::make_shared<Recorder>(1u);
+        auto limit = QP::NodeBuilder::make_limit(1000u, 0u, recorder, &logger_stub);
+        auto qproc = std::make_shared<QP::ScanQueryProcessor>(limit, m, begin, end);
+        BOOST_REQUIRE(page->searchV2(qproc));
+        BOOST_REQUIRE_EQUAL(recorder->cursor.results.size(), 200u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_limit_forward) {
+    limit_test(AKU_CURSOR_DIR_FORWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_limit_backward) {
+    limit_test(AKU_CURSOR_DIR_BACKWARD);
+}
@@ -213,3 +213,257 @@ BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_1) {
     BOOST_REQUIRE_EQUAL(terminal->ids.at(1), 2);
     BOOST_REQUIRE_EQUAL(terminal->values.at(1), 0.234);
 }
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_aggregate) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series[] = {
+        "cpu key3=1",
+        "cpu key3=2",
+    };
+    for(int i = 0; i < 2; i++) {
+        const char* sname = series[i];
+        int slen = strlen(sname);
+        matcher.add(sname, sname+slen);
+    }
+    const char* json = R"(
+            {
+                "aggregate": { "step": "1h", "func": ["max", "count"] },
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                },
+                "where": [
+                    {"in":
+                        {"key3": [1] }
+                    }
+                ]
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = matcher.build_query_processor(json, terminal, &logger);
+    auto qproc = std::dynamic_pointer_cast<QP::ScanQueryProcessor>(iproc);
+    BOOST_REQUIRE(qproc->root_node_->get_type() == Node::FilterById);
+
+    auto first_ts  = DateTimeUtil::from_boost_ptime(boost::posix_time::ptime(boost::gregorian::date(2015, 01, 01)));
+    aku_Timestamp hour = 3600000000000ul;
+    qproc->start();
+    qproc->put(make(first_ts, 1, 1.0));
+    qproc->put(make(first_ts, 2, 2.0));  // filtered out
+    qproc->put(make(first_ts + 1, 1, 3.0));
+    qproc->put(make(first_ts + hour, 1, 4.0));
+    qproc->stop();
+
+    BOOST_REQUIRE_EQUAL(terminal->ids.size(), 4);
+    BOOST_REQUIRE_EQUAL(terminal->timestamps.at(0), first_ts);
+    BOOST_REQUIRE_EQUAL(terminal->values.at(0), 3.0);
+    BOOST_REQUIRE_EQUAL(terminal->values.at(1), 2.0);
+    BOOST_REQUIRE_EQUAL(terminal->timestamps.at(2), first_ts + hour);
+    BOOST_REQUIRE_EQUAL(terminal->values.at(2), 4.0);
+    BOOST_REQUIRE_EQUAL(terminal->values.at(3), 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_group_by) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series[] = {
+        "cpu host=A region=eu",
+        "cpu host=B region=eu",
+        "cpu host=C region=us",
+        "cpu host=D",
+        "cpu",
+    };
+    for(int i = 0; i < 5; i++) {
+        const char* sname = series[i];
+        int slen = strlen(sname);
+        matcher.add(sname, sname+slen);
+    }
+    // Query shouldn't modify series table
+    auto table_size = matcher.table.size();
+    auto names_size = matcher.names.size();
+    auto series_id = matcher.series_id;
+    const char* json = R"(
+            {
+                "aggregate": { "step": "1h", "func": "sum" },
+                "group_by": { "tag": "region" },
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                }
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = matcher.build_query_processor(json, terminal, &logger);
+    auto qproc = std::dynamic_pointer_cast<QP::ScanQueryProcessor>(iproc);
+
+    auto ts = DateTimeUtil::from_boost_ptime(boost::posix_time::ptime(boost::gregorian::date(2015, 01, 01)));
+    qproc->start();
+    for (aku_ParamId id = 1; id <= 5; id++) {
+        qproc->put(make(ts, id, id*1.0));
+    }
+    qproc->stop();
+
+    BOOST_REQUIRE_EQUAL(matcher.table.size(), table_size);
+    BOOST_REQUIRE_EQUAL(matcher.names.size(), names_size);
+    BOOST_REQUIRE_EQUAL(matcher.series_id, series_id);
+
+    // Group "cpu" is not the same as series "cpu"
+    const char* expected_names[] = { "cpu region=eu", "cpu region=us", "cpu" };
+    double expected_sums[] = { 3.0, 3.0, 9.0 };
+    std::map<std::string, double> results;
+    for (size_t i = 0; i < terminal->ids.size(); i++) {
+        BOOST_REQUIRE(terminal->ids[i] >= AKU_QUERY_SERIES_ID);
+        auto name = matcher.id2str(terminal->ids[i]);
+        BOOST_REQUIRE(name.first != nullptr);
+        results[std::string(name.first, name.first + name.second)] = terminal->values[i];
+    }
+    BOOST_REQUIRE_EQUAL(results.size(), 3u);
+    for (int i = 0; i < 3; i++) {
+        BOOST_REQUIRE_EQUAL(results[expected_names[i]], expected_sums[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_combine) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series[] = {
+        "errors host=A",
+        "requests host=A",
+    };
+    for(int i = 0; i < 2; i++) {
+        const char* sname = series[i];
+        int slen = strlen(sname);
+        matcher.add(sname, sname+slen);
+    }
+    const char* json = R"(
+            {
+                "transform": [ {"scale": 100} ],
+                "combine": { "op": "div", "lhs": "errors  host=A", "rhs": "requests host=A", "name": "error_rate host=A" },
+                "metric": ["errors", "requests"],
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                }
+            }
+    )";
+    auto table_size = matcher.table.size();
+    auto names_size = matcher.names.size();
+    auto series_id = matcher.series_id;
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = matcher.build_query_processor(json, terminal, &logger);
+    auto qproc = std::dynamic_pointer_cast<QP::ScanQueryProcessor>(iproc);
+
+    auto ts = DateTimeUtil::from_boost_ptime(boost::posix_time::ptime(boost::gregorian::date(2015, 01, 01)));
+    qproc->start();
+    qproc->put(make(ts, 1, 5.0));
+    qproc->put(make(ts, 2, 50.0));
+    qproc->stop();
+
+    // Combined series is not added to series table
+    BOOST_REQUIRE_EQUAL(matcher.table.size(), table_size);
+    BOOST_REQUIRE_EQUAL(matcher.names.size(), names_size);
+    BOOST_REQUIRE_EQUAL(matcher.series_id, series_id);
+    const char* out = "error_rate host=A";
+    BOOST_REQUIRE_EQUAL(matcher.match(out, out + strlen(out)), 0u);
+
+    BOOST_REQUIRE_EQUAL(terminal->ids.size(), 1);
+    BOOST_REQUIRE(terminal->ids.at(0) >= AKU_QUERY_SERIES_ID);
+    auto name = matcher.id2str(terminal->ids.at(0));
+    BOOST_REQUIRE_EQUAL(std::string(name.first, name.first + name.second), "error_rate host=A");
+    BOOST_REQUIRE_CLOSE(terminal->values.at(0), 0.1, 10E-5);
+
+    const char* bad_json = R"(
+            {
+                "combine": { "op": "div", "lhs": "errors host=B", "rhs": "requests host=A" },
+                "metric": "errors",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                }
+            }
+    )";
+    BOOST_REQUIRE_THROW(matcher.build_query_processor(bad_json, terminal, &logger), QueryParserError);
+}
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_value_filter) {
+
+    SeriesMatcher matcher(1ul);
+    const char* sname = "cpu key=1";
+    matcher.add(sname, sname + strlen(sname));
+    const char* json = R"(
+            {
+                "filter": { "gt": 100, "le": 200, "ge": 100 },
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                }
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = matcher.build_query_processor(json, terminal, &logger);
+    auto qproc = std::dynamic_pointer_cast<QP::ScanQueryProcessor>(iproc);
+    BOOST_REQUIRE(qproc->root_node_->get_type() == Node::FilterByValue);
+    auto filter = qproc->value_filter();
+    BOOST_REQUIRE(filter != nullptr);
+    BOOST_REQUIRE(!filter->match(100) && filter->match(100.5) && filter->match(200) && !filter->match(201));
+
+    const char* bad_json = R"(
+            {
+                "filter": { "eq": 100 },
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                }
+            }
+    )";
+    BOOST_REQUIRE_THROW(matcher.build_query_processor(bad_json, terminal, &logger), QueryParserError);
+}
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_limit) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series[] = { "cpu key=1", "cpu key=2", "cpu key=3", "cpu key=4" };
+    for (auto sname: series) {
+        matcher.add(sname, sname + strlen(sname));
+    }
+    const char* json = R"(
+            {
+                "limit": 2,
+                "offset": 1,
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                }
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = matcher.build_query_processor(json, terminal, &logger);
+    auto qproc = std::dynamic_pointer_cast<QP::ScanQueryProcessor>(iproc);
+    aku_Sample sample;
+    sample.paramid = 1u;
+    sample.payload.type = aku_PData::FLOAT;
+    sample.payload.value.float64 = 0.0;
+    for (aku_Timestamp ts = 0u; ts < 2u; ts++) {
+        sample.timestamp = ts;
+        BOOST_REQUIRE(qproc->put(sample));
+    }
+    // Scan should be interrupted when limit is reached
+    sample.timestamp = 2u;
+    BOOST_REQUIRE(!qproc->put(sample));
+    BOOST_REQUIRE_EQUAL(terminal->timestamps.size(), 2u);
+    BOOST_REQUIRE_EQUAL(terminal->timestamps.at(0), 1u);
+
+    const char* select_json = R"({ "select": "names", "limit": 2, "offset": 3 })";
+    auto mproc = std::dynamic_pointer_cast<QP::MetadataQueryProcessor>(
+                matcher.build_query_processor(select_json, terminal, &logger));
+    BOOST_REQUIRE(mproc);
+    BOOST_REQUIRE_EQUAL(mproc->ids_.size(), 1u);
+
+    const char* bad_json = R"({ "select": "names", "limit": 0 })";
+    BOOST_REQUIRE_THROW(matcher.build_query_processor(bad_json, terminal, &logger), QueryParserError);
+}
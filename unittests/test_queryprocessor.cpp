@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cmath>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -200,3 +201,534 @@ BOOST_AUTO_TEST_CASE(Test_moving_average_bwd) {
                                            [](aku_Timestamp a, aku_Timestamp b) { return a + b; });
     BOOST_REQUIRE_EQUAL(ts_sum, 50500*2);
 }
+
+BOOST_AUTO_TEST_CASE(Test_filter_by_id_batch) {
+    auto mock = std::make_shared<NodeMock>();
+    std::vector<aku_ParamId> ids = { 1, 3 };
+    auto filter = NodeBuilder::make_filter_by_id_list(ids, mock, &logger_stub);
+
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<aku_ParamId> paramids;
+    std::vector<double> values;
+    for (int i = 0; i < 100; i++) {
+        timestamps.push_back(i);
+        paramids.push_back(i % 4);
+        values.push_back(i*0.5);
+    }
+    // Every second row is selected in reverse order
+    std::vector<uint32_t> selection;
+    for (int i = 99; i >= 0; i -= 2) {
+        selection.push_back(i);
+    }
+    SampleBatch batch = { timestamps.data(), paramids.data(), values.data(), selection.data(),
+                          static_cast<uint32_t>(selection.size()) };
+    BOOST_REQUIRE(filter->put_batch(batch));
+
+    // Only odd rows are selected and only ids 1 and 3 are odd
+    BOOST_REQUIRE_EQUAL(mock->timestamps.size(), 50u);
+    for (size_t i = 0; i < mock->timestamps.size(); i++) {
+        auto ts = 99 - 2*i;
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], ts);
+        BOOST_REQUIRE_EQUAL(mock->ids[i], ts % 4);
+        BOOST_REQUIRE_EQUAL(mock->values[i], ts*0.5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_batch_builder) {
+    struct Recorder : IQueryProcessor {
+        std::vector<aku_Sample> samples;
+        size_t nbatches = 0;
+
+        aku_Timestamp lowerbound() const { return AKU_MIN_TIMESTAMP; }
+        aku_Timestamp upperbound() const { return AKU_MAX_TIMESTAMP; }
+        int direction() const { return AKU_CURSOR_DIR_FORWARD; }
+        bool start() { return true; }
+        void stop() {}
+        void set_error(aku_Status) {}
+        bool put(aku_Sample const& s) {
+            samples.push_back(s);
+            return true;
+        }
+        bool put_batch(SampleBatch const& batch) {
+            nbatches++;
+            return IQueryProcessor::put_batch(batch);
+        }
+    };
+    Recorder rec;
+    BatchBuilder builder(rec);
+    const int N = 3000;
+    for (int i = 0; i < N; i++) {
+        if (i == 100) {
+            aku_Sample blob = make(i, i, 0.0);
+            blob.payload.type = aku_PData::BLOB;
+            BOOST_REQUIRE(builder.put(blob));
+        } else {
+            BOOST_REQUIRE(builder.put(make(i, i, i*1.0)));
+        }
+    }
+    BOOST_REQUIRE(builder.flush());
+    BOOST_REQUIRE_EQUAL(rec.samples.size(), static_cast<size_t>(N));
+    for (int i = 0; i < N; i++) {
+        BOOST_REQUIRE_EQUAL(rec.samples[i].timestamp, static_cast<aku_Timestamp>(i));
+        BOOST_REQUIRE_EQUAL(rec.samples[i].payload.type, i == 100 ? aku_PData::BLOB : aku_PData::FLOAT);
+    }
+    BOOST_REQUIRE(rec.nbatches > 1 && rec.nbatches < 10);
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_fwd) {
+    auto mock = std::make_shared<NodeMock>();
+    auto aggregate = NodeBuilder::make_aggregate(
+                from_json(R"({"step": "10ns", "func": ["min", "max", "avg", "count", "first", "last"]})"),
+                mock, &logger_stub);
+    // Two series, series 1 is present only in even buckets
+    for (aku_Timestamp ts = 0u; ts < 100u; ts++) {
+        aku_Timestamp bucket = ts / 10;
+        if (bucket % 2 == 0) {
+            aggregate->put(make(ts, 1ul, ts*2.0));
+        }
+        aggregate->put(make(ts, 0ul, ts*1.0));
+    }
+    aggregate->complete();
+
+    size_t ix = 0;
+    for (aku_Timestamp bucket = 0u; bucket < 10u; bucket++) {
+        aku_ParamId maxid = bucket % 2 == 0 ? 1u : 0u;
+        for (aku_ParamId id = 0u; id <= maxid; id++) {
+            double k = id == 0 ? 1.0 : 2.0;
+            double expected[] = { k*bucket*10, k*(bucket*10 + 9), k*(bucket*10 + 4.5), 10.0,
+                                  k*bucket*10, k*(bucket*10 + 9) };
+            for (auto value: expected) {
+                BOOST_REQUIRE(ix < mock->values.size());
+                BOOST_REQUIRE_EQUAL(mock->timestamps[ix], bucket*10);
+                BOOST_REQUIRE_EQUAL(mock->ids[ix], id);
+                BOOST_REQUIRE_CLOSE(mock->values[ix], value, 10E-5);
+                ix++;
+            }
+        }
+    }
+    BOOST_REQUIRE_EQUAL(ix, mock->values.size());
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_bwd) {
+    auto mock = std::make_shared<NodeMock>();
+    auto aggregate = NodeBuilder::make_aggregate(from_json(R"({"step": "10ns", "func": ["sum", "first", "last"]})"),
+                                                 mock, &logger_stub);
+    // Backward direction, batch interface
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<aku_ParamId> paramids;
+    std::vector<double> values;
+    for (int ts = 99; ts >= 5; ts--) {
+        timestamps.push_back(ts);
+        paramids.push_back(7u);
+        values.push_back(ts);
+    }
+    SampleBatch batch = { timestamps.data(), paramids.data(), values.data(), nullptr,
+                          static_cast<uint32_t>(values.size()) };
+    BOOST_REQUIRE(aggregate->put_batch(batch));
+    aggregate->complete();
+
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 30u);
+    for (int i = 0; i < 10; i++) {
+        aku_Timestamp bucket = 9 - i;
+        aku_Timestamp first = bucket == 0 ? 5 : bucket*10;
+        aku_Timestamp last = bucket*10 + 9;
+        double sum = (first + last)*(last - first + 1)/2.0;
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i*3], bucket*10);
+        BOOST_REQUIRE_EQUAL(mock->ids[i*3], 7u);
+        BOOST_REQUIRE_CLOSE(mock->values[i*3 + 0], sum, 10E-5);
+        BOOST_REQUIRE_CLOSE(mock->values[i*3 + 1], static_cast<double>(first), 10E-5);
+        BOOST_REQUIRE_CLOSE(mock->values[i*3 + 2], static_cast<double>(last), 10E-5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_bad_spec) {
+    auto mock = std::make_shared<NodeMock>();
+    BOOST_REQUIRE_THROW(NodeBuilder::make_aggregate(from_json(R"({"step": "10s", "func": "mode"})"),
+                                                    mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_aggregate(from_json(R"({"step": "10xx", "func": "avg"})"),
+                                                    mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_aggregate(from_json(R"({"func": "avg"})"),
+                                                    mock, &logger_stub), NodeException);
+    auto node = NodeBuilder::make_aggregate(from_json(R"({"step": "1m", "func": "count"})"), mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(node->get_type(), Node::Aggregate);
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_quantiles) {
+    auto mock = std::make_shared<NodeMock>();
+    auto aggregate = NodeBuilder::make_aggregate(from_json(R"({"step": "1s", "func": ["p1", "median", "p99", "p99.9", "count"]})"),
+                                                 mock, &logger_stub);
+    // Series 0 - uniform distribution, series 1 - negative values and zeroes,
+    // series 2 - very wide range of values (lowest bins of the sketch are collapsed).
+    const int N = 100000;
+    std::vector<double> values(N);
+    for (int i = 0; i < N; i++) {
+        values[i] = (i * 7919) % N + 1;  // permutation of 1..N
+    }
+    for (int i = 0; i < N; i++) {
+        aku_Timestamp ts = i;
+        aggregate->put(make(ts, 0ul, values[i]));
+        aggregate->put(make(ts, 1ul, values[i] - N/2));
+        aggregate->put(make(ts, 2ul, std::pow(10.0, values[i]*200.0/N - 100.0)));
+    }
+    aggregate->complete();
+
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 15u);
+    double expected[] = {
+        0.01*N, 0.5*N, 0.99*N, 0.999*N, N,
+        0.01*N - N/2, 0, 0.99*N - N/2, 0.999*N - N/2, N,
+    };
+    for (int i = 0; i < 10; i++) {
+        BOOST_REQUIRE_EQUAL(mock->ids[i], i / 5);
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], 0u);
+        if (expected[i] == 0.0) {
+            BOOST_REQUIRE(std::abs(mock->values[i]) < 2.0);
+        } else {
+            BOOST_REQUIRE_CLOSE(mock->values[i], expected[i], 1.1);
+        }
+    }
+    // High quantiles of the wide range distribution are still accurate
+    BOOST_REQUIRE_EQUAL(mock->ids[12], 2u);
+    BOOST_REQUIRE_CLOSE(std::log10(mock->values[12]), 0.99*200 - 100, 0.1);
+    BOOST_REQUIRE_CLOSE(std::log10(mock->values[13]), 0.999*200 - 100, 0.1);
+    BOOST_REQUIRE_EQUAL(mock->values[14], N);
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_histogram) {
+    auto mock = std::make_shared<NodeMock>();
+    auto aggregate = NodeBuilder::make_aggregate(from_json(R"({"step": "10ns", "func": "max", "histogram": [10, 50, 90]})"),
+                                                 mock, &logger_stub);
+    for (aku_Timestamp ts = 0u; ts < 20u; ts++) {
+        for (int i = 0; i < 100; i++) {
+            aggregate->put(make(ts, 1ul, i));
+        }
+    }
+    aggregate->complete();
+
+    // Two buckets, max + 4 intervals each
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 10u);
+    for (int b = 0; b < 2; b++) {
+        BOOST_REQUIRE_EQUAL(mock->timestamps[b*5], b*10u);
+        BOOST_REQUIRE_EQUAL(mock->values[b*5 + 0], 99.0);
+        BOOST_REQUIRE_EQUAL(mock->values[b*5 + 1], 100.0);
+        BOOST_REQUIRE_EQUAL(mock->values[b*5 + 2], 400.0);
+        BOOST_REQUIRE_EQUAL(mock->values[b*5 + 3], 400.0);
+        BOOST_REQUIRE_EQUAL(mock->values[b*5 + 4], 100.0);
+    }
+
+    BOOST_REQUIRE_THROW(NodeBuilder::make_aggregate(from_json(R"({"step": "10s", "histogram": [10, 5]})"),
+                                                    mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_aggregate(from_json(R"({"step": "10s", "func": "p101"})"),
+                                                    mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_aggregate(from_json(R"({"step": "10s"})"),
+                                                    mock, &logger_stub), NodeException);
+}
+
+BOOST_AUTO_TEST_CASE(Test_topk) {
+    auto top = std::make_shared<NodeMock>();
+    auto bottom = std::make_shared<NodeMock>();
+    auto topk = NodeBuilder::make_topk(from_json(R"({"k": 3, "by": "avg"})"), false, top, &logger_stub);
+    auto bottomk = NodeBuilder::make_topk(from_json(R"({"k": "2", "by": "max"})"), true, bottom, &logger_stub);
+    BOOST_REQUIRE_EQUAL(topk->get_type(), Node::TopK);
+    // Series id i has values in range [i, i + 10), series 7 has one spike
+    for (aku_Timestamp ts = 0u; ts < 100u; ts++) {
+        for (aku_ParamId id = 0u; id < 100u; id++) {
+            double value = id + ts % 10;
+            if (id == 7 && ts == 50) {
+                value = 1000.0;
+            }
+            topk->put(make(ts, id, value));
+            bottomk->put(make(ts, id, value));
+        }
+    }
+    topk->complete();
+    bottomk->complete();
+
+    BOOST_REQUIRE_EQUAL(top->ids.size(), 3u);
+    BOOST_REQUIRE_EQUAL(top->ids[0], 99u);
+    BOOST_REQUIRE_EQUAL(top->ids[1], 98u);
+    BOOST_REQUIRE_EQUAL(top->ids[2], 97u);
+    BOOST_REQUIRE_CLOSE(top->values[0], 103.5, 10E-5);
+    BOOST_REQUIRE_EQUAL(top->timestamps[0], 99u);
+
+    BOOST_REQUIRE_EQUAL(bottom->ids.size(), 2u);
+    BOOST_REQUIRE_EQUAL(bottom->ids[0], 0u);
+    BOOST_REQUIRE_EQUAL(bottom->ids[1], 1u);
+    BOOST_REQUIRE_EQUAL(bottom->values[0], 9.0);
+    BOOST_REQUIRE_EQUAL(bottom->values[1], 10.0);
+
+    auto mock = std::make_shared<NodeMock>();
+    BOOST_REQUIRE_THROW(NodeBuilder::make_topk(from_json(R"({"k": 0})"), false, mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_topk(from_json(R"({"by": "max"})"), false, mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_topk(from_json(R"({"k": 1, "by": "mode"})"), false, mock, &logger_stub), NodeException);
+}
+
+BOOST_AUTO_TEST_CASE(Test_topk_plan_ids) {
+    auto mock = std::make_shared<NodeMock>();
+    // Series 20 is known at plan time but has no data, series 5 and 50 are not known at plan time
+    std::vector<aku_ParamId> ids = { 30, 10, 20, 10 };
+    auto topk = NodeBuilder::make_topk(from_json(R"({"k": 10, "by": "sum"})"), true, mock, &logger_stub, ids);
+    aku_ParamId series[] = { 10, 5, 30, 50 };
+    for (aku_Timestamp ts = 0u; ts < 10u; ts++) {
+        for (auto id: series) {
+            topk->put(make(ts, id, static_cast<double>(id)));
+        }
+    }
+    topk->complete();
+
+    BOOST_REQUIRE_EQUAL(mock->ids.size(), 4u);
+    aku_ParamId expected[] = { 5, 10, 30, 50 };
+    for (int i = 0; i < 4; i++) {
+        BOOST_REQUIRE_EQUAL(mock->ids[i], expected[i]);
+        BOOST_REQUIRE_EQUAL(mock->values[i], 10.0*expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_group_by_batch) {
+    auto mock = std::make_shared<NodeMock>();
+    // Series 10..19 are mapped to groups 100 (even) and 101 (odd), series 15 is not mapped
+    std::vector<aku_ParamId> ids, groups;
+    for (aku_ParamId id = 10; id < 20; id++) {
+        if (id != 15) {
+            ids.push_back(id);
+            groups.push_back(100 + id % 2);
+        }
+    }
+    auto group_by = NodeBuilder::make_group_by(ids, groups, mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(group_by->get_type(), Node::GroupBy);
+
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<aku_ParamId> paramids;
+    std::vector<double> values;
+    for (int i = 0; i < 30; i++) {
+        timestamps.push_back(i);
+        paramids.push_back(i);
+        values.push_back(i);
+    }
+    SampleBatch batch = { timestamps.data(), paramids.data(), values.data(), nullptr,
+                          static_cast<uint32_t>(values.size()) };
+    BOOST_REQUIRE(group_by->put_batch(batch));
+    BOOST_REQUIRE(group_by->put(make(100u, 12u, 1.0)));
+    BOOST_REQUIRE(group_by->put(make(100u, 15u, 1.0)));
+
+    BOOST_REQUIRE_EQUAL(mock->ids.size(), 10u);
+    for (int i = 0; i < 9; i++) {
+        aku_ParamId id = i < 5 ? 10 + i : 11 + i;
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], id);
+        BOOST_REQUIRE_EQUAL(mock->ids[i], 100 + id % 2);
+    }
+    BOOST_REQUIRE_EQUAL(mock->ids[9], 100u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_resampler_linear) {
+    auto mock = std::make_shared<NodeMock>();
+    auto resampler = NodeBuilder::make_resampler(from_json(R"({"step": "10ns"})"), mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(resampler->get_type(), Node::Resampler);
+    // Two series with different sampling rates
+    resampler->put(make(5u, 1u, 5.0));
+    resampler->put(make(7u, 2u, 70.0));
+    resampler->put(make(20u, 1u, 20.0));
+    resampler->put(make(27u, 2u, 270.0));
+    resampler->put(make(45u, 1u, 45.0));
+    resampler->complete();
+
+    aku_Timestamp timestamps[] = { 10, 20, 10, 20, 30, 40 };
+    aku_ParamId ids[] = { 1, 1, 2, 2, 1, 1 };
+    double values[] = { 10.0, 20.0, 100.0, 200.0, 30.0, 40.0 };
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 6u);
+    for (int i = 0; i < 6; i++) {
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], timestamps[i]);
+        BOOST_REQUIRE_EQUAL(mock->ids[i], ids[i]);
+        BOOST_REQUIRE_CLOSE(mock->values[i], values[i], 10E-5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_resampler_gaps) {
+    auto mock = std::make_shared<NodeMock>();
+    auto resampler = NodeBuilder::make_resampler(
+                from_json(R"({"step": "10ns", "interpolation": "previous", "max_gap": "30ns", "fill": -1})"),
+                mock, &logger_stub);
+    // Backward direction, batch interface
+    aku_Timestamp timestamps[] = { 100, 75, 5, 0 };
+    aku_ParamId paramids[] = { 1, 1, 1, 1 };
+    double values[] = { 1.0, 2.0, 3.0, 4.0 };
+    SampleBatch batch = { timestamps, paramids, values, nullptr, 4u };
+    BOOST_REQUIRE(resampler->put_batch(batch));
+    resampler->complete();
+
+    // 100 is aligned, 90 and 80 are filled with previous value (75), 70..10 are in the gap,
+    // 0 is aligned
+    aku_Timestamp exp_timestamps[] = { 100, 90, 80, 70, 60, 50, 40, 30, 20, 10, 0 };
+    double exp_values[] = { 1.0, 2.0, 2.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0, 4.0 };
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 11u);
+    for (int i = 0; i < 11; i++) {
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], exp_timestamps[i]);
+        BOOST_REQUIRE_EQUAL(mock->values[i], exp_values[i]);
+    }
+
+    BOOST_REQUIRE_THROW(NodeBuilder::make_resampler(from_json(R"({"step": "10s", "interpolation": "cubic"})"),
+                                                    mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_resampler(from_json(R"({"step": "0s"})"),
+                                                    mock, &logger_stub), NodeException);
+}
+
+BOOST_AUTO_TEST_CASE(Test_resampler_long_gap_limit) {
+    auto mock = std::make_shared<NodeMock>();
+    auto limit = NodeBuilder::make_limit(10u, 0u, mock, &logger_stub);
+    auto resampler = NodeBuilder::make_resampler(from_json(R"({"step": "1ns"})"), limit, &logger_stub);
+    // Gap is 1s long, output is generated in small batches until the limit is reached
+    BOOST_REQUIRE(resampler->put(make(0u, 1u, 0.0)));
+    BOOST_REQUIRE(!resampler->put(make(1000000000u, 1u, 1.0)));
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 10u);
+    for (aku_Timestamp i = 0; i < 10u; i++) {
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_transform) {
+    auto mock = std::make_shared<NodeMock>();
+    auto transform = NodeBuilder::make_transform(from_json(R"(["rate", {"scale": 10}, {"clamp": [0, 100]}])"),
+                                                 mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(transform->get_type(), Node::Transform);
+    // Counter of the series 1 grows by 2 per second and resets at 3s,
+    // counter of the series 2 grows by 20 per second
+    const aku_Timestamp SEC = 1000000000ul;
+    double counter1[] = { 0, 2, 4, 1, 3 };
+    for (int i = 0; i < 5; i++) {
+        transform->put(make(i*SEC, 1u, counter1[i]));
+        transform->put(make(i*SEC, 2u, i*20.0));
+    }
+    transform->complete();
+
+    // First sample of each series is dropped
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 8u);
+    double expected1[] = { 20, 20, 10, 20 };
+    for (int i = 0; i < 4; i++) {
+        BOOST_REQUIRE_EQUAL(mock->ids[i*2], 1u);
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i*2], (i + 1)*SEC);
+        BOOST_REQUIRE_CLOSE(mock->values[i*2], expected1[i], 10E-5);
+        BOOST_REQUIRE_EQUAL(mock->ids[i*2 + 1], 2u);
+        BOOST_REQUIRE_CLOSE(mock->values[i*2 + 1], 100.0, 10E-5);  // clamped
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_transform_derivative_bwd) {
+    auto mock = std::make_shared<NodeMock>();
+    auto transform = NodeBuilder::make_transform(from_json(R"(["derivative", "abs"])"), mock, &logger_stub);
+    // Backward direction, value decreases by 5 per second
+    const aku_Timestamp SEC = 1000000000ul;
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<aku_ParamId> paramids;
+    std::vector<double> values;
+    for (int i = 10; i >= 0; i--) {
+        timestamps.push_back(i*SEC);
+        paramids.push_back(1u);
+        values.push_back(-5.0*i);
+    }
+    SampleBatch batch = { timestamps.data(), paramids.data(), values.data(), nullptr,
+                          static_cast<uint32_t>(values.size()) };
+    BOOST_REQUIRE(transform->put_batch(batch));
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 10u);
+    for (int i = 0; i < 10; i++) {
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], (9 - i)*SEC);
+        BOOST_REQUIRE_CLOSE(mock->values[i], 5.0, 10E-5);
+    }
+
+    BOOST_REQUIRE_THROW(NodeBuilder::make_transform(from_json(R"(["log"])"), mock, &logger_stub), NodeException);
+    BOOST_REQUIRE_THROW(NodeBuilder::make_transform(from_json(R"([{"clamp": 1}])"), mock, &logger_stub), NodeException);
+}
+
+BOOST_AUTO_TEST_CASE(Test_combine) {
+    auto mock = std::make_shared<NodeMock>();
+    auto combine = NodeBuilder::make_combine("div", 1u, 2u, 3u, mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(combine->get_type(), Node::Combine);
+    // Series 2 doesn't have value at ts=20, series 1 - at ts=30, series 4 is ignored
+    for (aku_Timestamp ts = 0u; ts < 50u; ts += 10) {
+        if (ts != 30) {
+            combine->put(make(ts, 1u, ts*2.0));
+        }
+        combine->put(make(ts, 4u, 1.0));
+        if (ts != 20) {
+            combine->put(make(ts, 2u, ts + 1.0));
+        }
+    }
+    combine->complete();
+
+    aku_Timestamp expected[] = { 0, 10, 40 };
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 3u);
+    for (int i = 0; i < 3; i++) {
+        BOOST_REQUIRE_EQUAL(mock->timestamps[i], expected[i]);
+        BOOST_REQUIRE_EQUAL(mock->ids[i], 3u);
+        BOOST_REQUIRE_CLOSE(mock->values[i], expected[i]*2.0/(expected[i] + 1.0), 10E-5);
+    }
+    BOOST_REQUIRE_THROW(NodeBuilder::make_combine("pow", 1u, 2u, 3u, mock, &logger_stub), NodeException);
+}
+
+BOOST_AUTO_TEST_CASE(Test_filter_by_value) {
+    QP::ValueFilter filter;
+    filter.lowerbound = 10;
+    filter.upperbound = 20;
+    filter.upper_inclusive = false;
+    BOOST_REQUIRE(filter.match(10) && filter.match(19.9) && !filter.match(20) && !filter.match(9));
+    BOOST_REQUIRE(filter.match_range(0, 10) && filter.match_range(15, 16) && filter.match_range(0, 100));
+    BOOST_REQUIRE(!filter.match_range(20, 30) && !filter.match_range(0, 9.9));
+    // Empty range (chunk without float values)
+    BOOST_REQUIRE(!filter.match_range(std::numeric_limits<double>::infinity(),
+                                      -std::numeric_limits<double>::infinity()));
+
+    auto mock = std::make_shared<NodeMock>();
+    auto node = NodeBuilder::make_filter_by_value(filter, mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(node->get_type(), Node::FilterByValue);
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<aku_ParamId> paramids;
+    std::vector<double> values;
+    for (int i = 0; i < 30; i++) {
+        timestamps.push_back(i);
+        paramids.push_back(1u);
+        values.push_back(i);
+    }
+    SampleBatch batch = { timestamps.data(), paramids.data(), values.data(), nullptr,
+                          static_cast<uint32_t>(values.size()) };
+    BOOST_REQUIRE(node->put_batch(batch));
+    aku_Sample blob = make(100u, 1u, 15.0);
+    blob.payload.type = aku_PData::BLOB;
+    BOOST_REQUIRE(node->put(blob));
+    BOOST_REQUIRE(node->put(make(101u, 1u, 15.0)));
+
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 11u);
+    for (int i = 0; i < 10; i++) {
+        BOOST_REQUIRE_EQUAL(mock->values[i], 10.0 + i);
+    }
+    BOOST_REQUIRE_EQUAL(mock->timestamps[10], 101u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_limit) {
+    auto mock = std::make_shared<NodeMock>();
+    auto node = NodeBuilder::make_limit(15u, 12u, mock, &logger_stub);
+    BOOST_REQUIRE_EQUAL(node->get_type(), Node::Limit);
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<aku_ParamId> paramids;
+    std::vector<double> values;
+    std::vector<uint32_t> selection;
+    for (int i = 0; i < 10; i++) {
+        timestamps.push_back(i);
+        paramids.push_back(1u);
+        values.push_back(i);
+        selection.push_back(9 - i);
+    }
+    // First 10 samples are skipped
+    BOOST_REQUIRE(node->put_batch({ timestamps.data(), paramids.data(), values.data(), nullptr, 10u }));
+    // Batch with selection vector, 2 samples are skipped, 8 passed
+    BOOST_REQUIRE(node->put_batch({ timestamps.data(), paramids.data(), values.data(), selection.data(), 10u }));
+    // 5 samples passed, limit reached
+    BOOST_REQUIRE(node->put(make(100u, 1u, 100.0)));
+    BOOST_REQUIRE(!node->put_batch({ timestamps.data(), paramids.data(), values.data(), nullptr, 10u }));
+    BOOST_REQUIRE(!node->put(make(101u, 1u, 101.0)));
+    BOOST_REQUIRE(!node->put_batch({ timestamps.data(), paramids.data(), values.data(), nullptr, 10u }));
+
+    double expected[] = { 7, 6, 5, 4, 3, 2, 1, 0, 100, 0, 1, 2, 3, 4, 5 };
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 15u);
+    for (int i = 0; i < 15; i++) {
+        BOOST_REQUIRE_EQUAL(mock->values[i], expected[i]);
+    }
+    BOOST_REQUIRE_THROW(NodeBuilder::make_limit(0u, 10u, mock, &logger_stub), NodeException);
+}
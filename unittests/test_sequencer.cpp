@@ -8,6 +8,7 @@
 #include <apr.h>
 #include <vector>
 #include <iostream>
+#include <thread>
 
 #include "sequencer.h"
 
@@ -239,10 +240,7 @@ void test_sequencer_searching(int dir) {
     std::vector<std::string> metrics;
     auto qproc = std::make_shared<QP::ScanQueryProcessor>(node, metrics, begin, end);
 
-    aku_Timestamp window;
-    int seq_id;
-    std::tie(window, seq_id) = seq.get_window();
-    seq.searchV2(qproc, seq_id);
+    seq.searchV2(qproc, seq.get_snapshot());
 
     // Check that everything is there
     BOOST_REQUIRE_EQUAL(cursor.results.size(), offsets.size());
@@ -259,3 +257,262 @@ BOOST_AUTO_TEST_CASE(Test_sequencer_search_backward) {
 BOOST_AUTO_TEST_CASE(Test_sequencer_search_forward) {
     test_sequencer_searching(AKU_CURSOR_DIR_FORWARD);
 }
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_no_busy_below_threshold) {
+    const int LARGE_LOOP = 1000;
+    const int WINDOW = 10;
+    const int THRESHOLD = 100;
+
+    Sequencer seq(nullptr, {THRESHOLD, WINDOW, 0u});
+
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i), 42u, i, 1u));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        if (lock % 2 == 1) {
+            RecordingCursor rec;
+            Caller caller;
+            seq.merge(caller, &rec);
+            BOOST_REQUIRE(rec.results.size() >= static_cast<size_t>(THRESHOLD));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_background_merge_and_compress) {
+    const int LARGE_LOOP = 10000;
+    const int WINDOW = 100;
+
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x100000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+    Sequencer seq(page, {0u, WINDOW, 0u});
+    Sequencer::Mutex page_lock;
+    std::thread worker;
+    int num_busy = 0;
+
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        TimeSeriesValue value(static_cast<aku_Timestamp>(i), 42u, static_cast<double>(i));
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(value);
+        if (status == AKU_EBUSY) {
+            // previous checkpoint is not merged yet
+            num_busy++;
+            worker.join();
+            tie(status, lock) = seq.add(value);
+        }
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        if (lock % 2 == 1) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+            worker = std::thread([&seq, page, &page_lock]() {
+                auto status = seq.merge_and_compress(page, &page_lock);
+                BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            });
+        }
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+    BOOST_REQUIRE(seq.reset() % 2 == 1);
+    BOOST_REQUIRE_EQUAL(seq.merge_and_compress(page), AKU_SUCCESS);
+    BOOST_TEST_MESSAGE("Number of busy writes: " << num_busy);
+
+    Caller caller;
+    RecordingCursor cursor;
+    auto node = std::make_shared<Node>(caller, cursor);
+    std::vector<std::string> metrics;
+    auto qproc = std::make_shared<QP::ScanQueryProcessor>(node, metrics, AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP);
+    page->searchV2(qproc);
+
+    BOOST_REQUIRE_EQUAL(cursor.results.size(), static_cast<size_t>(LARGE_LOOP));
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        BOOST_REQUIRE_EQUAL(cursor.results[i].timestamp, static_cast<aku_Timestamp>(i));
+        BOOST_REQUIRE_EQUAL(cursor.results[i].payload.value.float64, static_cast<double>(i));
+    }
+}
+
+//! Collects all samples
+struct CollectingNode : QP::Node {
+    std::vector<aku_Sample> samples;
+    aku_Status error = AKU_SUCCESS;
+
+    void complete() {}
+
+    bool put(const aku_Sample &sample) {
+        samples.push_back(sample);
+        return true;
+    }
+
+    void set_error(aku_Status status) {
+        error = status;
+    }
+
+    NodeType get_type() const {
+        return Node::Mock;
+    }
+};
+
+void test_sequencer_kway_merge(int dir) {
+    const int SZLOOP = 10000;
+    const int WINDOW = 1000;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> jitter(0, WINDOW/2);
+    std::uniform_int_distribution<int> ids(1, 8);
+
+    // Out of order timestamps (with duplicates) produces many sorted runs
+    Sequencer seq(nullptr, {0u, 10*SZLOOP, 0u});
+    std::vector<std::tuple<aku_Timestamp, aku_ParamId>> expected;
+    for (int i = 0; i < SZLOOP; i++) {
+        aku_Timestamp ts = static_cast<aku_Timestamp>(WINDOW + i - jitter(gen));
+        aku_ParamId id = static_cast<aku_ParamId>(ids(gen));
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(ts, id, static_cast<double>(i)));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE(lock % 2 == 0);
+        expected.push_back(std::make_tuple(ts, id));
+    }
+    BOOST_REQUIRE(seq.runs_.size() > 1);
+
+    std::sort(expected.begin(), expected.end());
+    aku_Timestamp begin = AKU_MIN_TIMESTAMP,
+                  end   = AKU_MAX_TIMESTAMP;
+    if (dir == AKU_CURSOR_DIR_BACKWARD) {
+        std::reverse(expected.begin(), expected.end());
+        std::swap(begin, end);
+    }
+
+    auto node = std::make_shared<CollectingNode>();
+    std::vector<std::string> metrics;
+    auto qproc = std::make_shared<QP::ScanQueryProcessor>(node, metrics, begin, end);
+    seq.searchV2(qproc, seq.get_snapshot());
+
+    BOOST_REQUIRE_EQUAL(node->error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(node->samples.size(), expected.size());
+    for (auto i = 0u; i < expected.size(); i++) {
+        BOOST_REQUIRE_EQUAL(node->samples[i].timestamp, std::get<0>(expected[i]));
+        BOOST_REQUIRE_EQUAL(node->samples[i].paramid, std::get<1>(expected[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_kway_merge_forward) {
+    test_sequencer_kway_merge(AKU_CURSOR_DIR_FORWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_kway_merge_backward) {
+    test_sequencer_kway_merge(AKU_CURSOR_DIR_BACKWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_concurrent_search) {
+    const int SZLOOP = 200000;
+    const int WINDOW = 1000;
+
+    Sequencer seq(nullptr, {0u, WINDOW, 0u});
+    std::atomic<bool> done(false);
+    std::atomic<int> nqueries(0);
+    std::atomic<int> nerrors(0);
+
+    // Reader works with snapshots while writer appends values and creates checkpoints
+    std::thread reader([&]() {
+        std::vector<std::string> metrics;
+        while (!done.load()) {
+            auto node = std::make_shared<CollectingNode>();
+            auto qproc = std::make_shared<QP::ScanQueryProcessor>(node, metrics, AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP);
+            seq.searchV2(qproc, seq.get_snapshot());
+            if (node->error != AKU_SUCCESS) {
+                nerrors++;
+            }
+            for (auto i = 1u; i < node->samples.size(); i++) {
+                if (node->samples[i - 1].timestamp > node->samples[i].timestamp) {
+                    nerrors++;
+                    break;
+                }
+            }
+            nqueries++;
+        }
+    });
+
+    for (int i = 0; i < SZLOOP; i++) {
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i), static_cast<aku_ParamId>(i % 8), 0.0));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        if (lock % 2 == 1) {
+            RecordingCursor rec;
+            Caller caller;
+            seq.merge(caller, &rec);
+        }
+    }
+    done.store(true);
+    reader.join();
+    BOOST_TEST_MESSAGE("Number of queries: " << nqueries.load());
+    BOOST_REQUIRE_EQUAL(nerrors.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_consistent_search_during_compaction) {
+    const int LARGE_LOOP = 20000;
+    const int WINDOW = 100;
+
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x400000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+    Sequencer seq(page, {0u, WINDOW, 0u});
+    Sequencer::Mutex page_lock;
+    std::atomic<bool> done(false);
+    std::atomic<int> nerrors(0);
+
+    // Reader searches page and sequencer using the same snapshot while
+    // checkpoints are merged and compressed in background. Every query
+    // should return continuous sequence of timestamps starting from zero.
+    std::thread reader([&]() {
+        std::vector<std::string> metrics;
+        size_t last_size = 0u;
+        while (!done.load()) {
+            auto node = std::make_shared<CollectingNode>();
+            auto qproc = std::make_shared<QP::ScanQueryProcessor>(node, metrics, AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP);
+            auto snapshot = seq.get_snapshot();
+            page->searchV2(qproc, std::shared_ptr<ChunkCache>(), snapshot.page_limit);
+            seq.searchV2(qproc, snapshot);
+            if (node->error != AKU_SUCCESS || node->samples.size() < last_size) {
+                nerrors++;
+            }
+            for (auto i = 0u; i < node->samples.size(); i++) {
+                if (node->samples[i].timestamp != static_cast<aku_Timestamp>(i)) {
+                    nerrors++;
+                    break;
+                }
+            }
+            last_size = node->samples.size();
+        }
+    });
+
+    std::thread worker;
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        TimeSeriesValue value(static_cast<aku_Timestamp>(i), 42u, static_cast<double>(i));
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(value);
+        if (status == AKU_EBUSY) {
+            worker.join();
+            tie(status, lock) = seq.add(value);
+        }
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        if (lock % 2 == 1) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+            worker = std::thread([&seq, page, &page_lock]() {
+                seq.merge_and_compress(page, &page_lock);
+            });
+        }
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+    done.store(true);
+    reader.join();
+    BOOST_REQUIRE_EQUAL(nerrors.load(), 0);
+}
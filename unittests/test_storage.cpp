@@ -4,8 +4,15 @@
 #define BOOST_TEST_MODULE Main
 #include <boost/test/unit_test.hpp>
 #include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
 
 #include "storage.h"
+#include "wal.h"
 
 
 using namespace Akumuli;
@@ -54,3 +61,207 @@ BOOST_AUTO_TEST_CASE(Test_metadata_storage_numeric_config) {
     BOOST_REQUIRE_EQUAL(creation_datetime, actual_dt);
 }
 
+
+//! Write sample, retry if storage is busy
+static void write_sample(aku_Database* db, const char* series, aku_Timestamp ts, aku_PData payload) {
+    aku_Status status = AKU_EBUSY;
+    while (status == AKU_EBUSY) {
+        aku_Sample sample;
+        BOOST_REQUIRE_EQUAL(aku_series_to_param_id(db, series, series + strlen(series), &sample), AKU_SUCCESS);
+        sample.timestamp = ts;
+        sample.payload = payload;
+        status = aku_write(db, &sample);
+    }
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+}
+
+//! Read all query results, check order and return number of samples
+static size_t read_ordered(aku_Database* db, const char* query, int direction) {
+    auto cursor = aku_query(db, query);
+    size_t count = 0;
+    aku_Sample prev = {};
+    aku_Sample buffer[0x100];
+    while (!aku_cursor_is_done(cursor)) {
+        int error = AKU_SUCCESS;
+        BOOST_REQUIRE(!aku_cursor_is_error(cursor, &error));
+        auto n = aku_cursor_read(cursor, buffer, 0x100);
+        for (size_t i = 0; i < n; i++) {
+            auto const& sample = buffer[i];
+            if (count) {
+                auto lhs = std::make_tuple(prev.timestamp, prev.paramid);
+                auto rhs = std::make_tuple(sample.timestamp, sample.paramid);
+                BOOST_REQUIRE(direction == AKU_CURSOR_DIR_FORWARD ? lhs <= rhs : lhs >= rhs);
+            }
+            prev = sample;
+            count++;
+        }
+    }
+    aku_cursor_close(cursor);
+    return count;
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_overlapping_volumes_order) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path("akumuli-test-%%%%-%%%%");
+    fs::create_directories(dir);
+    auto status = aku_create_database("test", dir.c_str(), dir.c_str(), 3, 0u, 10000u, 0u,
+                                      AKU_MIN_VOLUME_SIZE, &logger_stub);
+    BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+    std::string path = (dir / "test.akumuli").string();
+
+    for (uint32_t query_threads: { 0u, 4u }) {
+        aku_FineTuneParams params = {};
+        params.durability = 4u;
+        params.query_threads = query_threads;
+        params.logger = &logger_stub;
+        auto db = aku_open_database(path.c_str(), params);
+        BOOST_REQUIRE_EQUAL(aku_open_status(db), AKU_SUCCESS);
+
+        // Data is written once and queried again after reopen using worker threads.
+        // Blobs fill the volumes fast. Floats are late writes, some of them are written
+        // after rotation to the next volume and overlap with the previous volume.
+        const size_t N = query_threads ? 0u : 6000u;
+        std::string blob(0x1000, 'x');
+        for (size_t i = 0; i < N; i++) {
+            aku_Timestamp ts = 1000000u + 10u*i;
+            aku_PData payload;
+            payload.type = aku_PData::BLOB;
+            payload.value.blob.begin = blob.data();
+            payload.value.blob.size = static_cast<uint32_t>(blob.size());
+            write_sample(db, "cpu key=blob", ts, payload);
+            payload.type = aku_PData::FLOAT;
+            payload.value.float64 = i;
+            write_sample(db, "cpu key=float", ts - 25u, payload);
+        }
+
+        const char* forward = R"({ "metric": "cpu", "range": { "from": "19700101T000000", "to": "22000101T000000" }})";
+        const char* backward = R"({ "metric": "cpu", "range": { "from": "22000101T000000", "to": "19700101T000000" }})";
+        BOOST_REQUIRE_EQUAL(read_ordered(db, forward, AKU_CURSOR_DIR_FORWARD), 12000u);
+        BOOST_REQUIRE_EQUAL(read_ordered(db, backward, AKU_CURSOR_DIR_BACKWARD), 12000u);
+        aku_close_database(db);
+    }
+    aku_remove_database(path.c_str(), &logger_stub);
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_wal_synced_when_idle) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path("akumuli-test-%%%%-%%%%");
+    fs::create_directories(dir);
+    auto status = aku_create_database("test", dir.c_str(), dir.c_str(), 2, 0u, 10000u, 0u,
+                                      AKU_MIN_VOLUME_SIZE, &logger_stub);
+    BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+    std::string path = (dir / "test.akumuli").string();
+
+    aku_FineTuneParams params = {};
+    params.durability = 4u;
+    params.enable_wal = 1u;
+    params.wal_fsync_interval = 20u;
+    params.logger = &logger_stub;
+    auto db = aku_open_database(path.c_str(), params);
+    BOOST_REQUIRE_EQUAL(aku_open_status(db), AKU_SUCCESS);
+    for (int i = 0; i < 10; i++) {
+        aku_PData payload;
+        payload.type = aku_PData::FLOAT;
+        payload.value.float64 = i;
+        write_sample(db, "cpu key=1", 1000u + i, payload);
+    }
+    // Writes stopped, buffered records should be synced in background
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    size_t nrecords = 0;
+    WriteAheadLog wal(path + ".wal", 0u, &logger_stub);
+    wal.replay([&](TimeSeriesValue const&, aku_MemRange) {
+        nrecords++;
+        return AKU_SUCCESS;
+    });
+    BOOST_REQUIRE_EQUAL(nrecords, 10u);
+
+    aku_close_database(db);
+    aku_remove_database(path.c_str(), &logger_stub);
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_prepared_volume_page_id_mismatch) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path("akumuli-test-%%%%-%%%%");
+    fs::create_directories(dir);
+    auto status = aku_create_database("test", dir.c_str(), dir.c_str(), 3, 0u, 10000u, 0u,
+                                      AKU_MIN_VOLUME_SIZE, &logger_stub);
+    BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+    std::string path = (dir / "test.akumuli").string();
+
+    aku_FineTuneParams params = {};
+    params.durability = 4u;
+    params.logger = &logger_stub;
+    {
+        Storage storage(path.c_str(), params);
+        BOOST_REQUIRE_EQUAL(storage.open_error_code_, AKU_SUCCESS);
+        auto nvol = storage.volumes_.size();
+        auto next = storage.volumes_.at((storage.active_volume_index_ + 1) % nvol);
+        auto next_file = next->file_path_ + ".next";
+
+        // Replacement is prepared for the next volume, active volume can't use it
+        auto prepared = storage.take_next_volume_(storage.active_volume_);
+        BOOST_REQUIRE(!prepared);
+        BOOST_REQUIRE(!fs::exists(next_file));
+
+        storage.prepare_next_volume_();
+        prepared = storage.take_next_volume_(next);
+        BOOST_REQUIRE(prepared);
+        BOOST_REQUIRE_EQUAL(prepared->get_page()->get_page_id(), next->get_page()->get_page_id());
+        BOOST_REQUIRE(fs::exists(next_file));
+
+        // Unused replacement is removed
+        prepared.reset();
+        BOOST_REQUIRE(!fs::exists(next_file));
+        storage.close();
+    }
+    aku_remove_database(path.c_str(), &logger_stub);
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_leftover_next_volume) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path("akumuli-test-%%%%-%%%%");
+    fs::create_directories(dir);
+    auto status = aku_create_database("test", dir.c_str(), dir.c_str(), 2, 0u, 10000u, 0u,
+                                      AKU_MIN_VOLUME_SIZE, &logger_stub);
+    BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+    std::string path = (dir / "test.akumuli").string();
+
+    // Files left by the crashed run (truncated replacements)
+    for (int ix = 0; ix < 2; ix++) {
+        auto name = dir / ("test_" + std::to_string(ix) + ".volume.next");
+        std::ofstream stream(name.string());
+        stream << "garbage";
+    }
+
+    aku_FineTuneParams params = {};
+    params.durability = 4u;
+    params.logger = &logger_stub;
+    auto db = aku_open_database(path.c_str(), params);
+    BOOST_REQUIRE_EQUAL(aku_open_status(db), AKU_SUCCESS);
+
+    // Blobs fill both volumes, the first one is replaced at least once
+    const size_t N = 12000u;
+    std::string blob(0x1000, 'x');
+    for (size_t i = 0; i < N; i++) {
+        aku_PData payload;
+        payload.type = aku_PData::BLOB;
+        payload.value.blob.begin = blob.data();
+        payload.value.blob.size = static_cast<uint32_t>(blob.size());
+        write_sample(db, "cpu key=blob", 1000000u + 10u*i, payload);
+    }
+    const char* forward = R"({ "metric": "cpu", "range": { "from": "19700101T000000", "to": "22000101T000000" }})";
+    auto nread = read_ordered(db, forward, AKU_CURSOR_DIR_FORWARD);
+    BOOST_REQUIRE(nread > 0u);
+    BOOST_REQUIRE(nread < N);  // oldest samples are overwritten
+    aku_close_database(db);
+
+    // Unused replacements are removed on close
+    for (fs::directory_iterator it(dir), end; it != end; ++it) {
+        BOOST_REQUIRE_NE(it->path().extension().string(), ".next");
+    }
+    aku_remove_database(path.c_str(), &logger_stub);
+    fs::remove_all(dir);
+}
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <chrono>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "wal.h"
+
+using namespace Akumuli;
+
+void test_logger(int tag, const char* msg) {
+    BOOST_MESSAGE(msg);
+}
+
+//! Temporary directory for log segments
+struct TempDir {
+    boost::filesystem::path path;
+
+    TempDir() {
+        path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+        boost::filesystem::create_directories(path);
+    }
+
+    ~TempDir() {
+        boost::filesystem::remove_all(path);
+    }
+
+    std::string base() const {
+        return (path / "test.wal").string();
+    }
+
+    size_t nfiles() const {
+        return static_cast<size_t>(std::distance(boost::filesystem::directory_iterator(path),
+                                                 boost::filesystem::directory_iterator()));
+    }
+};
+
+struct Record {
+    aku_Timestamp ts;
+    aku_ParamId   id;
+    double        value;
+    std::string   blob;
+    bool          is_blob;
+};
+
+static std::vector<Record> replay_all(std::string const& base) {
+    std::vector<Record> result;
+    WriteAheadLog wal(base, 0u, &test_logger);
+    auto status = wal.replay([&](TimeSeriesValue const& value, aku_MemRange data) {
+        Record rec = { value.get_timestamp(), value.get_paramid(), 0.0, std::string(), value.is_blob() };
+        if (rec.is_blob) {
+            rec.blob.assign(static_cast<const char*>(data.address), data.length);
+        } else {
+            rec.value = value.payload.value;
+        }
+        result.push_back(rec);
+        return AKU_SUCCESS;
+    });
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_append_and_replay) {
+    TempDir dir;
+    {
+        WriteAheadLog wal(dir.base(), 1000u, &test_logger);
+        for (int i = 0; i < 1000; i++) {
+            aku_MemRange empty = {};
+            BOOST_REQUIRE_EQUAL(wal.append(TimeSeriesValue(i, i % 10, i*0.5), empty), AKU_SUCCESS);
+        }
+        std::string payload = "blob payload";
+        aku_MemRange range = { const_cast<char*>(payload.data()), static_cast<uint32_t>(payload.size()) };
+        BOOST_REQUIRE_EQUAL(wal.append(TimeSeriesValue(1000u, 42u, 0u, range.length), range), AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(wal.sync(), AKU_SUCCESS);
+    }
+    auto records = replay_all(dir.base());
+    BOOST_REQUIRE_EQUAL(records.size(), 1001u);
+    for (int i = 0; i < 1000; i++) {
+        BOOST_REQUIRE_EQUAL(records[i].ts, static_cast<aku_Timestamp>(i));
+        BOOST_REQUIRE_EQUAL(records[i].id, static_cast<aku_ParamId>(i % 10));
+        BOOST_REQUIRE(!records[i].is_blob);
+        BOOST_REQUIRE_EQUAL(records[i].value, i*0.5);
+    }
+    BOOST_REQUIRE(records.back().is_blob);
+    BOOST_REQUIRE_EQUAL(records.back().blob, "blob payload");
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_damaged_tail) {
+    TempDir dir;
+    {
+        WriteAheadLog wal(dir.base(), 1000u, &test_logger);
+        for (int i = 0; i < 100; i++) {
+            aku_MemRange empty = {};
+            BOOST_REQUIRE_EQUAL(wal.append(TimeSeriesValue(i, 1u, 1.0), empty), AKU_SUCCESS);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(dir.nfiles(), 1u);
+    // Simulate incomplete write
+    auto segment = boost::filesystem::directory_iterator(dir.path)->path();
+    auto size = boost::filesystem::file_size(segment);
+    boost::filesystem::resize_file(segment, size - 3);
+    {
+        // New records are written to the new segment
+        WriteAheadLog wal(dir.base(), 1000u, &test_logger);
+        BOOST_REQUIRE_EQUAL(replay_all(dir.base()).size(), 99u);
+        aku_MemRange empty = {};
+        BOOST_REQUIRE_EQUAL(wal.append(TimeSeriesValue(100u, 1u, 1.0), empty), AKU_SUCCESS);
+    }
+    auto records = replay_all(dir.base());
+    BOOST_REQUIRE_EQUAL(records.size(), 100u);
+    BOOST_REQUIRE_EQUAL(records.back().ts, 100u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_truncate_and_reset) {
+    TempDir dir;
+    WriteAheadLog wal(dir.base(), 1000u, &test_logger);
+    BOOST_REQUIRE_EQUAL(wal.replay([](TimeSeriesValue const&, aku_MemRange) { return AKU_SUCCESS; }), AKU_SUCCESS);
+    // Fill several segments
+    std::string payload(0x1000, 'x');
+    aku_MemRange range = { const_cast<char*>(payload.data()), static_cast<uint32_t>(payload.size()) };
+    const int N = 2*WriteAheadLog::SEGMENT_SIZE/payload.size() + 1;
+    for (int i = 0; i < N; i++) {
+        BOOST_REQUIRE_EQUAL(wal.append(TimeSeriesValue(i, 1u, 0u, range.length), range), AKU_SUCCESS);
+    }
+    BOOST_REQUIRE(dir.nfiles() >= 3u);
+    auto nfiles = dir.nfiles();
+    // Nothing is durable
+    wal.truncate(0u);
+    BOOST_REQUIRE_EQUAL(dir.nfiles(), nfiles);
+    // First segment is durable
+    wal.truncate(N/2);
+    BOOST_REQUIRE_EQUAL(dir.nfiles(), nfiles - 1);
+    wal.reset();
+    BOOST_REQUIRE_EQUAL(dir.nfiles(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_sync_if_stale) {
+    TempDir dir;
+    WriteAheadLog wal(dir.base(), 50u, &test_logger);
+    for (int i = 0; i < 10; i++) {
+        aku_MemRange empty = {};
+        BOOST_REQUIRE_EQUAL(wal.append(TimeSeriesValue(i, 1u, 1.0), empty), AKU_SUCCESS);
+    }
+    // Records are buffered until fsync interval elapses
+    BOOST_REQUIRE_EQUAL(wal.sync_if_stale(), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(replay_all(dir.base()).size(), 0u);
+    // No more writes, records should be synced by the periodic call
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    BOOST_REQUIRE_EQUAL(wal.sync_if_stale(), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(replay_all(dir.base()).size(), 10u);
+}